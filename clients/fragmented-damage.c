@@ -0,0 +1,368 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+#include <wayland-client.h>
+#include "../shared/os-compatibility.h"
+
+/* Redraws a checkerboard of small cells every frame and damages each
+ * changed cell separately, so that the compositor has to repaint a region
+ * made of thousands of rectangles.  Prints the frame rate every five
+ * seconds; with the compositor running on a software GL driver this is
+ * limited by how fast it can draw the fragmented damage. */
+
+struct display {
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *compositor;
+	struct wl_shell *shell;
+	struct wl_shm *shm;
+};
+
+struct buffer {
+	struct wl_buffer *buffer;
+	uint32_t *data;
+	int busy;
+};
+
+struct window {
+	struct display *display;
+	int width, height, cell;
+	struct wl_surface *surface;
+	struct wl_shell_surface *shell_surface;
+	struct buffer buffers[2];
+	struct wl_callback *callback;
+	uint32_t frame;		/* never reset, picks the cells to repaint */
+	uint32_t frames, benchmark_time;
+};
+
+static int running = 1;
+
+static void
+buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct buffer *mybuf = data;
+
+	mybuf->busy = 0;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	buffer_release
+};
+
+static int
+create_shm_buffer(struct display *display, struct buffer *buffer,
+		  int width, int height)
+{
+	struct wl_shm_pool *pool;
+	int fd, size, stride;
+	void *data;
+
+	stride = width * 4;
+	size = stride * height;
+
+	fd = os_create_anonymous_file(size);
+	if (fd < 0) {
+		fprintf(stderr, "creating a buffer file for %d B failed: %m\n",
+			size);
+		return -1;
+	}
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %m\n");
+		close(fd);
+		return -1;
+	}
+
+	pool = wl_shm_create_pool(display->shm, fd, size);
+	buffer->buffer = wl_shm_pool_create_buffer(pool, 0, width, height,
+						   stride,
+						   WL_SHM_FORMAT_XRGB8888);
+	wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	buffer->data = data;
+
+	return 0;
+}
+
+static void
+handle_ping(void *data, struct wl_shell_surface *shell_surface,
+	    uint32_t serial)
+{
+	wl_shell_surface_pong(shell_surface, serial);
+}
+
+static void
+handle_configure(void *data, struct wl_shell_surface *shell_surface,
+		 uint32_t edges, int32_t width, int32_t height)
+{
+}
+
+static void
+handle_popup_done(void *data, struct wl_shell_surface *shell_surface)
+{
+}
+
+static const struct wl_shell_surface_listener shell_surface_listener = {
+	handle_ping,
+	handle_configure,
+	handle_popup_done
+};
+
+static struct buffer *
+window_next_buffer(struct window *window)
+{
+	struct buffer *buffer;
+
+	if (!window->buffers[0].busy)
+		buffer = &window->buffers[0];
+	else if (!window->buffers[1].busy)
+		buffer = &window->buffers[1];
+	else
+		return NULL;
+
+	if (!buffer->buffer &&
+	    create_shm_buffer(window->display, buffer,
+			      window->width, window->height) < 0)
+		return NULL;
+
+	return buffer;
+}
+
+static uint32_t
+cell_color(uint32_t frame)
+{
+	return 0xff000000 | ((frame * 0x010307) & 0x00ffffff);
+}
+
+/* Cells where (column + row + frame) is even get a new color each frame,
+ * the others keep the one they got the frame before, so every frame
+ * changes and damages half of the cells in a pattern that can't be
+ * merged into larger rectangles.  The buffers alternate, so the whole
+ * buffer is painted to keep the undamaged cells right too. */
+static void
+paint_cells(struct window *window, uint32_t *pixel, uint32_t frame)
+{
+	uint32_t color[2] = { cell_color(frame), cell_color(frame - 1) };
+	int x, y;
+
+	for (y = 0; y < window->height; y++)
+		for (x = 0; x < window->width; x++)
+			*pixel++ = color[(x / window->cell + y / window->cell +
+					  frame) & 1];
+}
+
+static void
+damage_cells(struct window *window, uint32_t frame)
+{
+	int x, y, cell = window->cell;
+
+	for (y = 0; y < window->height; y += cell)
+		for (x = 0; x < window->width; x += cell)
+			if (((x / cell + y / cell + frame) & 1) == 0)
+				wl_surface_damage(window->surface,
+						  x, y, cell, cell);
+}
+
+static const struct wl_callback_listener frame_listener;
+
+static void
+redraw(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct window *window = data;
+	struct buffer *buffer;
+
+	buffer = window_next_buffer(window);
+	if (!buffer) {
+		fprintf(stderr,
+			!callback ? "Failed to create the first buffer.\n" :
+			"Both buffers busy at redraw(). Server bug?\n");
+		abort();
+	}
+
+	if (window->benchmark_time == 0)
+		window->benchmark_time = time;
+	if (time - window->benchmark_time > 5000) {
+		printf("%u frames in 5 seconds: %.1f fps\n", window->frames,
+		       window->frames * 1000.0 /
+		       (time - window->benchmark_time));
+		window->benchmark_time = time;
+		window->frames = 0;
+	}
+
+	paint_cells(window, buffer->data, window->frame);
+
+	wl_surface_attach(window->surface, buffer->buffer, 0, 0);
+	if (callback)
+		damage_cells(window, window->frame);
+	else
+		wl_surface_damage(window->surface, 0, 0,
+				  window->width, window->height);
+
+	if (callback)
+		wl_callback_destroy(callback);
+
+	window->callback = wl_surface_frame(window->surface);
+	wl_callback_add_listener(window->callback, &frame_listener, window);
+	wl_surface_commit(window->surface);
+	buffer->busy = 1;
+	window->frame++;
+	window->frames++;
+}
+
+static const struct wl_callback_listener frame_listener = {
+	redraw
+};
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t id, const char *interface, uint32_t version)
+{
+	struct display *d = data;
+
+	if (strcmp(interface, "wl_compositor") == 0)
+		d->compositor = wl_registry_bind(registry, id,
+						 &wl_compositor_interface, 1);
+	else if (strcmp(interface, "wl_shell") == 0)
+		d->shell = wl_registry_bind(registry, id,
+					    &wl_shell_interface, 1);
+	else if (strcmp(interface, "wl_shm") == 0)
+		d->shm = wl_registry_bind(registry, id,
+					  &wl_shm_interface, 1);
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+static void
+signal_int(int signum)
+{
+	running = 0;
+}
+
+static void
+usage(int error_code)
+{
+	fprintf(stderr, "Usage: fragmented-damage [OPTIONS]\n\n"
+		"  -s <size>\tWindow width and height (default 512)\n"
+		"  -c <size>\tCell width and height (default 8)\n"
+		"  -h\t\tThis help text\n\n");
+
+	exit(error_code);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sigaction sigint;
+	struct display display = { 0 };
+	struct window window = { 0 };
+	int i, opt, ret = 0;
+
+	window.width = window.height = 512;
+	window.cell = 8;
+
+	while ((opt = getopt(argc, argv, "s:c:h")) != -1) {
+		switch (opt) {
+		case 's':
+			window.width = window.height = atoi(optarg);
+			break;
+		case 'c':
+			window.cell = atoi(optarg);
+			break;
+		case 'h':
+			usage(EXIT_SUCCESS);
+		default:
+			usage(EXIT_FAILURE);
+		}
+	}
+
+	if (window.width <= 0 || window.cell <= 0)
+		usage(EXIT_FAILURE);
+
+	display.display = wl_display_connect(NULL);
+	assert(display.display);
+
+	display.registry = wl_display_get_registry(display.display);
+	wl_registry_add_listener(display.registry,
+				 &registry_listener, &display);
+	wl_display_roundtrip(display.display);
+	if (display.shm == NULL || display.shell == NULL) {
+		fprintf(stderr, "wl_shm or wl_shell not available\n");
+		return 1;
+	}
+
+	window.display = &display;
+	window.surface = wl_compositor_create_surface(display.compositor);
+	window.shell_surface = wl_shell_get_shell_surface(display.shell,
+							  window.surface);
+	wl_shell_surface_add_listener(window.shell_surface,
+				      &shell_surface_listener, &window);
+	wl_shell_surface_set_title(window.shell_surface, "fragmented-damage");
+	wl_shell_surface_set_toplevel(window.shell_surface);
+
+	sigint.sa_handler = signal_int;
+	sigemptyset(&sigint.sa_mask);
+	sigint.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &sigint, NULL);
+
+	redraw(&window, NULL, 0);
+
+	while (running && ret != -1)
+		ret = wl_display_dispatch(display.display);
+
+	if (window.callback)
+		wl_callback_destroy(window.callback);
+	for (i = 0; i < 2; i++) {
+		if (!window.buffers[i].buffer)
+			continue;
+		wl_buffer_destroy(window.buffers[i].buffer);
+		munmap(window.buffers[i].data,
+		       window.width * window.height * 4);
+	}
+	wl_shell_surface_destroy(window.shell_surface);
+	wl_surface_destroy(window.surface);
+	wl_display_disconnect(display.display);
+
+	return 0;
+}
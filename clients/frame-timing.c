@@ -0,0 +1,227 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <wayland-client.h>
+#include "frame-timing-client-protocol.h"
+
+/* Prints the frame timing histograms that weston keeps for each output.
+ * weston only advertises the interface with frame-timing-protocol=true
+ * in the [core] section of weston.ini. */
+
+static struct weston_frame_timing *frame_timing;
+static struct wl_list output_list;
+static int histograms_done;
+
+static const char *stat_names[] = {
+	"build view list",
+	"assign planes",
+	"accumulate damage",
+	"repaint",
+	"frame callbacks",
+	"frame interval",
+	"present",
+	"commit to present",
+};
+
+struct timing_output {
+	struct wl_output *output;
+	char *make, *model;
+	struct wl_list link;
+};
+
+static void
+display_handle_geometry(void *data,
+			struct wl_output *wl_output,
+			int x,
+			int y,
+			int physical_width,
+			int physical_height,
+			int subpixel,
+			const char *make,
+			const char *model,
+			int transform)
+{
+	struct timing_output *output = data;
+
+	free(output->make);
+	free(output->model);
+	output->make = strdup(make);
+	output->model = strdup(model);
+}
+
+static void
+display_handle_mode(void *data,
+		    struct wl_output *wl_output,
+		    uint32_t flags,
+		    int width,
+		    int height,
+		    int refresh)
+{
+}
+
+static const struct wl_output_listener output_listener = {
+	display_handle_geometry,
+	display_handle_mode
+};
+
+static void
+frame_timing_histogram(void *data, struct weston_frame_timing *timing,
+		       uint32_t stat, uint32_t count,
+		       uint32_t sum_hi, uint32_t sum_lo, uint32_t max,
+		       struct wl_array *buckets)
+{
+	uint64_t sum = ((uint64_t) sum_hi << 32) | sum_lo;
+	uint32_t *b, n;
+	int i;
+
+	if (count == 0)
+		return;
+
+	printf("  %-18s n %-7u avg %-7llu max %u\n",
+	       stat < sizeof stat_names / sizeof stat_names[0] ?
+	       stat_names[stat] : "unknown", count,
+	       (unsigned long long) (sum / count), max);
+
+	n = buckets->size / sizeof *b;
+	b = buckets->data;
+	for (i = 0; i < (int) n; i++) {
+		if (b[i] == 0)
+			continue;
+		if (i == (int) n - 1)
+			printf("    >= %-8u %u\n", 1u << (i - 1), b[i]);
+		else
+			printf("    <  %-8u %u\n", 1u << i, b[i]);
+	}
+}
+
+static void
+frame_timing_done(void *data, struct weston_frame_timing *timing)
+{
+	histograms_done = 1;
+}
+
+static const struct weston_frame_timing_listener frame_timing_listener = {
+	frame_timing_histogram,
+	frame_timing_done
+};
+
+static void
+handle_global(void *data, struct wl_registry *registry,
+	      uint32_t name, const char *interface, uint32_t version)
+{
+	struct timing_output *output;
+
+	if (strcmp(interface, "wl_output") == 0) {
+		output = calloc(1, sizeof *output);
+		if (output == NULL)
+			return;
+		output->output = wl_registry_bind(registry, name,
+						  &wl_output_interface, 1);
+		wl_list_insert(output_list.prev, &output->link);
+		wl_output_add_listener(output->output,
+				       &output_listener, output);
+	} else if (strcmp(interface, "weston_frame_timing") == 0) {
+		frame_timing = wl_registry_bind(registry, name,
+						&weston_frame_timing_interface,
+						1);
+	}
+}
+
+static void
+handle_global_remove(void *data, struct wl_registry *registry, uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	handle_global,
+	handle_global_remove
+};
+
+int main(int argc, char *argv[])
+{
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct timing_output *output;
+	int reset = 0;
+
+	if (argc == 2 && strcmp(argv[1], "--reset") == 0) {
+		reset = 1;
+	} else if (argc != 1) {
+		fprintf(stderr, "usage: %s [--reset]\n",
+			program_invocation_short_name);
+		return -1;
+	}
+
+	display = wl_display_connect(NULL);
+	if (display == NULL) {
+		fprintf(stderr, "failed to create display: %m\n");
+		return -1;
+	}
+
+	wl_list_init(&output_list);
+	registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, NULL);
+	wl_display_roundtrip(display);
+	if (frame_timing == NULL) {
+		fprintf(stderr, "display doesn't support weston_frame_timing, "
+			"is frame-timing-protocol enabled in weston.ini?\n");
+		return -1;
+	}
+
+	/* Second roundtrip for the output geometry events. */
+	wl_display_roundtrip(display);
+
+	weston_frame_timing_add_listener(frame_timing,
+					 &frame_timing_listener, NULL);
+
+	wl_list_for_each(output, &output_list, link) {
+		if (reset) {
+			weston_frame_timing_reset(frame_timing,
+						  output->output);
+			continue;
+		}
+
+		printf("%s %s (times in us):\n",
+		       output->make ? output->make : "unknown",
+		       output->model ? output->model : "output");
+
+		histograms_done = 0;
+		weston_frame_timing_get(frame_timing, output->output);
+		while (!histograms_done)
+			if (wl_display_dispatch(display) < 0)
+				return -1;
+	}
+
+	weston_frame_timing_destroy(frame_timing);
+	wl_display_roundtrip(display);
+	wl_display_disconnect(display);
+
+	return 0;
+}
@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <math.h>
@@ -50,6 +51,7 @@ static char *option_font;
 static int option_font_size;
 static char *option_term;
 static char *option_shell;
+static char *option_replay;
 
 static struct wl_list terminal_list;
 
@@ -84,6 +86,12 @@ terminal_run(struct terminal *terminal, const char *path);
 #define MAX_RESPONSE		256
 #define MAX_ESCAPE		255
 
+/* The pty is read this much at a time, up to the budget per wakeup so
+ * that a program flooding the terminal doesn't starve input and redraws.
+ */
+#define READ_SIZE		65536
+#define READ_BUDGET		(16 * READ_SIZE)
+
 /* Terminal modes */
 #define MODE_SHOW_CURSOR	0x00000001
 #define MODE_INVERSE		0x00000002
@@ -398,6 +406,289 @@ attr_init(struct attr *data_attr, struct attr attr, int n)
 	}
 }
 
+/* Lines that scrolled off the top of the screen.  Each one is packed by
+ * scrollback_pack() into a block of up to SCROLLBACK_BLOCK_LINES lines,
+ * so it costs what it holds rather than a full row of cells.  The blocks
+ * form a ring; when it is full the oldest block is dropped and its
+ * storage reused, so it holds at least SCROLLBACK_LINES lines and at
+ * most a block more.  Lines are packed at whatever width they had and only
+ * laid out to the current width when shown, so a resize doesn't touch
+ * them. */
+#define SCROLLBACK_LINES	1024
+#define SCROLLBACK_BLOCK_LINES	64
+
+struct scrollback_block {
+	int count;
+	uint32_t size, alloc;
+	uint32_t offset[SCROLLBACK_BLOCK_LINES];
+	unsigned char *data;
+};
+
+struct scrollback {
+	struct scrollback_block *blocks;
+	int n_blocks, head, used;
+	uint32_t lines;		/* lines held */
+	uint32_t pushed;	/* lines ever pushed, numbers them */
+
+	/* Lines unpacked for display, in slot line % n_cached */
+	union utf8_char *cache_data;
+	struct attr *cache_attr;
+	uint32_t *cache_tag;	/* line number + 1, or 0 */
+	int n_cached, cache_width;
+};
+
+/* A packed line starts with this header, followed by 'runs' attribute
+ * runs of a count byte and a struct attr, then the cells: an empty cell
+ * or ASCII character as one byte, anything else as 0xf8 plus its length
+ * followed by its bytes.  Blank cells at the end with attribute 'fill'
+ * are dropped. */
+struct scrollback_line {
+	uint16_t cells, runs;
+	struct attr fill;
+};
+
+#define SCROLLBACK_MULTIBYTE	0xf8
+
+static int
+attr_equal(struct attr a, struct attr b)
+{
+	return a.fg == b.fg && a.bg == b.bg && a.a == b.a && a.s == b.s;
+}
+
+static size_t
+scrollback_pack(unsigned char *p, const union utf8_char *data,
+		const struct attr *attr, int width)
+{
+	struct scrollback_line line;
+	unsigned char *start = p;
+	int i, n, run;
+
+	line.fill = attr[width - 1];
+	for (n = width; n > 0; n--)
+		if (data[n - 1].ch != 0 || !attr_equal(attr[n - 1], line.fill))
+			break;
+	line.cells = n;
+
+	p += sizeof line;
+	line.runs = 0;
+	for (i = 0; i < n; i += run) {
+		for (run = 1; i + run < n && run < 255; run++)
+			if (!attr_equal(attr[i + run], attr[i]))
+				break;
+		*p++ = run;
+		memcpy(p, &attr[i], sizeof *attr);
+		p += sizeof *attr;
+		line.runs++;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (data[i].byte[0] < 0x80 && data[i].byte[1] == 0) {
+			*p++ = data[i].byte[0];
+		} else {
+			run = strnlen((const char *) data[i].byte, 4);
+			*p++ = SCROLLBACK_MULTIBYTE + run;
+			memcpy(p, data[i].byte, run);
+			p += run;
+		}
+	}
+
+	memcpy(start, &line, sizeof line);
+
+	return p - start;
+}
+
+static void
+scrollback_unpack(const unsigned char *p, union utf8_char *data,
+		  struct attr *attr, int width)
+{
+	struct scrollback_line line;
+	int i, k, n, run;
+
+	memcpy(&line, p, sizeof line);
+	p += sizeof line;
+
+	n = line.cells < width ? line.cells : width;
+	for (i = 0, k = 0; k < line.runs; k++) {
+		run = *p++;
+		for (; run > 0 && i < n; run--)
+			memcpy(&attr[i++], p, sizeof *attr);
+		p += sizeof *attr;
+	}
+	attr_init(attr + n, line.fill, width - n);
+
+	memset(data, 0, width * sizeof *data);
+	for (i = 0; i < n; i++) {
+		if (*p < SCROLLBACK_MULTIBYTE) {
+			data[i].byte[0] = *p++;
+		} else {
+			run = *p++ - SCROLLBACK_MULTIBYTE;
+			memcpy(data[i].byte, p, run);
+			p += run;
+		}
+	}
+}
+
+static void
+scrollback_init(struct scrollback *sb)
+{
+	memset(sb, 0, sizeof *sb);
+	sb->n_blocks = SCROLLBACK_LINES / SCROLLBACK_BLOCK_LINES + 1;
+	sb->blocks = zalloc(sb->n_blocks * sizeof *sb->blocks);
+}
+
+static void
+scrollback_release(struct scrollback *sb)
+{
+	int i;
+
+	for (i = 0; i < sb->n_blocks; i++)
+		free(sb->blocks[i].data);
+	free(sb->blocks);
+	free(sb->cache_data);
+	free(sb->cache_attr);
+	free(sb->cache_tag);
+}
+
+static struct scrollback_block *
+scrollback_block(struct scrollback *sb, int i)
+{
+	return &sb->blocks[(sb->head + i) % sb->n_blocks];
+}
+
+static void
+scrollback_push(struct scrollback *sb, const union utf8_char *data,
+		const struct attr *attr, int width)
+{
+	struct scrollback_block *block = NULL;
+	uint32_t need, alloc;
+	unsigned char *p;
+
+	if (width <= 0)
+		return;
+
+	if (sb->used > 0)
+		block = scrollback_block(sb, sb->used - 1);
+
+	if (!block || block->count == SCROLLBACK_BLOCK_LINES) {
+		if (sb->used == sb->n_blocks) {
+			sb->lines -= sb->blocks[sb->head].count;
+			sb->head = (sb->head + 1) % sb->n_blocks;
+			sb->used--;
+		}
+		block = scrollback_block(sb, sb->used++);
+		block->count = 0;
+		block->size = 0;
+	}
+
+	/* Worst case: a run and a multibyte cell for every cell. */
+	need = block->size + sizeof (struct scrollback_line) +
+		width * (1 + sizeof *attr + 5);
+	if (need > block->alloc) {
+		alloc = block->alloc ? block->alloc : 4096;
+		while (alloc < need)
+			alloc *= 2;
+		p = realloc(block->data, alloc);
+		if (!p)
+			return;
+		block->data = p;
+		block->alloc = alloc;
+	}
+
+	block->offset[block->count++] = block->size;
+	block->size += scrollback_pack(block->data + block->size,
+				       data, attr, width);
+	sb->lines++;
+	sb->pushed++;
+}
+
+/* The packed line 'back' lines up from the newest one, which is 1. */
+static const unsigned char *
+scrollback_get(struct scrollback *sb, uint32_t back)
+{
+	struct scrollback_block *block;
+	uint32_t i;
+
+	if (back == 0 || back > sb->lines)
+		return NULL;
+
+	/* Only the newest block can be partly filled. */
+	i = sb->lines - back;
+	block = scrollback_block(sb, i / SCROLLBACK_BLOCK_LINES);
+
+	return block->data + block->offset[i % SCROLLBACK_BLOCK_LINES];
+}
+
+/* Takes the newest line back out, unpacked to 'width' cells. */
+static int
+scrollback_pop(struct scrollback *sb, union utf8_char *data,
+	       struct attr *attr, int width)
+{
+	struct scrollback_block *block;
+
+	if (sb->lines == 0)
+		return -1;
+
+	scrollback_unpack(scrollback_get(sb, 1), data, attr, width);
+
+	if (sb->n_cached)
+		sb->cache_tag[(sb->pushed - 1) % sb->n_cached] = 0;
+
+	block = scrollback_block(sb, sb->used - 1);
+	block->size = block->offset[--block->count];
+	if (block->count == 0)
+		sb->used--;
+	sb->lines--;
+	sb->pushed--;
+
+	return 0;
+}
+
+static void
+scrollback_resize_cache(struct scrollback *sb, int lines, int width)
+{
+	free(sb->cache_data);
+	free(sb->cache_attr);
+	free(sb->cache_tag);
+
+	sb->n_cached = lines > 0 ? lines : 1;
+	sb->cache_width = width;
+	sb->cache_data = malloc(sb->n_cached * width * sizeof *sb->cache_data);
+	sb->cache_attr = malloc(sb->n_cached * width * sizeof *sb->cache_attr);
+	sb->cache_tag = zalloc(sb->n_cached * sizeof *sb->cache_tag);
+}
+
+/* Unpacks line 'back' into the display cache, unless it's there
+ * already, and returns its slot.  Lines past the oldest are blank. */
+static int
+scrollback_cache(struct scrollback *sb, uint32_t back, struct attr blank)
+{
+	const unsigned char *line;
+	uint32_t number = sb->pushed - back;
+	int slot, width;
+
+	/* Sized with the screen, so empty as long as the screen is. */
+	if (sb->n_cached == 0)
+		scrollback_resize_cache(sb, 1, sb->cache_width);
+
+	slot = number % sb->n_cached;
+	width = sb->cache_width;
+	if (sb->cache_tag[slot] == number + 1)
+		return slot;
+
+	line = scrollback_get(sb, back);
+	if (line) {
+		scrollback_unpack(line, &sb->cache_data[slot * width],
+				  &sb->cache_attr[slot * width], width);
+	} else {
+		memset(&sb->cache_data[slot * width], 0,
+		       width * sizeof *sb->cache_data);
+		attr_init(&sb->cache_attr[slot * width], blank, width);
+	}
+	sb->cache_tag[slot] = number + 1;
+
+	return slot;
+}
+
 enum escape_state {
 	escape_state_normal = 0,
 	escape_state_escape,
@@ -424,6 +715,24 @@ enum {
 	SELECT_LINE
 };
 
+/* What cairo_scaled_font_text_to_glyphs() made of a cell, with the
+ * glyphs placed relative to the cell origin, so that redraws only have to
+ * look the cell up.  Direct-mapped: ASCII has slots of its own and the
+ * rest of the characters share the others, evicting each other on
+ * collision. */
+#define GLYPH_CACHE_SIZE 1024
+
+struct glyph_cache_entry {
+	uint32_t ch;
+	int count;		/* -1 for an empty slot */
+	cairo_glyph_t glyphs[4];
+};
+
+struct glyph_cache {
+	cairo_scaled_font_t *font;
+	struct glyph_cache_entry entries[GLYPH_CACHE_SIZE];
+};
+
 struct terminal {
 	struct window *window;
 	struct widget *widget;
@@ -445,8 +754,9 @@ struct terminal {
 	keyboard_mode key_mode;
 	int data_pitch, attr_pitch;  /* The width in bytes of a line */
 	int width, height, row, column, max_width;
-	uint32_t buffer_height;
-	uint32_t start, end, saved_start, log_size;
+	int start;  /* The screen is a ring of rows, starting here */
+	struct scrollback scrollback;
+	int view_offset;  /* Scrollback lines shown above the screen */
 	int saved_row, saved_column;
 	int scrolling;
 	int send_cursor_position;
@@ -464,6 +774,7 @@ struct terminal {
 	cairo_font_extents_t extents;
 	double average_width;
 	cairo_scaled_font_t *font_normal, *font_bold;
+	struct glyph_cache *glyphs_normal, *glyphs_bold;
 	uint32_t hide_cursor_serial;
 
 	struct wl_data_source *selection;
@@ -473,6 +784,8 @@ struct terminal {
 	int selection_end_x, selection_end_y;
 	int selection_start_row, selection_start_col;
 	int selection_end_row, selection_end_col;
+	char *dirty;  /* One per row, set until terminal_damage() */
+	int damaged_cursor_row;
 	struct wl_list link;
 };
 
@@ -546,12 +859,35 @@ init_color_table(struct terminal *terminal)
 	}
 }
 
+/* Rows are counted from the top of the view, which is view_offset lines
+ * up into the scrollback when scrolled back. */
+static int
+terminal_row_index(struct terminal *terminal, int row)
+{
+	row -= terminal->view_offset;
+	if (row < 0)
+		return -1;
+
+	row += terminal->start;
+	if (row >= terminal->height)
+		row %= terminal->height;
+
+	return row;
+}
+
 static union utf8_char *
 terminal_get_row(struct terminal *terminal, int row)
 {
-	int index;
+	int index, slot;
 
-	index = (row + terminal->start) & (terminal->buffer_height - 1);
+	index = terminal_row_index(terminal, row);
+	if (index < 0) {
+		slot = scrollback_cache(&terminal->scrollback,
+					terminal->view_offset - row,
+					terminal->color_scheme->default_attr);
+		return (void *) terminal->scrollback.cache_data +
+			slot * terminal->data_pitch;
+	}
 
 	return (void *) terminal->data + index * terminal->data_pitch;
 }
@@ -559,13 +895,105 @@ terminal_get_row(struct terminal *terminal, int row)
 static struct attr*
 terminal_get_attr_row(struct terminal *terminal, int row)
 {
-	int index;
+	int index, slot;
 
-	index = (row + terminal->start) & (terminal->buffer_height - 1);
+	index = terminal_row_index(terminal, row);
+	if (index < 0) {
+		slot = scrollback_cache(&terminal->scrollback,
+					terminal->view_offset - row,
+					terminal->color_scheme->default_attr);
+		return (void *) terminal->scrollback.cache_attr +
+			slot * terminal->attr_pitch;
+	}
 
 	return (void *) terminal->data_attr + index * terminal->attr_pitch;
 }
 
+/* Rows down to the last one with anything written in it. */
+static int
+terminal_used_rows(struct terminal *terminal)
+{
+	union utf8_char *data;
+	int row, col;
+
+	for (row = terminal->height; row > 0; row--) {
+		data = terminal_get_row(terminal, row - 1);
+		for (col = 0; col < terminal->width; col++)
+			if (data[col].ch != 0)
+				return row;
+	}
+
+	return 0;
+}
+
+/* Marks rows first to last, inclusive, as changed. */
+static void
+terminal_dirty_rows(struct terminal *terminal, int first, int last)
+{
+	if (first < 0)
+		first = 0;
+	if (last >= terminal->height)
+		last = terminal->height - 1;
+	if (first <= last)
+		memset(&terminal->dirty[first], 1, last - first + 1);
+}
+
+static void
+terminal_dirty_all(struct terminal *terminal)
+{
+	terminal_dirty_rows(terminal, 0, terminal->height - 1);
+}
+
+/* Reports the rows changed since the last call, along with the rows the
+ * cursor moved between, as damage and schedules a redraw of them. */
+static void
+terminal_damage(struct terminal *terminal)
+{
+	struct rectangle allocation;
+	int row, first, top_margin, y1, y2;
+	double ch = terminal->extents.height;
+
+	terminal_dirty_rows(terminal, terminal->damaged_cursor_row,
+			    terminal->damaged_cursor_row);
+	terminal_dirty_rows(terminal, terminal->row, terminal->row);
+	terminal->damaged_cursor_row = terminal->row;
+
+	widget_get_allocation(terminal->widget, &allocation);
+	top_margin = (allocation.height - terminal->height * ch) / 2;
+
+	for (row = 0; row < terminal->height; row++) {
+		if (!terminal->dirty[row])
+			continue;
+
+		first = row;
+		while (row < terminal->height && terminal->dirty[row])
+			terminal->dirty[row++] = 0;
+
+		y1 = floor(first * ch);
+		y2 = ceil(row * ch);
+		widget_damage(terminal->widget, allocation.x,
+			      allocation.y + top_margin + y1,
+			      allocation.width, y2 - y1);
+	}
+}
+
+/* Scrolls the view back down to the screen. */
+static void
+terminal_reset_view(struct terminal *terminal)
+{
+	int d = terminal->view_offset;
+
+	if (!terminal->scrolling)
+		return;
+
+	terminal->row -= d;
+	terminal->selection_start_row -= d;
+	terminal->selection_end_row -= d;
+	terminal->view_offset = 0;
+	terminal->scrolling = 0;
+	terminal_dirty_all(terminal);
+}
+
 union decoded_attr {
 	struct attr attr;
 	uint32_t key;
@@ -624,26 +1052,38 @@ terminal_decode_attr(struct terminal *terminal, int row, int col,
 static void
 terminal_scroll_buffer(struct terminal *terminal, int d)
 {
-	int i;
+	int i, n;
 
-	terminal->start += d;
+	/* Rows scrolled off the top go to the scrollback, rows scrolled
+	 * off the bottom are lost. */
+	n = abs(d) < terminal->height ? abs(d) : terminal->height;
 	if (d < 0) {
-		d = 0 - d;
-		for (i = 0; i < d; i++) {
+		terminal->start = (terminal->start + terminal->height - n) %
+			terminal->height;
+		for (i = 0; i < n; i++) {
 			memset(terminal_get_row(terminal, i), 0, terminal->data_pitch);
 			attr_init(terminal_get_attr_row(terminal, i),
 			    terminal->curr_attr, terminal->width);
 		}
 	} else {
-		for (i = terminal->height - d; i < terminal->height; i++) {
+		for (i = 0; i < n; i++)
+			scrollback_push(&terminal->scrollback,
+					terminal_get_row(terminal, i),
+					terminal_get_attr_row(terminal, i),
+					terminal->max_width);
+		terminal->start = (terminal->start + n) % terminal->height;
+		for (i = terminal->height - n; i < terminal->height; i++) {
 			memset(terminal_get_row(terminal, i), 0, terminal->data_pitch);
 			attr_init(terminal_get_attr_row(terminal, i),
 			    terminal->curr_attr, terminal->width);
 		}
 	}
 
+	d = abs(d);
 	terminal->selection_start_row -= d;
 	terminal->selection_end_row -= d;
+
+	terminal_dirty_all(terminal);
 }
 
 static void
@@ -692,6 +1132,9 @@ terminal_scroll_window(struct terminal *terminal, int d)
 				terminal->curr_attr, terminal->width);
 		}
 	}
+
+	terminal_dirty_rows(terminal, terminal->margin_top,
+			    terminal->margin_bottom);
 }
 
 static void
@@ -734,6 +1177,8 @@ terminal_shift_line(struct terminal *terminal, int d)
 		memset(&row[terminal->column], 0, d * sizeof(union utf8_char));
 		attr_init(&attr_row[terminal->column], terminal->curr_attr, d);
 	}
+
+	terminal_dirty_rows(terminal, terminal->row, terminal->row);
 }
 
 static void
@@ -744,77 +1189,90 @@ terminal_resize_cells(struct terminal *terminal,
 	struct attr *data_attr;
 	char *tab_ruler;
 	int data_pitch, attr_pitch;
-	int i, l, total_rows;
-	uint32_t d, uheight = height;
+	int i, l, pitch, shift, pull;
 	struct rectangle allocation;
 	struct winsize ws;
 
-	if (uheight > terminal->buffer_height)
-		height = terminal->buffer_height;
+	if (width < 1)
+		width = 1;
+	if (height < 1)
+		height = 1;
 
 	if (terminal->width == width && terminal->height == height)
 		return;
 
-	if (terminal->data && width <= terminal->max_width) {
-		d = 0;
-		if (height < terminal->height && height <= terminal->row)
-			d = terminal->height - height;
-		else if (height > terminal->height &&
-			 terminal->height - 1 == terminal->row) {
-			d = terminal->height - height;
-			if (terminal->log_size < uheight)
-				d = -terminal->start;
-		}
+	terminal_reset_view(terminal);
 
-		terminal->start += d;
-		terminal->row -= d;
-	} else {
-		terminal->max_width = width;
-		data_pitch = width * sizeof(union utf8_char);
-		data = zalloc(data_pitch * terminal->buffer_height);
-		attr_pitch = width * sizeof(struct attr);
-		data_attr = malloc(attr_pitch * terminal->buffer_height);
+	/* The screen rows keep max_width cells, so that text cut off by
+	 * narrowing the window comes back when widening it again. */
+	if (width > terminal->max_width) {
 		tab_ruler = zalloc(width);
-		attr_init(data_attr, terminal->curr_attr,
-			  width * terminal->buffer_height);
-
-		if (terminal->data && terminal->data_attr) {
-			if (width > terminal->width)
-				l = terminal->width;
-			else
-				l = width;
-
-			if (terminal->height > height) {
-				total_rows = height;
-				i = 1 + terminal->row - height;
-				if (i > 0) {
-					terminal->start += i;
-					terminal->row = terminal->row - i;
-				}
-			} else {
-				total_rows = terminal->height;
-			}
+		free(terminal->tab_ruler);
+		terminal->tab_ruler = tab_ruler;
+		terminal->max_width = width;
+	}
 
-			for (i = 0; i < total_rows; i++) {
-				memcpy(&data[width * i],
-				       terminal_get_row(terminal, i),
-				       l * sizeof(union utf8_char));
-				memcpy(&data_attr[width * i],
-				       terminal_get_attr_row(terminal, i),
-				       l * sizeof(struct attr));
-			}
+	pitch = terminal->max_width;
+	data_pitch = pitch * sizeof(union utf8_char);
+	data = zalloc(data_pitch * height);
+	attr_pitch = pitch * sizeof(struct attr);
+	data_attr = malloc(attr_pitch * height);
+	attr_init(data_attr, terminal->curr_attr, pitch * height);
+
+	if (terminal->data && terminal->data_attr) {
+		/* Keep the cursor on screen by scrolling rows off the top
+		 * into the scrollback, and when growing with the cursor on
+		 * the last row, bring lines back from it. */
+		shift = 0;
+		pull = 0;
+		if (height <= terminal->row) {
+			shift = terminal->row - height + 1;
+		} else if (height > terminal->height &&
+			   terminal->height - 1 == terminal->row) {
+			pull = height - terminal->height;
+			if ((uint32_t) pull > terminal->scrollback.lines)
+				pull = terminal->scrollback.lines;
+		}
 
-			free(terminal->data);
-			free(terminal->data_attr);
-			free(terminal->tab_ruler);
+		l = terminal->data_pitch / sizeof(union utf8_char);
+		for (i = 0; i < shift; i++)
+			scrollback_push(&terminal->scrollback,
+					terminal_get_row(terminal, i),
+					terminal_get_attr_row(terminal, i), l);
+
+		for (i = shift; i < terminal->height &&
+			     i - shift + pull < height; i++) {
+			memcpy(&data[pitch * (i - shift + pull)],
+			       terminal_get_row(terminal, i),
+			       l * sizeof(union utf8_char));
+			memcpy(&data_attr[pitch * (i - shift + pull)],
+			       terminal_get_attr_row(terminal, i),
+			       l * sizeof(struct attr));
 		}
 
-		terminal->data_pitch = data_pitch;
-		terminal->attr_pitch = attr_pitch;
-		terminal->data = data;
-		terminal->data_attr = data_attr;
-		terminal->tab_ruler = tab_ruler;
-		terminal->start = 0;
+		for (i = pull; i > 0; i--)
+			scrollback_pop(&terminal->scrollback,
+				       &data[pitch * (i - 1)],
+				       &data_attr[pitch * (i - 1)], pitch);
+
+		terminal->row += pull - shift;
+		terminal->selection_start_row += pull - shift;
+		terminal->selection_end_row += pull - shift;
+
+		free(terminal->data);
+		free(terminal->data_attr);
+	}
+
+	terminal->data_pitch = data_pitch;
+	terminal->attr_pitch = attr_pitch;
+	terminal->data = data;
+	terminal->data_attr = data_attr;
+	terminal->start = 0;
+	scrollback_resize_cache(&terminal->scrollback, height, pitch);
+
+	if (terminal->height != height) {
+		free(terminal->dirty);
+		terminal->dirty = zalloc(height);
 	}
 
 	terminal->margin_bottom =
@@ -822,6 +1280,7 @@ terminal_resize_cells(struct terminal *terminal,
 	terminal->width = width;
 	terminal->height = height;
 	terminal_init_tabs(terminal);
+	terminal_dirty_all(terminal);
 
 	/* Update the window size */
 	ws.ws_row = terminal->height;
@@ -940,6 +1399,62 @@ terminal_send_selection(struct terminal *terminal, int fd)
 	fclose(fp);
 }
 
+static struct glyph_cache *
+glyph_cache_create(cairo_scaled_font_t *font)
+{
+	struct glyph_cache *cache;
+	int i;
+
+	cache = xzalloc(sizeof *cache);
+	cache->font = font;
+	for (i = 0; i < GLYPH_CACHE_SIZE; i++)
+		cache->entries[i].count = -1;
+
+	return cache;
+}
+
+static struct glyph_cache_entry *
+glyph_cache_lookup(struct glyph_cache *cache, union utf8_char *c)
+{
+	struct glyph_cache_entry *entry;
+	cairo_glyph_t *glyphs;
+	uint32_t slot;
+	int count;
+
+	if (c->ch < 128)
+		slot = c->ch;
+	else
+		slot = 128 + (c->ch * 2654435761u >> 16) %
+			(GLYPH_CACHE_SIZE - 128);
+
+	entry = &cache->entries[slot];
+	if (entry->count >= 0 && entry->ch == c->ch)
+		return entry;
+
+	glyphs = entry->glyphs;
+	count = ARRAY_LENGTH(entry->glyphs);
+	if (cairo_scaled_font_text_to_glyphs(cache->font, 0, 0,
+					     (char *) c->byte, 4,
+					     &glyphs, &count,
+					     NULL, NULL, NULL) !=
+	    CAIRO_STATUS_SUCCESS)
+		count = 0;
+
+	/* Four bytes can't make more than four glyphs, but don't trust
+	 * the font to agree. */
+	if (glyphs != entry->glyphs) {
+		if (count > (int) ARRAY_LENGTH(entry->glyphs))
+			count = ARRAY_LENGTH(entry->glyphs);
+		memcpy(entry->glyphs, glyphs, count * sizeof *glyphs);
+		cairo_glyph_free(glyphs);
+	}
+
+	entry->ch = c->ch;
+	entry->count = count;
+
+	return entry;
+}
+
 struct glyph_run {
 	struct terminal *terminal;
 	cairo_t *cr;
@@ -984,23 +1499,24 @@ glyph_run_flush(struct glyph_run *run, union decoded_attr attr)
 static void
 glyph_run_add(struct glyph_run *run, int x, int y, union utf8_char *c)
 {
-	int num_glyphs;
-	cairo_scaled_font_t *font;
-
-	num_glyphs = ARRAY_LENGTH(run->glyphs) - run->count;
+	struct glyph_cache *cache;
+	struct glyph_cache_entry *entry;
+	int i;
 
 	if (run->attr.attr.a & (ATTRMASK_BOLD | ATTRMASK_BLINK))
-		font = run->terminal->font_bold;
+		cache = run->terminal->glyphs_bold;
 	else
-		font = run->terminal->font_normal;
-
-	cairo_move_to(run->cr, x, y);
-	cairo_scaled_font_text_to_glyphs (font, x, y,
-					  (char *) c->byte, 4,
-					  &run->g, &num_glyphs,
-					  NULL, NULL, NULL);
-	run->g += num_glyphs;
-	run->count += num_glyphs;
+		cache = run->terminal->glyphs_normal;
+
+	entry = glyph_cache_lookup(cache, c);
+	for (i = 0; i < entry->count &&
+		    run->count < ARRAY_LENGTH(run->glyphs); i++) {
+		run->g->index = entry->glyphs[i].index;
+		run->g->x = x + entry->glyphs[i].x;
+		run->g->y = y + entry->glyphs[i].y;
+		run->g++;
+		run->count++;
+	}
 }
 
 
@@ -1028,8 +1544,9 @@ redraw_handler(struct widget *widget, void *data)
 	cairo_rectangle(cr, allocation.x, allocation.y,
 			allocation.width, allocation.height);
 	cairo_clip(cr);
-	cairo_push_group(cr);
 
+	/* The toolkit clips to the rows terminal_damage() reported, unless
+	 * the whole window is being redrawn; only paint the rows inside. */
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	terminal_set_color(terminal, cr, terminal->color_scheme->border);
 	cairo_paint(cr);
@@ -1046,6 +1563,9 @@ redraw_handler(struct widget *widget, void *data)
 			allocation.y + top_margin);
 	/* paint the background */
 	for (row = 0; row < terminal->height; row++) {
+		if (!cairo_in_clip(cr, 0, (row + 0.5) * extents.height))
+			continue;
+
 		p_row = terminal_get_row(terminal, row);
 		for (col = 0; col < terminal->width; col++) {
 			/* get the attributes for this character cell */
@@ -1075,6 +1595,9 @@ redraw_handler(struct widget *widget, void *data)
 	/* paint the foreground */
 	glyph_run_init(&run, terminal, cr);
 	for (row = 0; row < terminal->height; row++) {
+		if (!cairo_in_clip(cr, 0, (row + 0.5) * extents.height))
+			continue;
+
 		p_row = terminal_get_row(terminal, row);
 		for (col = 0; col < terminal->width; col++) {
 			/* get the attributes for this character cell */
@@ -1113,8 +1636,6 @@ redraw_handler(struct widget *widget, void *data)
 		cairo_stroke(cr);
 	}
 
-	cairo_pop_group_to_source(cr);
-	cairo_paint(cr);
 	cairo_destroy(cr);
 	cairo_surface_destroy(surface);
 
@@ -1177,10 +1698,12 @@ handle_term_parameter(struct terminal *terminal, int code, int sr)
 				attr_init(terminal_get_attr_row(terminal, i),
 				    terminal->curr_attr, terminal->width);
 			}
+			terminal_dirty_all(terminal);
 			break;
 		case 5:  /* DECSCNM */
 			if (sr)	terminal->mode |=  MODE_INVERSE;
 			else	terminal->mode &= ~MODE_INVERSE;
+			terminal_dirty_all(terminal);
 			break;
 		case 6:  /* DECOM */
 			terminal->origin_mode = sr;
@@ -1404,6 +1927,8 @@ handle_escape(struct terminal *terminal)
 				attr_init(terminal_get_attr_row(terminal, i),
 				    terminal->curr_attr, terminal->width);
 			}
+			terminal_dirty_rows(terminal, terminal->row,
+					    terminal->height - 1);
 		} else if (args[0] == 1) {
 			memset(row, 0, (terminal->column+1) * sizeof(union utf8_char));
 			attr_init(attr_row, terminal->curr_attr, terminal->column+1);
@@ -1413,10 +1938,11 @@ handle_escape(struct terminal *terminal)
 				attr_init(terminal_get_attr_row(terminal, i),
 				    terminal->curr_attr, terminal->width);
 			}
+			terminal_dirty_rows(terminal, 0, terminal->row);
 		} else if (args[0] == 2) {
 			/* Clear screen by scrolling contents out */
 			terminal_scroll_buffer(terminal,
-					       terminal->end - terminal->start);
+					       terminal_used_rows(terminal));
 		}
 		break;
 	case 'K':    /* EL */
@@ -1434,6 +1960,7 @@ handle_escape(struct terminal *terminal)
 			memset(row, 0, terminal->data_pitch);
 			attr_init(attr_row, terminal->curr_attr, terminal->width);
 		}
+		terminal_dirty_rows(terminal, terminal->row, terminal->row);
 		break;
 	case 'L':    /* IL */
 		count = set[0] ? args[0] : 1;
@@ -1450,6 +1977,8 @@ handle_escape(struct terminal *terminal)
 			       0, terminal->data_pitch);
 			attr_init(terminal_get_attr_row(terminal, terminal->row),
 				terminal->curr_attr, terminal->width);
+			terminal_dirty_rows(terminal, terminal->row,
+					    terminal->row);
 		}
 		break;
 	case 'M':    /* DL */
@@ -1465,6 +1994,8 @@ handle_escape(struct terminal *terminal)
 		} else if (terminal->row == terminal->margin_bottom) {
 			memset(terminal_get_row(terminal, terminal->row),
 			       0, terminal->data_pitch);
+			terminal_dirty_rows(terminal, terminal->row,
+					    terminal->row);
 		}
 		break;
 	case 'P':    /* DCH */
@@ -1487,6 +2018,7 @@ handle_escape(struct terminal *terminal)
 		attr_row = terminal_get_attr_row(terminal, terminal->row);
 		memset(&row[terminal->column], 0, count * sizeof(union utf8_char));
 		attr_init(&attr_row[terminal->column], terminal->curr_attr, count);
+		terminal_dirty_rows(terminal, terminal->row, terminal->row);
 		break;
 	case 'Z':    /* CBT */
 		count = set[0] ? args[0] : 1;
@@ -1679,6 +2211,7 @@ handle_non_csi_escape(struct terminal *terminal, char code)
 		break;
 	case 'c':    /* RIS */
 		terminal_init(terminal);
+		terminal_dirty_all(terminal);
 		break;
 	case 'H':    /* HTS */
 		terminal->tab_ruler[terminal->column] = 1;
@@ -1716,17 +2249,20 @@ handle_non_csi_escape(struct terminal *terminal, char code)
 static void
 handle_special_escape(struct terminal *terminal, char special, char code)
 {
-	int i, numChars;
+	union utf8_char *row;
+	int i, col;
 
 	if (special == '#') {
 		switch(code) {
 		case '8':
 			/* fill with 'E', no cheap way to do this */
 			memset(terminal->data, 0, terminal->data_pitch * terminal->height);
-			numChars = terminal->width * terminal->height;
-			for(i = 0; i < numChars; i++) {
-				terminal->data[i].byte[0] = 'E';
+			for(i = 0; i < terminal->height; i++) {
+				row = terminal_get_row(terminal, i);
+				for(col = 0; col < terminal->width; col++)
+					row[col].byte[0] = 'E';
 			}
+			terminal_dirty_all(terminal);
 			break;
 		default:
 			fprintf(stderr, "Unknown HASH escape #%c\n", code);
@@ -1875,6 +2411,7 @@ handle_special_char(struct terminal *terminal, char c)
 			terminal->column++;
 			if (terminal->tab_ruler[terminal->column]) break;
 		}
+		terminal_dirty_rows(terminal, terminal->row, terminal->row);
 		if (terminal->column >= terminal->width) {
 			terminal->column = terminal->width - 1;
 		}
@@ -1957,13 +2494,7 @@ handle_char(struct terminal *terminal, union utf8_char utf8)
 		terminal_shift_line(terminal, +1);
 	row[terminal->column] = utf8;
 	attr_row[terminal->column++] = terminal->curr_attr;
-
-	if (terminal->row + terminal->start + 1 > terminal->end)
-		terminal->end = terminal->row + terminal->start + 1;
-	if (terminal->end == terminal->buffer_height)
-		terminal->log_size = terminal->buffer_height;
-	else if (terminal->log_size < terminal->buffer_height)
-		terminal->log_size = terminal->end;
+	terminal_dirty_rows(terminal, terminal->row, terminal->row);
 
 	/* cursor jump for wide character. */
 	if (is_wide(utf8))
@@ -1973,6 +2504,59 @@ handle_char(struct terminal *terminal, union utf8_char utf8)
 		terminal->last_char = utf8;
 }
 
+/* Fast path for a run of printable ASCII outside any escape sequence,
+ * doing what handle_char() does for each byte a row at a time.  Only
+ * used without a character set substitution or insert mode. */
+static void
+handle_ascii_run(struct terminal *terminal, const char *data, int length)
+{
+	union utf8_char *row;
+	struct attr *attr_row;
+	int i, n;
+
+	while (length > 0) {
+		/* handle right margin effects */
+		if (terminal->column >= terminal->width) {
+			if (terminal->mode & MODE_AUTOWRAP) {
+				terminal->column = 0;
+				terminal->row += 1;
+				if (terminal->row > terminal->margin_bottom) {
+					terminal->row = terminal->margin_bottom;
+					terminal_scroll(terminal, +1);
+				}
+			} else {
+				terminal->column--;
+			}
+		}
+
+		row = terminal_get_row(terminal, terminal->row);
+		attr_row = terminal_get_attr_row(terminal, terminal->row);
+
+		n = terminal->width - terminal->column;
+		if (n > length)
+			n = length;
+
+		for (i = 0; i < n; i++) {
+			row[terminal->column + i].ch = 0;
+			row[terminal->column + i].byte[0] = data[i];
+			attr_row[terminal->column + i] = terminal->curr_attr;
+		}
+		terminal->column += n;
+		data += n;
+		length -= n;
+		terminal_dirty_rows(terminal, terminal->row, terminal->row);
+	}
+
+	terminal->last_char.ch = 0;
+	terminal->last_char.byte[0] = data[-1];
+}
+
+static inline int
+is_printable_ascii(char c)
+{
+	return c >= 0x20 && c < 0x7f;
+}
+
 static void
 escape_append_utf8(struct terminal *terminal, union utf8_char utf8)
 {
@@ -1996,11 +2580,28 @@ escape_append_utf8(struct terminal *terminal, union utf8_char utf8)
 static void
 terminal_data(struct terminal *terminal, const char *data, size_t length)
 {
-	unsigned int i;
+	unsigned int i, j;
 	union utf8_char utf8;
 	enum utf8_state parser_state;
 
+	/* Output puts the view back on the screen, like xterm does. */
+	terminal_reset_view(terminal);
+
 	for (i = 0; i < length; i++) {
+		if (is_printable_ascii(data[i]) &&
+		    terminal->state == escape_state_normal &&
+		    terminal->cs == CS_US && !(terminal->mode & MODE_IRM) &&
+		    (terminal->state_machine.state == utf8state_start ||
+		     terminal->state_machine.state == utf8state_accept ||
+		     terminal->state_machine.state == utf8state_reject)) {
+			for (j = i + 1; j < length; j++)
+				if (!is_printable_ascii(data[j]))
+					break;
+			handle_ascii_run(terminal, data + i, j - i);
+			i = j - 1;
+			continue;
+		}
+
 		parser_state =
 			utf8_next_char(&terminal->state_machine, data[i]);
 		switch(parser_state) {
@@ -2140,7 +2741,7 @@ terminal_data(struct terminal *terminal, const char *data, size_t length)
 		} /* if */
 	} /* for */
 
-	window_schedule_redraw(terminal->window);
+	terminal_damage(terminal);
 }
 
 static void
@@ -2270,32 +2871,30 @@ handle_bound_key(struct terminal *terminal,
 		return 1;
 
 	case XKB_KEY_Up:
-		if (!terminal->scrolling)
-			terminal->saved_start = terminal->start;
-		if (terminal->start == terminal->end - terminal->log_size)
+		if ((uint32_t) terminal->view_offset ==
+		    terminal->scrollback.lines)
 			return 1;
 
 		terminal->scrolling = 1;
-		terminal->start--;
+		terminal->view_offset++;
 		terminal->row++;
 		terminal->selection_start_row++;
 		terminal->selection_end_row++;
-		widget_schedule_redraw(terminal->widget);
+		terminal_dirty_all(terminal);
+		terminal_damage(terminal);
 		return 1;
 
 	case XKB_KEY_Down:
-		if (!terminal->scrolling)
-			terminal->saved_start = terminal->start;
-
-		if (terminal->start == terminal->saved_start)
+		if (terminal->view_offset == 0)
 			return 1;
 
 		terminal->scrolling = 1;
-		terminal->start++;
+		terminal->view_offset--;
 		terminal->row--;
 		terminal->selection_start_row--;
 		terminal->selection_end_row--;
-		widget_schedule_redraw(terminal->widget);
+		terminal_dirty_all(terminal);
+		terminal_damage(terminal);
 		return 1;
 
 	default:
@@ -2311,7 +2910,7 @@ key_handler(struct window *window, struct input *input, uint32_t time,
 	struct terminal *terminal = data;
 	char ch[MAX_RESPONSE];
 	uint32_t modifiers, serial;
-	int ret, len = 0, d;
+	int ret, len = 0;
 	bool convert_utf8 = true;
 
 	modifiers = input_get_modifiers(input);
@@ -2516,13 +3115,8 @@ key_handler(struct window *window, struct input *input, uint32_t time,
 
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED && len > 0) {
 		if (terminal->scrolling) {
-			d = terminal->saved_start - terminal->start;
-			terminal->row -= d;
-			terminal->selection_start_row -= d;
-			terminal->selection_end_row -= d;
-			terminal->start = terminal->saved_start;
-			terminal->scrolling = 0;
-			widget_schedule_redraw(terminal->widget);
+			terminal_reset_view(terminal);
+			terminal_damage(terminal);
 		}
 
 		terminal_write(terminal, ch, len);
@@ -2568,6 +3162,9 @@ recompute_selection(struct terminal *terminal)
 	int cw, ch;
 	union utf8_char *data;
 
+	terminal_dirty_rows(terminal, terminal->selection_start_row,
+			    terminal->selection_end_row);
+
 	cw = terminal->average_width;
 	ch = terminal->extents.height;
 	widget_get_allocation(terminal->widget, &allocation);
@@ -2650,6 +3247,9 @@ recompute_selection(struct terminal *terminal)
 			terminal->selection_start_col = eol;
 	}
 
+	terminal_dirty_rows(terminal, terminal->selection_start_row,
+			    terminal->selection_end_row);
+
 	return 1;
 }
 
@@ -2703,7 +3303,7 @@ click_handler(struct widget *widget, struct terminal *terminal,
 	terminal->selection_end_x = terminal->selection_start_x = x;
 	terminal->selection_end_y = terminal->selection_start_y = y;
 	if (recompute_selection(terminal))
-			widget_schedule_redraw(widget);
+		terminal_damage(terminal);
 }
 
 static void
@@ -2757,7 +3357,7 @@ motion_handler(struct widget *widget,
 				   &terminal->selection_end_y);
 
 		if (recompute_selection(terminal))
-			widget_schedule_redraw(widget);
+			terminal_damage(terminal);
 	}
 
 	return CURSOR_IBEAM;
@@ -2806,7 +3406,7 @@ touch_motion_handler(struct widget *widget, struct input *input,
 		terminal->selection_end_y = (int)y;
 
 		if (recompute_selection(terminal))
-			widget_schedule_redraw(widget);
+			terminal_damage(terminal);
 	}
 }
 
@@ -2838,8 +3438,7 @@ terminal_create(struct display *display)
 
 	terminal->display = display;
 	terminal->margin = 5;
-	terminal->buffer_height = 1024;
-	terminal->end = 1;
+	scrollback_init(&terminal->scrollback);
 
 	window_set_user_data(terminal->window, terminal);
 	window_set_key_handler(terminal->window, key_handler);
@@ -2876,6 +3475,9 @@ terminal_create(struct display *display)
 	terminal->font_normal = cairo_get_scaled_font (cr);
 	cairo_scaled_font_reference(terminal->font_normal);
 
+	terminal->glyphs_bold = glyph_cache_create(terminal->font_bold);
+	terminal->glyphs_normal = glyph_cache_create(terminal->font_normal);
+
 	cairo_font_extents(cr, &terminal->extents);
 
 	/* Compute the average ascii glyph width */
@@ -2909,6 +3511,10 @@ terminal_destroy(struct terminal *terminal)
 		display_exit(terminal->display);
 
 	free(terminal->title);
+	free(terminal->dirty);
+	free(terminal->glyphs_normal);
+	free(terminal->glyphs_bold);
+	scrollback_release(&terminal->scrollback);
 	free(terminal);
 }
 
@@ -2917,19 +3523,85 @@ io_handler(struct task *task, uint32_t events)
 {
 	struct terminal *terminal =
 		container_of(task, struct terminal, io_task);
-	char buffer[256];
-	int len;
+	static char buffer[READ_SIZE];
+	ssize_t len;
+	size_t total;
 
 	if (events & EPOLLHUP) {
 		terminal_destroy(terminal);
 		return;
 	}
 
-	len = read(terminal->master, buffer, sizeof buffer);
-	if (len < 0)
-		terminal_destroy(terminal);
-	else
+	for (total = 0; total < READ_BUDGET; total += len) {
+		len = read(terminal->master, buffer, sizeof buffer);
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			break;
+		if (len < 0) {
+			terminal_destroy(terminal);
+			return;
+		}
+
 		terminal_data(terminal, buffer, len);
+		if (len < (ssize_t) sizeof buffer)
+			break;
+	}
+}
+
+/* Feed recorded pty output, such as a typescript from script(1), to the
+ * parser in the chunks io_handler() would read, and print how long it
+ * took.  Nothing is drawn, so this measures the parser alone. */
+static int
+terminal_replay(struct terminal *terminal, const char *path)
+{
+	struct timespec start, end;
+	char *data;
+	size_t size, offset, len;
+	double elapsed;
+	FILE *fp;
+	long end_pos;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "could not open %s: %m\n", path);
+		return -1;
+	}
+
+	if (fseek(fp, 0, SEEK_END) < 0 || (end_pos = ftell(fp)) < 0 ||
+	    fseek(fp, 0, SEEK_SET) < 0) {
+		fprintf(stderr, "could not get the size of %s: %m\n", path);
+		fclose(fp);
+		return -1;
+	}
+	size = end_pos;
+
+	data = malloc(size ? size : 1);
+	if (data == NULL || fread(data, 1, size, fp) != size) {
+		fprintf(stderr, "could not read %s\n", path);
+		free(data);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	terminal_resize_cells(terminal, 80, 24);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (offset = 0; offset < size; offset += len) {
+		len = size - offset;
+		if (len > READ_SIZE)
+			len = READ_SIZE;
+		terminal_data(terminal, data + offset, len);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = end.tv_sec - start.tv_sec +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%zu bytes in %.3f s, %.1f MiB/s\n", size, elapsed,
+	       elapsed > 0 ? size / elapsed / (1024 * 1024) : 0.0);
+
+	free(data);
+
+	return 0;
 }
 
 static int
@@ -2968,6 +3640,7 @@ static const struct weston_option terminal_options[] = {
 	{ WESTON_OPTION_BOOLEAN, "fullscreen", 'f', &option_fullscreen },
 	{ WESTON_OPTION_STRING, "font", 0, &option_font },
 	{ WESTON_OPTION_STRING, "shell", 0, &option_shell },
+	{ WESTON_OPTION_STRING, "replay", 0, &option_replay },
 };
 
 int main(int argc, char *argv[])
@@ -2992,6 +3665,9 @@ int main(int argc, char *argv[])
 	weston_config_section_get_string(s, "term", &option_term, "xterm");
 	weston_config_destroy(config);
 
+	parse_options(terminal_options, ARRAY_LENGTH(terminal_options),
+		      &argc, argv);
+
 	d = display_create(&argc, argv);
 	if (d == NULL) {
 		fprintf(stderr, "failed to create display: %m\n");
@@ -3000,6 +3676,11 @@ int main(int argc, char *argv[])
 
 	wl_list_init(&terminal_list);
 	terminal = terminal_create(d);
+
+	if (option_replay)
+		exit(terminal_replay(terminal, option_replay) ?
+		     EXIT_FAILURE : EXIT_SUCCESS);
+
 	if (terminal_run(terminal, option_shell))
 		exit(EXIT_FAILURE);
 
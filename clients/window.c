@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -132,6 +133,10 @@ struct display {
 
 	int has_rgb565;
 	int seat_version;
+
+	/* Most recently used first */
+	struct wl_list shm_pool_list;
+	int shm_debug;
 };
 
 enum {
@@ -163,13 +168,23 @@ struct toysurface {
 				    int32_t width, int32_t height, uint32_t flags,
 				    enum wl_output_transform buffer_transform, int32_t buffer_scale);
 
+	/*
+	 * Make the surface from prepare() hold what was last posted, so
+	 * that only the damaged areas need to be redrawn.
+	 * Returns 0 on success, and negative if everything must be redrawn.
+	 */
+	int (*preserve)(struct toysurface *base);
+
 	/*
 	 * Post the surface to the server, returning the server allocation
-	 * rectangle. The Cairo surface from prepare() must be destroyed
-	 * after calling this.
+	 * rectangle. 'damage' lists the n_damage rectangles, in surface
+	 * coordinates, that changed since the last swap; with n_damage 0
+	 * the whole surface is damaged. The Cairo surface from prepare()
+	 * must be destroyed after calling this.
 	 */
 	void (*swap)(struct toysurface *base,
 		     enum wl_output_transform buffer_transform, int32_t buffer_scale,
+		     const struct rectangle *damage, int n_damage,
 		     struct rectangle *server_allocation);
 
 	/*
@@ -207,6 +222,11 @@ struct surface {
 	struct rectangle allocation;
 	struct rectangle server_allocation;
 
+	/* Areas reported with widget_damage() for the next frame, unless
+	 * damage_all says the whole surface needs redrawing. */
+	struct wl_array damage;
+	int damage_all;
+
 	struct wl_region *input_region;
 	struct wl_region *opaque_region;
 
@@ -384,10 +404,25 @@ struct tooltip {
 	float x, y;
 };
 
+/*
+ * Buffers are carved out of pools of SHM_POOL_SLOTS equal slots, one size
+ * class per pool, so that a window being resized keeps landing in slots
+ * that both sides have mapped already.  A pool never changes size, since
+ * wl_shm_pool.resize has the compositor remap it under the buffers it may
+ * still be reading.  The file is sized for all the slots up front instead,
+ * and a slot only gets storage the first time it is used.
+ */
+#define SHM_POOL_SLOTS 4
+
 struct shm_pool {
+	struct display *display;
+	struct wl_list link;
 	struct wl_shm_pool *pool;
-	size_t size;
-	size_t used;
+	int fd;
+	size_t slot_size;
+	uint32_t used;		/* bitmask of the slots in use */
+	uint32_t backed;	/* bitmask of the slots with storage */
+	size_t requested;	/* bytes the buffers in use asked for */
 	void *data;
 };
 
@@ -533,9 +568,17 @@ egl_window_surface_prepare(struct toysurface *base, int dx, int dy,
 	return cairo_surface_reference(surface->cairo_surface);
 }
 
+static int
+egl_window_surface_preserve(struct toysurface *base)
+{
+	/* The back buffer contents are undefined after a swap. */
+	return -1;
+}
+
 static void
 egl_window_surface_swap(struct toysurface *base,
 			enum wl_output_transform buffer_transform, int32_t buffer_scale,
+			const struct rectangle *damage, int n_damage,
 			struct rectangle *server_allocation)
 {
 	struct egl_window_surface *surface = to_egl_window_surface(base);
@@ -623,6 +666,7 @@ egl_window_surface_create(struct display *display,
 		return NULL;
 
 	surface->base.prepare = egl_window_surface_prepare;
+	surface->base.preserve = egl_window_surface_preserve;
 	surface->base.swap = egl_window_surface_swap;
 	surface->base.acquire = egl_window_surface_acquire;
 	surface->base.release = egl_window_surface_release;
@@ -665,6 +709,8 @@ egl_window_surface_create(struct display *display,
 struct shm_surface_data {
 	struct wl_buffer *buffer;
 	struct shm_pool *pool;
+	int offset;
+	size_t size;
 };
 
 struct wl_buffer *
@@ -679,7 +725,7 @@ display_get_buffer_for_surface(struct display *display,
 }
 
 static void
-shm_pool_destroy(struct shm_pool *pool);
+shm_pool_free(struct shm_pool *pool, int offset, size_t size);
 
 static void
 shm_surface_data_destroy(void *p)
@@ -687,107 +733,232 @@ shm_surface_data_destroy(void *p)
 	struct shm_surface_data *data = p;
 
 	wl_buffer_destroy(data->buffer);
-	if (data->pool)
-		shm_pool_destroy(data->pool);
+	shm_pool_free(data->pool, data->offset, data->size);
 
 	free(data);
 }
 
-static struct wl_shm_pool *
-make_shm_pool(struct display *display, int size, void **data)
+/* Bytes of storage in idle pools kept for the next buffers of their
+ * size; beyond that the least recently used idle pools go. */
+#ifdef USE_RESIZE_POOL
+#define SHM_IDLE_BYTES (16 * 1024 * 1024)
+#else
+#define SHM_IDLE_BYTES 0
+#endif
+
+/* Rounds up to one of four classes per power of two, so a buffer wastes
+ * at most a quarter of its slot, and a window being resized stays in the
+ * same class over many sizes. */
+static size_t
+shm_size_class(size_t size)
 {
-	struct wl_shm_pool *pool;
-	int fd;
+	size_t step;
 
-	fd = os_create_anonymous_file(size);
-	if (fd < 0) {
-		fprintf(stderr, "creating a buffer file for %d B failed: %m\n",
-			size);
-		return NULL;
-	}
+	size = (size + 4095) & ~(size_t) 4095;
+	for (step = 4096; step * 8 <= size; step *= 2)
+		;
 
-	*data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (*data == MAP_FAILED) {
-		fprintf(stderr, "mmap failed: %m\n");
-		close(fd);
-		return NULL;
-	}
+	return (size + step - 1) & ~(step - 1);
+}
+
+static int
+shm_pool_back_slot(struct shm_pool *pool, int slot)
+{
+#ifdef HAVE_POSIX_FALLOCATE
+	int ret;
 
-	pool = wl_shm_create_pool(display->shm, fd, size);
+	if (pool->backed & (1u << slot))
+		return 0;
 
-	close(fd);
+	ret = posix_fallocate(pool->fd, slot * pool->slot_size,
+			      pool->slot_size);
+	if (ret != 0) {
+		fprintf(stderr, "allocating %zu B of a buffer file failed: %s\n",
+			pool->slot_size, strerror(ret));
+		return -1;
+	}
+#endif
+	pool->backed |= 1u << slot;
 
-	return pool;
+	return 0;
+}
+
+static void
+shm_pool_destroy(struct shm_pool *pool)
+{
+	munmap(pool->data, pool->slot_size * SHM_POOL_SLOTS);
+	wl_shm_pool_destroy(pool->pool);
+	close(pool->fd);
+	wl_list_remove(&pool->link);
+	free(pool);
 }
 
 static struct shm_pool *
-shm_pool_create(struct display *display, size_t size)
+shm_pool_create(struct display *display, size_t slot_size)
 {
-	struct shm_pool *pool = malloc(sizeof *pool);
+	struct shm_pool *pool;
+	size_t size = slot_size * SHM_POOL_SLOTS;
 
+	pool = zalloc(sizeof *pool);
 	if (!pool)
 		return NULL;
 
-	pool->pool = make_shm_pool(display, size, &pool->data);
-	if (!pool->pool) {
+	/* Storage for the first slot, the rest stays a hole until used. */
+	pool->fd = os_create_anonymous_file(slot_size);
+	if (pool->fd < 0) {
+		fprintf(stderr, "creating a buffer file for %zu B failed: %m\n",
+			slot_size);
 		free(pool);
 		return NULL;
 	}
 
-	pool->size = size;
-	pool->used = 0;
+	if (ftruncate(pool->fd, size) < 0) {
+		fprintf(stderr, "sizing a buffer file to %zu B failed: %m\n",
+			size);
+		close(pool->fd);
+		free(pool);
+		return NULL;
+	}
+
+	pool->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			  pool->fd, 0);
+	if (pool->data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %m\n");
+		close(pool->fd);
+		free(pool);
+		return NULL;
+	}
+
+	pool->display = display;
+	pool->slot_size = slot_size;
+	pool->backed = 1;
+	pool->pool = wl_shm_create_pool(display->shm, pool->fd, size);
+	wl_list_init(&pool->link);
 
 	return pool;
 }
 
-static void *
-shm_pool_allocate(struct shm_pool *pool, size_t size, int *offset)
+void
+display_get_shm_stats(struct display *display, struct shm_stats *stats)
 {
-	if (pool->used + size > pool->size)
-		return NULL;
-
-	*offset = pool->used;
-	pool->used += size;
+	struct shm_pool *pool;
 
-	return (char *) pool->data + *offset;
+	memset(stats, 0, sizeof *stats);
+	wl_list_for_each(pool, &display->shm_pool_list, link) {
+		stats->pools++;
+		stats->slots += __builtin_popcount(pool->used);
+		stats->backed += pool->slot_size *
+			__builtin_popcount(pool->backed);
+		stats->requested += pool->requested;
+	}
 }
 
-/* destroy the pool. this does not unmap the memory though */
+/* With TOYTOOLKIT_SHM_DEBUG set, report the pools as they come and go. */
 static void
-shm_pool_destroy(struct shm_pool *pool)
+shm_stats_dump(struct display *display, const char *what)
 {
-	munmap(pool->data, pool->size);
-	wl_shm_pool_destroy(pool->pool);
-	free(pool);
+	struct shm_stats stats;
+
+	if (!display->shm_debug)
+		return;
+
+	display_get_shm_stats(display, &stats);
+	fprintf(stderr, "shm: %s: %d pools, %d slots in use, "
+		"%zu B backed for %zu B requested\n", what,
+		stats.pools, stats.slots, stats.backed, stats.requested);
 }
 
-/* Start allocating from the beginning of the pool again */
-static void
-shm_pool_reset(struct shm_pool *pool)
+/* Hands out a slot of the size class of 'size', from the most recently
+ * used pool of that class that has one, preferring slots that have
+ * storage already. */
+static void *
+shm_pool_allocate(struct display *display, size_t size,
+		  struct shm_pool **pool_ret, int *offset)
 {
-	pool->used = 0;
+	struct shm_pool *pool;
+	size_t slot_size = shm_size_class(size);
+	uint32_t free_slots;
+	int slot;
+
+	wl_list_for_each(pool, &display->shm_pool_list, link) {
+		free_slots = ~pool->used & ((1u << SHM_POOL_SLOTS) - 1);
+		if (pool->slot_size != slot_size || !free_slots)
+			continue;
+
+		if (free_slots & pool->backed)
+			slot = ffs(free_slots & pool->backed) - 1;
+		else
+			slot = ffs(free_slots) - 1;
+
+		if (shm_pool_back_slot(pool, slot) == 0)
+			goto found;
+	}
+
+	pool = shm_pool_create(display, slot_size);
+	if (!pool)
+		return NULL;
+	slot = 0;
+	shm_stats_dump(display, "created a pool");
+
+found:
+	pool->used |= 1u << slot;
+	pool->requested += size;
+
+	wl_list_remove(&pool->link);
+	wl_list_insert(&display->shm_pool_list, &pool->link);
+
+	*pool_ret = pool;
+	*offset = slot * pool->slot_size;
+
+	return (char *) pool->data + *offset;
 }
 
-static int
-data_length_for_shm_surface(struct rectangle *rect)
+static void
+shm_pool_free(struct shm_pool *pool, int offset, size_t size)
 {
-	int stride;
+	struct display *display = pool->display;
+	struct shm_pool *tmp;
+	size_t idle = 0, bytes;
+	int trimmed = 0;
 
-	stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32,
-						rect->width);
-	return stride * rect->height;
+	pool->used &= ~(1u << (offset / pool->slot_size));
+	pool->requested -= size;
+	if (pool->used)
+		return;
+
+	/* Outlived its display */
+	if (!display) {
+		shm_pool_destroy(pool);
+		return;
+	}
+
+	wl_list_for_each_safe(pool, tmp, &display->shm_pool_list, link) {
+		if (pool->used)
+			continue;
+
+		bytes = pool->slot_size * __builtin_popcount(pool->backed);
+		if (idle + bytes > SHM_IDLE_BYTES) {
+			shm_pool_destroy(pool);
+			trimmed = 1;
+		} else {
+			idle += bytes;
+		}
+	}
+
+	if (trimmed)
+		shm_stats_dump(display, "trimmed idle pools");
 }
 
 static cairo_surface_t *
-display_create_shm_surface_from_pool(struct display *display,
-				     struct rectangle *rectangle,
-				     uint32_t flags, struct shm_pool *pool)
+display_create_shm_surface(struct display *display,
+			   struct rectangle *rectangle, uint32_t flags,
+			   struct shm_surface_data **data_ret)
 {
 	struct shm_surface_data *data;
 	uint32_t format;
 	cairo_surface_t *surface;
 	cairo_format_t cairo_format;
-	int stride, length, offset;
+	int stride, length;
 	void *map;
 
 	data = malloc(sizeof *data);
@@ -801,8 +972,8 @@ display_create_shm_surface_from_pool(struct display *display,
 
 	stride = cairo_format_stride_for_width (cairo_format, rectangle->width);
 	length = stride * rectangle->height;
-	data->pool = NULL;
-	map = shm_pool_allocate(pool, length, &offset);
+	map = shm_pool_allocate(display, length, &data->pool, &data->offset);
+	data->size = length;
 
 	if (!map) {
 		free(data);
@@ -827,56 +998,12 @@ display_create_shm_surface_from_pool(struct display *display,
 			format = WL_SHM_FORMAT_ARGB8888;
 	}
 
-	data->buffer = wl_shm_pool_create_buffer(pool->pool, offset,
+	data->buffer = wl_shm_pool_create_buffer(data->pool->pool,
+						 data->offset,
 						 rectangle->width,
 						 rectangle->height,
 						 stride, format);
 
-	return surface;
-}
-
-static cairo_surface_t *
-display_create_shm_surface(struct display *display,
-			   struct rectangle *rectangle, uint32_t flags,
-			   struct shm_pool *alternate_pool,
-			   struct shm_surface_data **data_ret)
-{
-	struct shm_surface_data *data;
-	struct shm_pool *pool;
-	cairo_surface_t *surface;
-
-	if (alternate_pool) {
-		shm_pool_reset(alternate_pool);
-		surface = display_create_shm_surface_from_pool(display,
-							       rectangle,
-							       flags,
-							       alternate_pool);
-		if (surface) {
-			data = cairo_surface_get_user_data(surface,
-							   &shm_surface_data_key);
-			goto out;
-		}
-	}
-
-	pool = shm_pool_create(display,
-			       data_length_for_shm_surface(rectangle));
-	if (!pool)
-		return NULL;
-
-	surface =
-		display_create_shm_surface_from_pool(display, rectangle,
-						     flags, pool);
-
-	if (!surface) {
-		shm_pool_destroy(pool);
-		return NULL;
-	}
-
-	/* make sure we destroy the pool when the surface is destroyed */
-	data = cairo_surface_get_user_data(surface, &shm_surface_data_key);
-	data->pool = pool;
-
-out:
 	if (data_ret)
 		*data_ret = data;
 
@@ -904,8 +1031,7 @@ display_create_surface(struct display *display,
 		return NULL;
 
 	assert(flags & SURFACE_SHM);
-	return display_create_shm_surface(display, rectangle, flags,
-					  NULL, NULL);
+	return display_create_shm_surface(display, rectangle, flags, NULL);
 }
 
 struct shm_surface_leaf {
@@ -913,8 +1039,11 @@ struct shm_surface_leaf {
 	/* 'data' is automatically destroyed, when 'cairo_surface' is */
 	struct shm_surface_data *data;
 
-	struct shm_pool *resize_pool;
 	int busy;
+
+	/* Bounding box, in buffer pixels, of what was posted from other
+	 * leaves since this one, so what preserve() copies in. */
+	struct rectangle stale;
 };
 
 static void
@@ -924,9 +1053,6 @@ shm_surface_leaf_release(struct shm_surface_leaf *leaf)
 		cairo_surface_destroy(leaf->cairo_surface);
 	/* leaf->data already destroyed via cairo private */
 
-	if (leaf->resize_pool)
-		shm_pool_destroy(leaf->resize_pool);
-
 	memset(leaf, 0, sizeof *leaf);
 }
 
@@ -941,6 +1067,7 @@ struct shm_surface {
 
 	struct shm_surface_leaf leaf[MAX_LEAVES];
 	struct shm_surface_leaf *current;
+	struct shm_surface_leaf *last;
 };
 
 static struct shm_surface *
@@ -992,12 +1119,14 @@ shm_surface_buffer_release(void *data, struct wl_buffer *buffer)
 	}
 	assert(i < MAX_LEAVES && "unknown buffer released");
 
-	/* Leave one free leaf with storage, release others */
-	free_found = 0;
+	/* Leave one free leaf with storage, preferably the one last
+	 * posted so preserve() has something to copy from, release others */
+	free_found = surface->last && !surface->last->busy;
 	for (i = 0; i < MAX_LEAVES; i++) {
 		leaf = &surface->leaf[i];
 
-		if (!leaf->cairo_surface || leaf->busy)
+		if (!leaf->cairo_surface || leaf->busy ||
+		    leaf == surface->last)
 			continue;
 
 		if (!free_found)
@@ -1018,7 +1147,6 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 		    int32_t width, int32_t height, uint32_t flags,
 		    enum wl_output_transform buffer_transform, int32_t buffer_scale)
 {
-	int resize_hint = !!(flags & SURFACE_HINT_RESIZE);
 	struct shm_surface *surface = to_shm_surface(base);
 	struct rectangle rect = { 0};
 	struct shm_surface_leaf *leaf = NULL;
@@ -1045,13 +1173,6 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 		return NULL;
 	}
 
-	if (!resize_hint && leaf->resize_pool) {
-		cairo_surface_destroy(leaf->cairo_surface);
-		leaf->cairo_surface = NULL;
-		shm_pool_destroy(leaf->resize_pool);
-		leaf->resize_pool = NULL;
-	}
-
 	surface_to_buffer_size (buffer_transform, buffer_scale, &width, &height);
 
 	if (leaf->cairo_surface &&
@@ -1062,51 +1183,115 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 	if (leaf->cairo_surface)
 		cairo_surface_destroy(leaf->cairo_surface);
 
-#ifdef USE_RESIZE_POOL
-	if (resize_hint && !leaf->resize_pool) {
-		/* Create a big pool to allocate from, while continuously
-		 * resizing. Mmapping a new pool in the server
-		 * is relatively expensive, so reusing a pool performs
-		 * better, but may temporarily reserve unneeded memory.
-		 */
-		/* We should probably base this number on the output size. */
-		leaf->resize_pool = shm_pool_create(surface->display,
-						    6 * 1024 * 1024);
-	}
-#endif
-
 	rect.width = width;
 	rect.height = height;
 
 	leaf->cairo_surface =
 		display_create_shm_surface(surface->display, &rect,
-					   surface->flags,
-					   leaf->resize_pool,
-					   &leaf->data);
+					   surface->flags, &leaf->data);
 	if (!leaf->cairo_surface)
 		return NULL;
 
 	wl_buffer_add_listener(leaf->data->buffer,
 			       &shm_surface_buffer_listener, surface);
 
+	leaf->stale = rect;
+	if (surface->last == leaf)
+		surface->last = NULL;
+
 out:
 	surface->current = leaf;
 
 	return cairo_surface_reference(leaf->cairo_surface);
 }
 
+static void
+rectangle_union(struct rectangle *dest, const struct rectangle *rect)
+{
+	int32_t x1, y1, x2, y2;
+
+	if (rect->width <= 0 || rect->height <= 0)
+		return;
+
+	if (dest->width <= 0 || dest->height <= 0) {
+		*dest = *rect;
+		return;
+	}
+
+	x1 = dest->x < rect->x ? dest->x : rect->x;
+	y1 = dest->y < rect->y ? dest->y : rect->y;
+	x2 = dest->x + dest->width;
+	if (x2 < rect->x + rect->width)
+		x2 = rect->x + rect->width;
+	y2 = dest->y + dest->height;
+	if (y2 < rect->y + rect->height)
+		y2 = rect->y + rect->height;
+
+	dest->x = x1;
+	dest->y = y1;
+	dest->width = x2 - x1;
+	dest->height = y2 - y1;
+}
+
+static int
+shm_surface_preserve(struct toysurface *base)
+{
+	struct shm_surface *surface = to_shm_surface(base);
+	struct shm_surface_leaf *leaf = surface->current;
+	struct shm_surface_leaf *last = surface->last;
+	cairo_surface_t *src = last ? last->cairo_surface : NULL;
+	cairo_surface_t *dst = leaf->cairo_surface;
+	struct rectangle *stale = &leaf->stale;
+	unsigned char *s, *d;
+	int stride, bpp, y;
+
+	if (leaf == last || stale->width <= 0 || stale->height <= 0)
+		return 0;
+
+	if (!src ||
+	    cairo_image_surface_get_format(src) !=
+	    cairo_image_surface_get_format(dst) ||
+	    cairo_image_surface_get_width(src) !=
+	    cairo_image_surface_get_width(dst) ||
+	    cairo_image_surface_get_height(src) !=
+	    cairo_image_surface_get_height(dst))
+		return -1;
+
+	bpp = cairo_image_surface_get_format(dst) ==
+		CAIRO_FORMAT_RGB16_565 ? 2 : 4;
+	stride = cairo_image_surface_get_stride(dst);
+	s = cairo_image_surface_get_data(src) + stale->y * stride +
+		stale->x * bpp;
+	d = cairo_image_surface_get_data(dst) + stale->y * stride +
+		stale->x * bpp;
+
+	cairo_surface_flush(dst);
+	for (y = 0; y < stale->height; y++)
+		memcpy(d + y * stride, s + y * stride, stale->width * bpp);
+	cairo_surface_mark_dirty(dst);
+
+	stale->width = 0;
+	stale->height = 0;
+
+	return 0;
+}
+
 static void
 shm_surface_swap(struct toysurface *base,
 		 enum wl_output_transform buffer_transform, int32_t buffer_scale,
+		 const struct rectangle *damage, int n_damage,
 		 struct rectangle *server_allocation)
 {
 	struct shm_surface *surface = to_shm_surface(base);
 	struct shm_surface_leaf *leaf = surface->current;
+	struct rectangle posted = { 0 };
+	int32_t width, height;
+	int i;
 
-	server_allocation->width =
-		cairo_image_surface_get_width(leaf->cairo_surface);
-	server_allocation->height =
-		cairo_image_surface_get_height(leaf->cairo_surface);
+	width = cairo_image_surface_get_width(leaf->cairo_surface);
+	height = cairo_image_surface_get_height(leaf->cairo_surface);
+	server_allocation->width = width;
+	server_allocation->height = height;
 
 	buffer_to_surface_size (buffer_transform, buffer_scale,
 				&server_allocation->width,
@@ -1114,14 +1299,47 @@ shm_surface_swap(struct toysurface *base,
 
 	wl_surface_attach(surface->surface, leaf->data->buffer,
 			  surface->dx, surface->dy);
-	wl_surface_damage(surface->surface, 0, 0,
-			  server_allocation->width, server_allocation->height);
+
+	if (n_damage == 0 || buffer_transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		wl_surface_damage(surface->surface, 0, 0,
+				  server_allocation->width,
+				  server_allocation->height);
+		posted.width = width;
+		posted.height = height;
+	} else {
+		for (i = 0; i < n_damage; i++) {
+			wl_surface_damage(surface->surface,
+					  damage[i].x, damage[i].y,
+					  damage[i].width, damage[i].height);
+			rectangle_union(&posted, &damage[i]);
+		}
+
+		/* In buffer pixels, and clipped to the buffer. */
+		posted.width = (posted.x + posted.width) * buffer_scale;
+		posted.height = (posted.y + posted.height) * buffer_scale;
+		posted.x = posted.x > 0 ? posted.x * buffer_scale : 0;
+		posted.y = posted.y > 0 ? posted.y * buffer_scale : 0;
+		if (posted.width > width)
+			posted.width = width;
+		if (posted.height > height)
+			posted.height = height;
+		posted.width -= posted.x;
+		posted.height -= posted.y;
+	}
+
 	wl_surface_commit(surface->surface);
 
 	DBG_OBJ(surface->surface, "leaf %d busy\n",
 		(int)(leaf - &surface->leaf[0]));
 
+	for (i = 0; i < MAX_LEAVES; i++)
+		if (&surface->leaf[i] != leaf && surface->leaf[i].cairo_surface)
+			rectangle_union(&surface->leaf[i].stale, &posted);
+
+	leaf->stale.width = 0;
+	leaf->stale.height = 0;
 	leaf->busy = 1;
+	surface->last = leaf;
 	surface->current = NULL;
 }
 
@@ -1162,6 +1380,7 @@ shm_surface_create(struct display *display, struct wl_surface *wl_surface,
 		return NULL;
 
 	surface->base.prepare = shm_surface_prepare;
+	surface->base.preserve = shm_surface_preserve;
 	surface->base.swap = shm_surface_swap;
 	surface->base.acquire = shm_surface_acquire;
 	surface->base.release = shm_surface_release;
@@ -1333,6 +1552,9 @@ display_get_pointer_image(struct display *display, int pointer)
 static void
 surface_flush(struct surface *surface)
 {
+	struct rectangle *damage = NULL;
+	int n_damage = 0;
+
 	if (!surface->cairo_surface)
 		return;
 
@@ -1350,10 +1572,19 @@ surface_flush(struct surface *surface)
 		surface->input_region = NULL;
 	}
 
+	if (!surface->damage_all) {
+		damage = surface->damage.data;
+		n_damage = surface->damage.size / sizeof *damage;
+	}
+
 	surface->toysurface->swap(surface->toysurface,
 				  surface->buffer_transform, surface->buffer_scale,
+				  damage, n_damage,
 				  &surface->server_allocation);
 
+	surface->damage.size = 0;
+	surface->damage_all = 0;
+
 	cairo_surface_destroy(surface->cairo_surface);
 	surface->cairo_surface = NULL;
 }
@@ -1512,6 +1743,7 @@ surface_destroy(struct surface *surface)
 	if (surface->toysurface)
 		surface->toysurface->destroy(surface->toysurface);
 
+	wl_array_release(&surface->damage);
 	wl_list_remove(&surface->link);
 	free(surface);
 }
@@ -1801,6 +2033,7 @@ widget_cairo_create(struct widget *widget)
 	struct surface *surface = widget->surface;
 	cairo_surface_t *cairo_surface;
 	cairo_t *cr;
+	struct rectangle *r;
 
 	cairo_surface = widget_get_cairo_surface(widget);
 	cr = cairo_create(cairo_surface);
@@ -1809,6 +2042,14 @@ widget_cairo_create(struct widget *widget)
 
 	cairo_translate(cr, -surface->allocation.x, -surface->allocation.y);
 
+	if (!surface->damage_all) {
+		wl_array_for_each(r, &surface->damage)
+			cairo_rectangle(cr, surface->allocation.x + r->x,
+					surface->allocation.y + r->y,
+					r->width, r->height);
+		cairo_clip(cr);
+	}
+
 	return cr;
 }
 
@@ -1935,7 +2176,91 @@ widget_schedule_redraw(struct widget *widget)
 {
 	DBG_OBJ(widget->surface->surface, "widget %p\n", widget);
 	widget->surface->redraw_needed = 1;
+	widget->surface->damage_all = 1;
+	window_schedule_redraw_task(widget->window);
+}
+
+/* Past this many separate areas, or once the areas cover most of the
+ * surface, a frame just redraws all of it. */
+#define SURFACE_DAMAGE_MAX 16
+
+/* Schedules a redraw of just the given area of the widget, in the same
+ * coordinates as its allocation. As long as only such areas are
+ * reported before the next frame, the rest of the surface keeps what
+ * was posted last and drawing is clipped to the damage. Areas that
+ * overlap or touch are merged, so repeated reports of the same area
+ * while a frame is pending do not pile up. */
+void
+widget_damage(struct widget *widget,
+	      int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct surface *surface = widget->surface;
+	struct rectangle *r, *last;
+	int32_t x2, y2;
+	int64_t area;
+	int n;
+
+	surface->redraw_needed = 1;
 	window_schedule_redraw_task(widget->window);
+
+	if (surface->damage_all || width <= 0 || height <= 0)
+		return;
+
+	x -= surface->allocation.x;
+	y -= surface->allocation.y;
+	x2 = x + width;
+	y2 = y + height;
+
+	/* Grow the new area over every area it touches, dropping those.
+	 * A grown area can reach ones it missed, so look again. */
+restart:
+	wl_array_for_each(r, &surface->damage) {
+		if (r->x > x2 || r->x + r->width < x ||
+		    r->y > y2 || r->y + r->height < y)
+			continue;
+
+		if (r->x < x)
+			x = r->x;
+		if (r->y < y)
+			y = r->y;
+		if (r->x + r->width > x2)
+			x2 = r->x + r->width;
+		if (r->y + r->height > y2)
+			y2 = r->y + r->height;
+
+		last = (struct rectangle *)
+			((char *) surface->damage.data +
+			 surface->damage.size) - 1;
+		*r = *last;
+		surface->damage.size -= sizeof *r;
+		goto restart;
+	}
+
+	n = surface->damage.size / sizeof *r;
+	if (n >= SURFACE_DAMAGE_MAX)
+		goto damage_all;
+
+	r = wl_array_add(&surface->damage, sizeof *r);
+	if (!r)
+		goto damage_all;
+
+	r->x = x;
+	r->y = y;
+	r->width = x2 - x;
+	r->height = y2 - y;
+
+	area = 0;
+	wl_array_for_each(r, &surface->damage)
+		area += (int64_t) r->width * r->height;
+	if (area * 4 >= (int64_t) surface->allocation.width *
+			surface->allocation.height * 3)
+		goto damage_all;
+
+	return;
+
+damage_all:
+	surface->damage_all = 1;
+	surface->damage.size = 0;
 }
 
 cairo_surface_t *
@@ -3947,6 +4272,12 @@ surface_redraw(struct surface *surface)
 		return -1;
 	}
 
+	if (surface->damage_all || surface->window->redraw_needed ||
+	    surface->damage.size == 0 ||
+	    surface->buffer_transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    surface->toysurface->preserve(surface->toysurface) < 0)
+		surface->damage_all = 1;
+
 	surface->frame_cb = wl_surface_frame(surface->surface);
 	wl_callback_add_listener(surface->frame_cb, &listener, surface);
 	DBG_OBJ(surface->frame_cb, "new\n");
@@ -4029,8 +4360,10 @@ window_schedule_redraw(struct window *window)
 
 	DBG_OBJ(window->main_surface->surface, "window %p\n", window);
 
-	wl_list_for_each(surface, &window->subsurface_list, link)
+	wl_list_for_each(surface, &window->subsurface_list, link) {
 		surface->redraw_needed = 1;
+		surface->damage_all = 1;
+	}
 
 	window_schedule_redraw_task(window);
 }
@@ -4325,6 +4658,8 @@ surface_create(struct window *window)
 	surface->window = window;
 	surface->surface = wl_compositor_create_surface(display->compositor);
 	surface->buffer_scale = 1;
+	wl_array_init(&surface->damage);
+	surface->damage_all = 1;
 	wl_surface_add_listener(surface->surface, &surface_listener, window);
 
 	wl_list_insert(&window->subsurface_list, &surface->link);
@@ -5189,6 +5524,8 @@ display_create(int *argc, char *argv[])
 	wl_list_init(&d->input_list);
 	wl_list_init(&d->output_list);
 	wl_list_init(&d->global_list);
+	wl_list_init(&d->shm_pool_list);
+	d->shm_debug = getenv("TOYTOOLKIT_SHM_DEBUG") != NULL;
 
 	d->workspace = 0;
 	d->workspace_count = 1;
@@ -5241,6 +5578,8 @@ display_destroy_inputs(struct display *display)
 void
 display_destroy(struct display *display)
 {
+	struct shm_pool *pool, *tmp;
+
 	if (!wl_list_empty(&display->window_list))
 		fprintf(stderr, "toytoolkit warning: %d windows exist.\n",
 			wl_list_length(&display->window_list));
@@ -5251,6 +5590,19 @@ display_destroy(struct display *display)
 	cairo_surface_destroy(display->dummy_surface);
 	free(display->dummy_surface_data);
 
+	shm_stats_dump(display, "display destroyed");
+
+	/* Pools still in use go when their last buffer does. */
+	wl_list_for_each_safe(pool, tmp, &display->shm_pool_list, link) {
+		if (pool->used == 0) {
+			shm_pool_destroy(pool);
+			continue;
+		}
+		wl_list_remove(&pool->link);
+		wl_list_init(&pool->link);
+		pool->display = NULL;
+	}
+
 	display_destroy_outputs(display);
 	display_destroy_inputs(display);
 
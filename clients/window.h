@@ -156,6 +156,18 @@ struct wl_buffer *
 display_get_buffer_for_surface(struct display *display,
 			       cairo_surface_t *surface);
 
+/* Shared memory held for buffers.  'backed' less 'requested' is what the
+ * size classes, the free slots and the idle pools waste. */
+struct shm_stats {
+	int pools;
+	int slots;
+	size_t backed;
+	size_t requested;
+};
+
+void
+display_get_shm_stats(struct display *display, struct shm_stats *stats);
+
 struct wl_cursor_image *
 display_get_pointer_image(struct display *display, int pointer);
 
@@ -507,6 +519,9 @@ widget_set_axis_handler(struct widget *widget,
 			widget_axis_handler_t handler);
 void
 widget_schedule_redraw(struct widget *widget);
+void
+widget_damage(struct widget *widget,
+	      int32_t x, int32_t y, int32_t width, int32_t height);
 
 struct widget *
 window_frame_create(struct window *window, void *data);
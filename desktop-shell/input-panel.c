@@ -62,16 +62,18 @@ show_input_panels(struct wl_listener *listener, void *data)
 
 	shell->showing_input_panels = true;
 
-	if (!shell->locked)
+	if (!shell->locked) {
 		wl_list_insert(&shell->panel_layer.link,
 			       &shell->input_panel_layer.link);
+		weston_compositor_view_list_dirty(shell->compositor);
+	}
 
 	wl_list_for_each_safe(ipsurf, next,
 			      &shell->input_panel.surfaces, link) {
 		if (!ipsurf->surface->buffer_ref.buffer)
 			continue;
-		wl_list_insert(&shell->input_panel_layer.view_list,
-			       &ipsurf->view->layer_link);
+		weston_view_layer_insert(ipsurf->view,
+					 &shell->input_panel_layer.view_list);
 		weston_view_geometry_dirty(ipsurf->view);
 		weston_view_update_transform(ipsurf->view);
 		weston_surface_damage(ipsurf->surface);
@@ -93,8 +95,10 @@ hide_input_panels(struct wl_listener *listener, void *data)
 
 	shell->showing_input_panels = false;
 
-	if (!shell->locked)
+	if (!shell->locked) {
 		wl_list_remove(&shell->input_panel_layer.link);
+		weston_compositor_view_list_dirty(shell->compositor);
+	}
 
 	wl_list_for_each_safe(view, next,
 			      &shell->input_panel_layer.view_list, layer_link)
@@ -142,8 +146,8 @@ input_panel_configure(struct weston_surface *surface, int32_t sx, int32_t sy)
 	weston_view_set_position(ip_surface->view, x, y);
 
 	if (show_surface) {
-		wl_list_insert(&shell->input_panel_layer.view_list,
-			       &ip_surface->view->layer_link);
+		weston_view_layer_insert(ip_surface->view,
+					 &shell->input_panel_layer.view_list);
 		weston_view_update_transform(ip_surface->view);
 		weston_surface_damage(surface);
 		weston_slide_run(ip_surface->view, ip_surface->view->surface->height, 0, NULL, NULL);
@@ -701,8 +701,8 @@ animate_focus_change(struct desktop_shell *shell, struct workspace *ws,
 		ws->fsurf_back->view->alpha = 0.0;
 		focus_surface_created = true;
 	} else {
-		wl_list_remove(&ws->fsurf_front->view->layer_link);
-		wl_list_remove(&ws->fsurf_back->view->layer_link);
+		weston_view_layer_remove(ws->fsurf_front->view);
+		weston_view_layer_remove(ws->fsurf_back->view);
 	}
 
 	if (ws->focus_animation) {
@@ -711,11 +711,11 @@ animate_focus_change(struct desktop_shell *shell, struct workspace *ws,
 	}
 
 	if (to)
-		wl_list_insert(&to->layer_link,
-			       &ws->fsurf_front->view->layer_link);
+		weston_view_layer_insert(ws->fsurf_front->view,
+					 &to->layer_link);
 	else if (from)
-		wl_list_insert(&ws->layer.view_list,
-			       &ws->fsurf_front->view->layer_link);
+		weston_view_layer_insert(ws->fsurf_front->view,
+					 &ws->layer.view_list);
 
 	if (focus_surface_created) {
 		ws->focus_animation = weston_fade_run(
@@ -723,15 +723,15 @@ animate_focus_change(struct desktop_shell *shell, struct workspace *ws,
 			ws->fsurf_front->view->alpha, 0.6, 300,
 			focus_animation_done, ws);
 	} else if (from) {
-		wl_list_insert(&from->layer_link,
-			       &ws->fsurf_back->view->layer_link);
+		weston_view_layer_insert(ws->fsurf_back->view,
+					 &from->layer_link);
 		ws->focus_animation = weston_stable_fade_run(
 			ws->fsurf_front->view, 0.0,
 			ws->fsurf_back->view, 0.6,
 			focus_animation_done, ws);
 	} else if (to) {
-		wl_list_insert(&ws->layer.view_list,
-			       &ws->fsurf_back->view->layer_link);
+		weston_view_layer_insert(ws->fsurf_back->view,
+					 &ws->layer.view_list);
 		ws->focus_animation = weston_stable_fade_run(
 			ws->fsurf_front->view, 0.0,
 			ws->fsurf_back->view, 0.6,
@@ -816,6 +816,7 @@ activate_workspace(struct desktop_shell *shell, unsigned int index)
 
 	ws = get_workspace(shell, index);
 	wl_list_insert(&shell->panel_layer.link, &ws->layer.link);
+	weston_compositor_view_list_dirty(shell->compositor);
 
 	shell->workspaces.current = index;
 }
@@ -946,6 +947,7 @@ finish_workspace_change_animation(struct desktop_shell *shell,
 	shell->workspaces.anim_to = NULL;
 
 	wl_list_remove(&shell->workspaces.anim_from->layer.link);
+	weston_compositor_view_list_dirty(shell->compositor);
 }
 
 static void
@@ -1028,6 +1030,7 @@ animate_workspace_change(struct desktop_shell *shell,
 		       &shell->workspaces.animation.link);
 
 	wl_list_insert(from->layer.link.prev, &to->layer.link);
+	weston_compositor_view_list_dirty(shell->compositor);
 
 	workspace_translate_in(to, 0);
 
@@ -1043,6 +1046,7 @@ update_workspace(struct desktop_shell *shell, unsigned int index,
 	shell->workspaces.current = index;
 	wl_list_insert(&from->layer.link, &to->layer.link);
 	wl_list_remove(&from->layer.link);
+	weston_compositor_view_list_dirty(shell->compositor);
 }
 
 static void
@@ -1140,8 +1144,8 @@ move_surface_to_workspace(struct desktop_shell *shell,
 	from = get_current_workspace(shell);
 	to = get_workspace(shell, workspace);
 
-	wl_list_remove(&view->layer_link);
-	wl_list_insert(&to->layer.view_list, &view->layer_link);
+	weston_view_layer_remove(view);
+	weston_view_layer_insert(view, &to->layer.view_list);
 
 	shell_surface_update_child_surface_layers(shsurf);
 
@@ -1180,8 +1184,8 @@ take_surface_to_workspace_by_seat(struct desktop_shell *shell,
 	from = get_current_workspace(shell);
 	to = get_workspace(shell, index);
 
-	wl_list_remove(&view->layer_link);
-	wl_list_insert(&to->layer.view_list, &view->layer_link);
+	weston_view_layer_remove(view);
+	weston_view_layer_insert(view, &to->layer.view_list);
 
 	shsurf = get_shell_surface(surface);
 	if (shsurf != NULL)
@@ -1194,6 +1198,7 @@ take_surface_to_workspace_by_seat(struct desktop_shell *shell,
 	    shell->workspaces.anim_to == from) {
 		wl_list_remove(&to->layer.link);
 		wl_list_insert(from->layer.link.prev, &to->layer.link);
+		weston_compositor_view_list_dirty(shell->compositor);
 
 		reverse_workspace_change_animation(shell, index, from, to);
 		broadcast_current_workspace_state(shell);
@@ -2043,9 +2048,9 @@ shell_surface_update_child_surface_layers (struct shell_surface *shsurf)
 	wl_list_for_each_reverse(child, &shsurf->children_list, children_link) {
 		if (shsurf->view->layer_link.prev != &child->view->layer_link) {
 			weston_view_geometry_dirty(child->view);
-			wl_list_remove(&child->view->layer_link);
-			wl_list_insert(shsurf->view->layer_link.prev,
-			               &child->view->layer_link);
+			weston_view_layer_remove(child->view);
+			weston_view_layer_insert(child->view,
+						 shsurf->view->layer_link.prev);
 			weston_view_geometry_dirty(child->view);
 			weston_surface_damage(child->surface);
 
@@ -2074,8 +2079,8 @@ shell_surface_update_layer(struct shell_surface *shsurf)
 		return;
 
 	weston_view_geometry_dirty(shsurf->view);
-	wl_list_remove(&shsurf->view->layer_link);
-	wl_list_insert(new_layer_link, &shsurf->view->layer_link);
+	weston_view_layer_remove(shsurf->view);
+	weston_view_layer_insert(shsurf->view, new_layer_link);
 	weston_view_geometry_dirty(shsurf->view);
 	weston_surface_damage(shsurf->surface);
 
@@ -2492,9 +2497,9 @@ shell_ensure_fullscreen_black_view(struct shell_surface *shsurf)
 			                     output->height);
 
 	weston_view_geometry_dirty(shsurf->fullscreen.black_view);
-	wl_list_remove(&shsurf->fullscreen.black_view->layer_link);
-	wl_list_insert(&shsurf->view->layer_link,
-	               &shsurf->fullscreen.black_view->layer_link);
+	weston_view_layer_remove(shsurf->fullscreen.black_view);
+	weston_view_layer_insert(shsurf->fullscreen.black_view,
+				 &shsurf->view->layer_link);
 	weston_view_geometry_dirty(shsurf->fullscreen.black_view);
 	weston_surface_damage(shsurf->surface);
 }
@@ -3533,7 +3538,7 @@ configure_static_view(struct weston_view *ev, struct weston_layer *layer)
 	weston_view_set_position(ev, ev->output->x, ev->output->y);
 
 	if (wl_list_empty(&ev->layer_link)) {
-		wl_list_insert(&layer->view_list, &ev->layer_link);
+		weston_view_layer_insert(ev, &layer->view_list);
 		weston_compositor_schedule_repaint(ev->surface->compositor);
 	}
 }
@@ -3638,8 +3643,7 @@ lock_surface_configure(struct weston_surface *surface, int32_t sx, int32_t sy)
 	center_on_output(view, get_default_output(shell->compositor));
 
 	if (!weston_surface_is_mapped(surface)) {
-		wl_list_insert(&shell->lock_layer.view_list,
-			       &view->layer_link);
+		weston_view_layer_insert(view, &shell->lock_layer.view_list);
 		weston_view_update_transform(view);
 		shell_fade(shell, FADE_IN);
 	}
@@ -3700,6 +3704,7 @@ resume_desktop(struct desktop_shell *shell)
 	} else {
 		wl_list_insert(&shell->panel_layer.link, &ws->layer.link);
 	}
+	weston_compositor_view_list_dirty(shell->compositor);
 
 	restore_focus_state(shell, get_current_workspace(shell));
 
@@ -4191,8 +4196,8 @@ alt_tab_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 		preview->view = v = weston_view_create(view->surface);
 		v->output = view->output;
 
-		wl_list_remove(&v->layer_link);
-		wl_list_insert(&ws->layer.view_list, &v->layer_link);
+		weston_view_layer_remove(v);
+		weston_view_layer_insert(v, &ws->layer.view_list);
 		weston_view_damage_below(v);
 		weston_surface_damage(v->surface);
 
@@ -4400,8 +4405,8 @@ lower_fullscreen_layer(struct desktop_shell *shell)
 	wl_list_for_each_reverse_safe(view, prev,
 				      &shell->fullscreen_layer.view_list,
 				      layer_link) {
-		wl_list_remove(&view->layer_link);
-		wl_list_insert(&ws->layer.view_list, &view->layer_link);
+		weston_view_layer_remove(view);
+		weston_view_layer_insert(view, &ws->layer.view_list);
 		weston_view_damage_below(view);
 		weston_surface_damage(view->surface);
 	}
@@ -4525,6 +4530,7 @@ lock(struct desktop_shell *shell)
 	wl_list_remove(&ws->layer.link);
 	wl_list_insert(&shell->compositor->cursor_layer.link,
 		       &shell->lock_layer.link);
+	weston_compositor_view_list_dirty(shell->compositor);
 
 	launch_screensaver(shell);
 
@@ -4594,8 +4600,7 @@ shell_fade_create_surface(struct desktop_shell *shell)
 	weston_surface_set_size(surface, 8192, 8192);
 	weston_view_set_position(view, 0, 0);
 	weston_surface_set_color(surface, 0.0, 0.0, 0.0, 1.0);
-	wl_list_insert(&compositor->fade_layer.view_list,
-		       &view->layer_link);
+	weston_view_layer_insert(view, &compositor->fade_layer.view_list);
 	pixman_region32_init(&surface->input);
 
 	return view;
@@ -5102,8 +5107,8 @@ screensaver_configure(struct weston_surface *surface, int32_t sx, int32_t sy)
 	center_on_output(view, surface->output);
 
 	if (wl_list_empty(&view->layer_link)) {
-		wl_list_insert(shell->lock_layer.view_list.prev,
-			       &view->layer_link);
+		weston_view_layer_insert(view,
+					 shell->lock_layer.view_list.prev);
 		weston_view_update_transform(view);
 		wl_event_source_timer_update(shell->screensaver.timer,
 					     shell->screensaver.duration);
@@ -34,8 +34,6 @@
 #include "image-loader.h"
 #include "config-parser.h"
 
-#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
-
 void
 surface_flush_device(cairo_surface_t *surface)
 {
@@ -46,95 +44,203 @@ surface_flush_device(cairo_surface_t *surface)
 		cairo_device_flush(device);
 }
 
+/* Each channel of an ARGB pixel in its own 16 bit lane, so that the
+ * running sums of all four channels of a box blur fit in one integer.
+ * A lane holds at most 255 times the box width. */
+static inline uint64_t
+pixel_spread(uint32_t p)
+{
+	uint64_t v = p;
+
+	v = (v | v << 16) & 0x0000ffff0000ffffULL;
+	v = (v | v << 8) & 0x00ff00ff00ff00ffULL;
+
+	return v;
+}
+
+/* Divide each lane by the box width, given as 65536 / width rounded up,
+ * which never takes a channel above 255 for widths up to 256. */
+static inline uint32_t
+pixel_average(uint64_t sum, uint32_t mul)
+{
+	return (((sum >> 48) & 0xffff) * mul >> 16) << 24 |
+	       (((sum >> 32) & 0xffff) * mul >> 16) << 16 |
+	       (((sum >> 16) & 0xffff) * mul >> 16) << 8 |
+	       ((sum & 0xffff) * mul >> 16);
+}
+
+/* Box blur n pixels from src into every step'th pixel of dst with a
+ * running sum.  Pixels past the ends count as transparent black. */
+static void
+box_blur_line(const uint32_t *src, uint32_t *dst, int n, int step,
+	      int radius)
+{
+	uint32_t mul = (65536 + 2 * radius) / (2 * radius + 1);
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < radius && i < n; i++)
+		sum += pixel_spread(src[i]);
+
+	for (i = 0; i < n; i++) {
+		if (i + radius < n)
+			sum += pixel_spread(src[i + radius]);
+		dst[i * step] = pixel_average(sum, mul);
+		if (i >= radius)
+			sum -= pixel_spread(src[i - radius]);
+	}
+}
+
+/* Radii of three box blurs that together approximate a gaussian with
+ * the given variance. */
+static void
+box_blur_radii(double variance, int *radii)
+{
+	double ideal = sqrt(4 * variance + 1);
+	int lower, i, m;
+
+	lower = floor(ideal);
+	if (lower % 2 == 0)
+		lower--;
+
+	m = lround((12 * variance - 3 * lower * lower - 12 * lower - 9) /
+		   (-4 * lower - 4));
+
+	for (i = 0; i < 3; i++)
+		radii[i] = (i < m ? lower : lower + 2) / 2;
+}
+
+/* One row or column at a time; reused by every blur. */
+static uint32_t *blur_scratch;
+static int blur_scratch_size;
+
+/* Blur the surface with the gaussian that used to be applied as a
+ * (2 * radius + 1) tap kernel, as three passes of a box blur in each
+ * direction. */
 static int
-blur_surface(cairo_surface_t *surface, int margin)
+blur_surface(cairo_surface_t *surface, int radius)
 {
-	int32_t width, height, stride, x, y, z, w;
-	uint8_t *src, *dst;
-	uint32_t *s, *d, a, p;
-	int i, j, k, size, half;
-	uint32_t kernel[71];
-	double f;
-
-	size = ARRAY_LENGTH(kernel);
+	int32_t width, height, stride;
+	uint32_t *data, *line;
+	int i, j, pass, radii[3];
+
 	width = cairo_image_surface_get_width(surface);
 	height = cairo_image_surface_get_height(surface);
-	stride = cairo_image_surface_get_stride(surface);
-	src = cairo_image_surface_get_data(surface);
-
-	dst = malloc(height * stride);
-	if (dst == NULL)
-		return -1;
-
-	half = size / 2;
-	a = 0;
-	for (i = 0; i < size; i++) {
-		f = (i - half);
-		kernel[i] = exp(- f * f / ARRAY_LENGTH(kernel)) * 10000;
-		a += kernel[i];
+	stride = cairo_image_surface_get_stride(surface) / 4;
+
+	if (blur_scratch_size < width || blur_scratch_size < height) {
+		line = realloc(blur_scratch, (width > height ? width : height) *
+			       sizeof *line);
+		if (line == NULL)
+			return -1;
+		blur_scratch = line;
+		blur_scratch_size = width > height ? width : height;
 	}
+	line = blur_scratch;
 
-	for (i = 0; i < height; i++) {
-		s = (uint32_t *) (src + i * stride);
-		d = (uint32_t *) (dst + i * stride);
-		for (j = 0; j < width; j++) {
-			if (margin < j && j < width - margin) {
-				d[j] = s[j];
-				continue;
-			}
-
-			x = 0;
-			y = 0;
-			z = 0;
-			w = 0;
-			for (k = 0; k < size; k++) {
-				if (j - half + k < 0 || j - half + k >= width)
-					continue;
-				p = s[j - half + k];
-
-				x += (p >> 24) * kernel[k];
-				y += ((p >> 16) & 0xff) * kernel[k];
-				z += ((p >> 8) & 0xff) * kernel[k];
-				w += (p & 0xff) * kernel[k];
-			}
-			d[j] = (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
+	cairo_surface_flush(surface);
+	data = (uint32_t *) cairo_image_surface_get_data(surface);
+
+	box_blur_radii((2 * radius + 1) / 2.0, radii);
+
+	for (pass = 0; pass < 3; pass++) {
+		for (i = 0; i < height; i++) {
+			memcpy(line, data + i * stride, width * sizeof *line);
+			box_blur_line(line, data + i * stride, width, 1,
+				      radii[pass]);
 		}
-	}
 
-	for (i = 0; i < height; i++) {
-		s = (uint32_t *) (dst + i * stride);
-		d = (uint32_t *) (src + i * stride);
 		for (j = 0; j < width; j++) {
-			if (margin <= i && i < height - margin) {
-				d[j] = s[j];
-				continue;
-			}
-
-			x = 0;
-			y = 0;
-			z = 0;
-			w = 0;
-			for (k = 0; k < size; k++) {
-				if (i - half + k < 0 || i - half + k >= height)
-					continue;
-				s = (uint32_t *) (dst + (i - half + k) * stride);
-				p = s[j];
-
-				x += (p >> 24) * kernel[k];
-				y += ((p >> 16) & 0xff) * kernel[k];
-				z += ((p >> 8) & 0xff) * kernel[k];
-				w += (p & 0xff) * kernel[k];
-			}
-			d[j] = (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
+			for (i = 0; i < height; i++)
+				line[i] = data[i * stride + j];
+			box_blur_line(line, data + j, height, stride,
+				      radii[pass]);
 		}
 	}
 
-	free(dst);
 	cairo_surface_mark_dirty(surface);
 
 	return 0;
 }
 
+/* Blurred shadows of rounded squares, shared by all themes in the
+ * process.  An entry goes away once only the cache holds its surface. */
+struct shadow_tile {
+	int size, blur_radius, corner_radius;
+	cairo_surface_t *surface;
+	struct shadow_tile *next;
+};
+
+static struct shadow_tile *shadow_cache;
+
+static cairo_surface_t *
+shadow_tile_get(int size, int blur_radius, int corner_radius)
+{
+	struct shadow_tile *tile;
+	cairo_surface_t *surface;
+	cairo_t *cr;
+
+	for (tile = shadow_cache; tile; tile = tile->next)
+		if (tile->size == size && tile->blur_radius == blur_radius &&
+		    tile->corner_radius == corner_radius)
+			return cairo_surface_reference(tile->surface);
+
+	tile = malloc(sizeof *tile);
+	if (tile == NULL)
+		return NULL;
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
+	cr = cairo_create(surface);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	cairo_set_source_rgba(cr, 0, 0, 0, 1);
+	rounded_rect(cr, size / 4, size / 4, size * 3 / 4, size * 3 / 4,
+		     corner_radius);
+	cairo_fill(cr);
+	if (cairo_status(cr) != CAIRO_STATUS_SUCCESS ||
+	    blur_surface(surface, blur_radius) == -1) {
+		cairo_destroy(cr);
+		cairo_surface_destroy(surface);
+		free(tile);
+		return NULL;
+	}
+	cairo_destroy(cr);
+
+	tile->size = size;
+	tile->blur_radius = blur_radius;
+	tile->corner_radius = corner_radius;
+	tile->surface = surface;
+	tile->next = shadow_cache;
+	shadow_cache = tile;
+
+	return cairo_surface_reference(surface);
+}
+
+static void
+shadow_tile_release(cairo_surface_t *surface)
+{
+	struct shadow_tile **p, *tile;
+
+	cairo_surface_destroy(surface);
+
+	p = &shadow_cache;
+	while ((tile = *p)) {
+		if (cairo_surface_get_reference_count(tile->surface) > 1) {
+			p = &tile->next;
+			continue;
+		}
+
+		*p = tile->next;
+		cairo_surface_destroy(tile->surface);
+		free(tile);
+	}
+
+	if (shadow_cache == NULL) {
+		free(blur_scratch);
+		blur_scratch = NULL;
+		blur_scratch_size = 0;
+	}
+}
+
 void
 tile_mask(cairo_t *cr, cairo_surface_t *surface,
 	  int x, int y, int width, int height, int margin, int top_margin)
@@ -350,17 +456,9 @@ theme_create(void)
 	t->width = 6;
 	t->titlebar_height = 27;
 	t->frame_radius = 3;
-	t->shadow = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 128, 128);
-	cr = cairo_create(t->shadow);
-	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-	cairo_set_source_rgba(cr, 0, 0, 0, 1);
-	rounded_rect(cr, 32, 32, 96, 96, t->frame_radius);
-	cairo_fill(cr);
-	if (cairo_status (cr) != CAIRO_STATUS_SUCCESS)
-		goto err_shadow;
-	cairo_destroy(cr);
-	if (blur_surface(t->shadow, 64) == -1)
-		goto err_shadow;
+	t->shadow = shadow_tile_get(128, 35, t->frame_radius);
+	if (t->shadow == NULL)
+		goto err_free;
 
 	t->active_frame =
 		cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 128, 128);
@@ -395,8 +493,8 @@ theme_create(void)
 	cairo_surface_destroy(t->inactive_frame);
  err_active_frame:
 	cairo_surface_destroy(t->active_frame);
- err_shadow:
-	cairo_surface_destroy(t->shadow);
+	shadow_tile_release(t->shadow);
+ err_free:
 	free(t);
 	return NULL;
 }
@@ -406,7 +504,7 @@ theme_destroy(struct theme *t)
 {
 	cairo_surface_destroy(t->active_frame);
 	cairo_surface_destroy(t->inactive_frame);
-	cairo_surface_destroy(t->shadow);
+	shadow_tile_release(t->shadow);
 	free(t);
 }
 
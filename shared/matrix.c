@@ -28,6 +28,12 @@
 #include <stdlib.h>
 #include <math.h>
 
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #ifdef IN_WESTON
 #include <wayland-server.h>
 #else
@@ -56,10 +62,56 @@ weston_matrix_init(struct weston_matrix *matrix)
 	memcpy(matrix, &identity, sizeof identity);
 }
 
+/*
+ * The SIMD versions below compute column i of n * m as the columns of n
+ * weighted by the entries of column i of m, summed in the same order as
+ * the plain C loops, so all versions give bit-identical results.
+ */
+
 /* m <- n * m, that is, m is multiplied on the LEFT. */
 WL_EXPORT void
 weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
 {
+#if defined(__SSE__)
+	__m128 c0, c1, c2, c3, r;
+	const float *col;
+	int i;
+
+	c0 = _mm_loadu_ps(n->d + 0);
+	c1 = _mm_loadu_ps(n->d + 4);
+	c2 = _mm_loadu_ps(n->d + 8);
+	c3 = _mm_loadu_ps(n->d + 12);
+
+	for (i = 0; i < 16; i += 4) {
+		col = m->d + i;
+		r = _mm_mul_ps(c0, _mm_set1_ps(col[0]));
+		r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(col[1])));
+		r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(col[2])));
+		r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(col[3])));
+		_mm_storeu_ps(m->d + i, r);
+	}
+	m->type |= n->type;
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+	float32x4_t c0, c1, c2, c3, r;
+	const float *col;
+	int i;
+
+	c0 = vld1q_f32(n->d + 0);
+	c1 = vld1q_f32(n->d + 4);
+	c2 = vld1q_f32(n->d + 8);
+	c3 = vld1q_f32(n->d + 12);
+
+	/* Separate multiplies and adds; vmlaq_f32 may be fused. */
+	for (i = 0; i < 16; i += 4) {
+		col = m->d + i;
+		r = vmulq_n_f32(c0, col[0]);
+		r = vaddq_f32(r, vmulq_n_f32(c1, col[1]));
+		r = vaddq_f32(r, vmulq_n_f32(c2, col[2]));
+		r = vaddq_f32(r, vmulq_n_f32(c3, col[3]));
+		vst1q_f32(m->d + i, r);
+	}
+	m->type |= n->type;
+#else
 	struct weston_matrix tmp;
 	const float *row, *column;
 	div_t d;
@@ -75,45 +127,81 @@ weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
 	}
 	tmp.type = m->type | n->type;
 	memcpy(m, &tmp, sizeof tmp);
+#endif
 }
 
+/* The translate, scale and rotate helpers below are multiplications on
+ * the left by a matrix of known shape, so they only compute the terms
+ * that are not multiplied by zero, which leaves the result unchanged. */
+
 WL_EXPORT void
 weston_matrix_translate(struct weston_matrix *matrix, float x, float y, float z)
 {
-	struct weston_matrix translate = {
-		.d = { 1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  x, y, z, 1 },
-		.type = WESTON_MATRIX_TRANSFORM_TRANSLATE,
-	};
+	float *d = matrix->d;
+	int i;
 
-	weston_matrix_multiply(matrix, &translate);
+	for (i = 0; i < 16; i += 4) {
+		d[i + 0] += d[i + 3] * x;
+		d[i + 1] += d[i + 3] * y;
+		d[i + 2] += d[i + 3] * z;
+	}
+	matrix->type |= WESTON_MATRIX_TRANSFORM_TRANSLATE;
 }
 
 WL_EXPORT void
 weston_matrix_scale(struct weston_matrix *matrix, float x, float y,float z)
 {
-	struct weston_matrix scale = {
-		.d = { x, 0, 0, 0,  0, y, 0, 0,  0, 0, z, 0,  0, 0, 0, 1 },
-		.type = WESTON_MATRIX_TRANSFORM_SCALE,
-	};
+	float *d = matrix->d;
+	int i;
 
-	weston_matrix_multiply(matrix, &scale);
+	for (i = 0; i < 16; i += 4) {
+		d[i + 0] *= x;
+		d[i + 1] *= y;
+		d[i + 2] *= z;
+	}
+	matrix->type |= WESTON_MATRIX_TRANSFORM_SCALE;
 }
 
 WL_EXPORT void
 weston_matrix_rotate_xy(struct weston_matrix *matrix, float cos, float sin)
 {
-	struct weston_matrix translate = {
-		.d = { cos, sin, 0, 0,  -sin, cos, 0, 0,  0, 0, 1, 0,  0, 0, 0, 1 },
-		.type = WESTON_MATRIX_TRANSFORM_ROTATE,
-	};
-
-	weston_matrix_multiply(matrix, &translate);
+	float *d = matrix->d;
+	float x, y;
+	int i;
+
+	for (i = 0; i < 16; i += 4) {
+		x = d[i + 0];
+		y = d[i + 1];
+		d[i + 0] = x * cos - y * sin;
+		d[i + 1] = x * sin + y * cos;
+	}
+	matrix->type |= WESTON_MATRIX_TRANSFORM_ROTATE;
 }
 
 /* v <- m * v */
 WL_EXPORT void
 weston_matrix_transform(struct weston_matrix *matrix, struct weston_vector *v)
 {
+#if defined(__SSE__)
+	__m128 r;
+
+	r = _mm_mul_ps(_mm_loadu_ps(matrix->d + 0), _mm_set1_ps(v->f[0]));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(matrix->d + 4),
+				     _mm_set1_ps(v->f[1])));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(matrix->d + 8),
+				     _mm_set1_ps(v->f[2])));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(matrix->d + 12),
+				     _mm_set1_ps(v->f[3])));
+	_mm_storeu_ps(v->f, r);
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+	float32x4_t r;
+
+	r = vmulq_n_f32(vld1q_f32(matrix->d + 0), v->f[0]);
+	r = vaddq_f32(r, vmulq_n_f32(vld1q_f32(matrix->d + 4), v->f[1]));
+	r = vaddq_f32(r, vmulq_n_f32(vld1q_f32(matrix->d + 8), v->f[2]));
+	r = vaddq_f32(r, vmulq_n_f32(vld1q_f32(matrix->d + 12), v->f[3]));
+	vst1q_f32(v->f, r);
+#else
 	int i, j;
 	struct weston_vector t;
 
@@ -124,6 +212,7 @@ weston_matrix_transform(struct weston_matrix *matrix, struct weston_vector *v)
 	}
 
 	*v = t;
+#endif
 }
 
 static inline void
@@ -253,6 +342,44 @@ inverse_transform(const double *LU, const unsigned *p, float *v)
 		v[j] = b[j];
 }
 
+/*
+ * Inverse of a matrix that only scales and translates.  For such a
+ * matrix the LU decomposition is the matrix itself with no pivoting, so
+ * this is what the general path computes, in the same double precision
+ * and order, minus the work on zeros.  Returns 1 if the matrix is not of
+ * that shape; the type flags are only a hint, some callers fill in d[]
+ * directly.
+ */
+static int
+matrix_invert_scale_translate(struct weston_matrix *inverse,
+			      const struct weston_matrix *matrix)
+{
+	const float *d = matrix->d;
+	double sx = d[0], sy = d[5], sz = d[10];
+	double tx = d[12], ty = d[13], tz = d[14];
+	unsigned int type = matrix->type;
+
+	if (d[1] != 0 || d[2] != 0 || d[3] != 0 ||
+	    d[4] != 0 || d[6] != 0 || d[7] != 0 ||
+	    d[8] != 0 || d[9] != 0 || d[11] != 0 || d[15] != 1)
+		return 1;
+
+	if (fabs(sx) < 1e-9 || fabs(sy) < 1e-9 || fabs(sz) < 1e-9)
+		return -1; /* zero pivot, not invertible */
+
+	/* inverse may be matrix, everything is read by now. */
+	weston_matrix_init(inverse);
+	inverse->d[0] = 1.0 / sx;
+	inverse->d[5] = 1.0 / sy;
+	inverse->d[10] = 1.0 / sz;
+	inverse->d[12] = -tx / sx;
+	inverse->d[13] = -ty / sy;
+	inverse->d[14] = -tz / sz;
+	inverse->type = type;
+
+	return 0;
+}
+
 WL_EXPORT int
 weston_matrix_invert(struct weston_matrix *inverse,
 		     const struct weston_matrix *matrix)
@@ -260,6 +387,14 @@ weston_matrix_invert(struct weston_matrix *inverse,
 	double LU[16];		/* column-major */
 	unsigned perm[4];	/* permutation */
 	unsigned c;
+	int r;
+
+	if (!(matrix->type & (WESTON_MATRIX_TRANSFORM_ROTATE |
+			      WESTON_MATRIX_TRANSFORM_OTHER))) {
+		r = matrix_invert_scale_translate(inverse, matrix);
+		if (r <= 0)
+			return r;
+	}
 
 	if (matrix_invert(LU, perm, matrix) < 0)
 		return -1;
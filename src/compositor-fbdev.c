@@ -52,6 +52,7 @@ struct fbdev_compositor {
 	struct udev *udev;
 	struct udev_input input;
 	int use_pixman;
+	int use_shadow;
 	struct wl_listener session_listener;
 };
 
@@ -93,6 +94,7 @@ struct fbdev_parameters {
 	int tty;
 	char *device;
 	int use_gl;
+	int no_shadow;
 };
 
 struct gl_renderer_interface *gl_renderer;
@@ -130,6 +132,14 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 	pixman_box32_t *rects;
 	int nrects, i, src_x, src_y, x1, y1, x2, y2, width, height;
 
+	/* Without a transform the renderer writes to the frame buffer
+	 * itself. */
+	if (!output->shadow_surface) {
+		pixman_renderer_output_set_buffer(base, output->hw_surface);
+		ec->renderer->repaint_output(base, damage);
+		goto out;
+	}
+
 	/* Repaint the damaged region onto the back buffer. */
 	pixman_renderer_output_set_buffer(base, output->shadow_surface);
 	ec->renderer->repaint_output(base, damage);
@@ -181,6 +191,7 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 			y2 - y1 /* height */);
 	}
 
+out:
 	/* Update the damage region. */
 	pixman_region32_subtract(&ec->primary_plane.damage,
 	                         &ec->primary_plane.damage, damage);
@@ -442,13 +453,18 @@ static int
 fbdev_frame_buffer_map(struct fbdev_output *output, int fd)
 {
 	int retval = -1;
+	int prot = PROT_WRITE;
 
 	weston_log("Mapping fbdev frame buffer.\n");
 
 	/* Map the frame buffer. Write-only mode, since we don't want to read
-	 * anything back (because it's slow). */
+	 * anything back (because it's slow), unless we composite straight
+	 * into it and have to blend against its contents. */
+	if (!output->compositor->use_shadow)
+		prot |= PROT_READ;
+
 	output->fb = mmap(NULL, output->fb_info.buffer_length,
-	                  PROT_WRITE, MAP_SHARED, fd, 0);
+	                  prot, MAP_SHARED, fd, 0);
 	if (output->fb == MAP_FAILED) {
 		weston_log("Failed to mmap frame buffer: %s\n",
 		           strerror(errno));
@@ -506,6 +522,7 @@ fbdev_output_create(struct fbdev_compositor *compositor,
 	int shadow_width, shadow_height;
 	int width, height;
 	unsigned int bytes_per_pixel;
+	uint32_t flags = 0;
 	struct wl_event_loop *loop;
 
 	weston_log("Creating fbdev output.\n");
@@ -607,23 +624,29 @@ fbdev_output_create(struct fbdev_compositor *compositor,
 
 	bytes_per_pixel = output->fb_info.bits_per_pixel / 8;
 
-	output->shadow_buf = malloc(width * height * bytes_per_pixel);
-	output->shadow_surface =
-		pixman_image_create_bits(output->fb_info.pixel_format,
-		                         shadow_width, shadow_height,
-		                         output->shadow_buf,
-		                         shadow_width * bytes_per_pixel);
-	if (output->shadow_buf == NULL || output->shadow_surface == NULL) {
-		weston_log("Failed to create surface for frame buffer.\n");
-		goto out_hw_surface;
-	}
+	/* The shadow surface is only needed to rotate the frame buffer;
+	 * a normal output is rendered into the frame buffer directly. */
+	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		output->shadow_buf = malloc(width * height * bytes_per_pixel);
+		output->shadow_surface =
+			pixman_image_create_bits(output->fb_info.pixel_format,
+			                         shadow_width, shadow_height,
+			                         output->shadow_buf,
+			                         shadow_width * bytes_per_pixel);
+		if (output->shadow_buf == NULL ||
+		    output->shadow_surface == NULL) {
+			weston_log("Failed to create surface for frame buffer.\n");
+			goto out_hw_surface;
+		}
 
-	/* No need in transform for normal output */
-	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL)
 		pixman_image_set_transform(output->shadow_surface, &transform);
+	} else if (!compositor->use_shadow) {
+		flags |= PIXMAN_RENDERER_OUTPUT_DIRECT;
+	}
 
 	if (compositor->use_pixman) {
-		if (pixman_renderer_output_create(&output->base) < 0)
+		if (pixman_renderer_output_create_with_flags(&output->base,
+							     flags) < 0)
 			goto out_shadow_surface;
 	} else {
 		setenv("HYBRIS_EGLPLATFORM", "wayland", 1);
@@ -649,7 +672,8 @@ fbdev_output_create(struct fbdev_compositor *compositor,
 	return 0;
 
 out_shadow_surface:
-	pixman_image_unref(output->shadow_surface);
+	if (output->shadow_surface)
+		pixman_image_unref(output->shadow_surface);
 	output->shadow_surface = NULL;
 out_hw_surface:
 	free(output->shadow_buf);
@@ -782,6 +806,9 @@ fbdev_output_disable(struct weston_output *base)
 
 	if ( ! compositor->use_pixman) return;
 
+	/* The renderer may be drawing straight into the frame buffer. */
+	pixman_renderer_output_set_buffer(base, NULL);
+
 	if (output->hw_surface != NULL) {
 		pixman_image_unref(output->hw_surface);
 		output->hw_surface = NULL;
@@ -906,6 +933,7 @@ fbdev_compositor_create(struct wl_display *display, int *argc, char *argv[],
 
 	compositor->prev_state = WESTON_COMPOSITOR_ACTIVE;
 	compositor->use_pixman = !param->use_gl;
+	compositor->use_shadow = !param->no_shadow;
 
 	for (key = KEY_F1; key < KEY_F9; key++)
 		weston_compositor_add_key_binding(&compositor->base, key,
@@ -972,6 +1000,7 @@ backend_init(struct wl_display *display, int *argc, char *argv[],
 		{ WESTON_OPTION_INTEGER, "tty", 0, &param.tty },
 		{ WESTON_OPTION_STRING, "device", 0, &param.device },
 		{ WESTON_OPTION_BOOLEAN, "use-gl", 0, &param.use_gl },
+		{ WESTON_OPTION_BOOLEAN, "no-shadow", 0, &param.no_shadow },
 	};
 
 	parse_options(fbdev_options, ARRAY_LENGTH(fbdev_options), argc, argv);
@@ -26,23 +26,52 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "compositor.h"
+#include "pixman-renderer.h"
 
 struct headless_compositor {
 	struct weston_compositor base;
 	struct weston_seat fake_seat;
+	int use_pixman;
+	int benchmark_frames;
 };
 
 struct headless_output {
 	struct weston_output base;
 	struct weston_mode mode;
 	struct wl_event_source *finish_frame_timer;
+	uint64_t vblank_usec;
+	uint32_t *image_buf;
+	pixman_image_t *image;
+
+	int benchmark_count;
+	uint64_t benchmark_total[WESTON_REPAINT_STAGE_COUNT];
+	uint32_t benchmark_max[WESTON_REPAINT_STAGE_COUNT];
+};
+
+static const char *const repaint_stage_names[WESTON_REPAINT_STAGE_COUNT] = {
+	[WESTON_REPAINT_STAGE_BUILD_VIEW_LIST] = "build_view_list",
+	[WESTON_REPAINT_STAGE_ASSIGN_PLANES] = "assign_planes",
+	[WESTON_REPAINT_STAGE_ACCUMULATE_DAMAGE] = "accumulate_damage",
+	[WESTON_REPAINT_STAGE_REPAINT] = "repaint",
+	[WESTON_REPAINT_STAGE_FRAME_CALLBACKS] = "frame_callbacks",
 };
 
 
+static uint64_t
+headless_get_time_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static void
-headless_output_start_repaint_loop(struct weston_output *output)
+headless_output_finish_frame(struct weston_output *output)
 {
 	uint32_t msec;
 	struct timeval tv;
@@ -52,27 +81,123 @@ headless_output_start_repaint_loop(struct weston_output *output)
 	weston_output_finish_frame(output, msec);
 }
 
+static void
+headless_output_start_repaint_loop(struct weston_output *output_base)
+{
+	struct headless_output *output = (struct headless_output *) output_base;
+
+	output->vblank_usec = headless_get_time_usec();
+	headless_output_finish_frame(output_base);
+}
+
 static int
 finish_frame_handler(void *data)
 {
-	headless_output_start_repaint_loop(data);
+	headless_output_finish_frame(data);
 
 	return 1;
 }
 
+/* Fake vblanks tick at the mode refresh rate counting from the first
+ * one of a repaint loop, like a real display, instead of a fixed time
+ * after each repaint, so that repaint scheduling behaves here as it
+ * does on hardware. */
+static void
+headless_output_queue_vblank(struct headless_output *output)
+{
+	uint64_t now, next, period;
+
+	now = headless_get_time_usec();
+	period = 1000000000ULL / output->mode.refresh;
+	next = output->vblank_usec + period;
+	if (next <= now)
+		next += ((now - next) / period + 1) * period;
+	output->vblank_usec = next;
+
+	wl_event_source_timer_update(output->finish_frame_timer,
+				     (next - now + 999) / 1000);
+}
+
+static void
+headless_output_benchmark_report(struct headless_output *output)
+{
+	int i;
+
+	weston_log("headless benchmark: %d frames at %dx%d\n",
+		   output->benchmark_count,
+		   output->base.width, output->base.height);
+
+	for (i = 0; i < WESTON_REPAINT_STAGE_COUNT; i++)
+		weston_log_continue(STAMP_SPACE "%-18s avg %6llu us, "
+				    "max %6u us\n",
+				    repaint_stage_names[i],
+				    (unsigned long long)
+				    (output->benchmark_total[i] /
+				     output->benchmark_count),
+				    output->benchmark_max[i]);
+}
+
+/* In benchmark mode every frame is a full-output repaint, started as
+ * soon as the previous one is done instead of waiting for the fake
+ * 16ms vblank. */
+static void
+headless_output_benchmark_frame(void *data)
+{
+	struct headless_output *output = data;
+	struct headless_compositor *c =
+		(struct headless_compositor *) output->base.compositor;
+	uint32_t *usec = output->base.repaint_stage_usec;
+	uint32_t repaint_count = c->base.repaint_count;
+	int i;
+
+	weston_output_damage(&output->base);
+	headless_output_start_repaint_loop(&output->base);
+
+	/* Nothing to record if the compositor is asleep; the benchmark
+	 * resumes with the next scheduled repaint. */
+	if (c->base.repaint_count == repaint_count)
+		return;
+
+	output->benchmark_count++;
+	weston_log("frame %d:", output->benchmark_count);
+	for (i = 0; i < WESTON_REPAINT_STAGE_COUNT; i++) {
+		weston_log_continue(" %s %u us", repaint_stage_names[i],
+				    usec[i]);
+		output->benchmark_total[i] += usec[i];
+		if (usec[i] > output->benchmark_max[i])
+			output->benchmark_max[i] = usec[i];
+	}
+	weston_log_continue("\n");
+
+	if (output->benchmark_count == c->benchmark_frames) {
+		headless_output_benchmark_report(output);
+		wl_display_terminate(c->base.wl_display);
+	}
+}
+
 static int
 headless_output_repaint(struct weston_output *output_base,
 		       pixman_region32_t *damage)
 {
 	struct headless_output *output = (struct headless_output *) output_base;
+	struct headless_compositor *c =
+		(struct headless_compositor *) output->base.compositor;
 	struct weston_compositor *ec = output->base.compositor;
+	struct wl_event_loop *loop;
 
 	ec->renderer->repaint_output(&output->base, damage);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 16);
+	if (c->benchmark_frames > 0 &&
+	    output->benchmark_count < c->benchmark_frames) {
+		loop = wl_display_get_event_loop(ec->wl_display);
+		wl_event_loop_add_idle(loop, headless_output_benchmark_frame,
+				       output);
+	} else {
+		headless_output_queue_vblank(output);
+	}
 
 	return 0;
 }
@@ -81,8 +206,17 @@ static void
 headless_output_destroy(struct weston_output *output_base)
 {
 	struct headless_output *output = (struct headless_output *) output_base;
+	struct headless_compositor *c =
+		(struct headless_compositor *) output->base.compositor;
 
 	wl_event_source_remove(output->finish_frame_timer);
+
+	if (c->use_pixman) {
+		pixman_renderer_output_destroy(&output->base);
+		pixman_image_unref(output->image);
+		free(output->image_buf);
+	}
+
 	free(output);
 
 	return;
@@ -103,20 +237,48 @@ headless_compositor_create_output(struct headless_compositor *c,
 		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
 	output->mode.width = width;
 	output->mode.height = height;
-	output->mode.refresh = 60;
+	output->mode.refresh = 60000;
 	wl_list_init(&output->base.mode_list);
 	wl_list_insert(&output->base.mode_list, &output->mode.link);
 
 	output->base.current_mode = &output->mode;
+
+	loop = wl_display_get_event_loop(c->base.wl_display);
+	output->finish_frame_timer =
+		wl_event_loop_add_timer(loop, finish_frame_handler, output);
+	if (!output->finish_frame_timer)
+		goto err_free;
+
+	if (c->use_pixman) {
+		output->image_buf = malloc(width * height * 4);
+		if (!output->image_buf)
+			goto err_timer;
+
+		output->image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+							 width, height,
+							 output->image_buf,
+							 width * 4);
+		if (!output->image)
+			goto err_buf;
+
+		/* The image is plain memory, so there is no point in a
+		 * shadow copy of it. */
+		if (pixman_renderer_output_create_with_flags(&output->base,
+				PIXMAN_RENDERER_OUTPUT_DIRECT) < 0)
+			goto err_image;
+	}
+
+	/* Nothing can fail from here on, so the error paths never have
+	 * to undo weston_output_init(). */
 	weston_output_init(&output->base, &c->base, 0, 0, width, height,
 			   WL_OUTPUT_TRANSFORM_NORMAL, 1);
 
 	output->base.make = "weston";
 	output->base.model = "headless";
 
-	loop = wl_display_get_event_loop(c->base.wl_display);
-	output->finish_frame_timer =
-		wl_event_loop_add_timer(loop, finish_frame_handler, output);
+	if (c->use_pixman)
+		pixman_renderer_output_set_buffer(&output->base,
+						  output->image);
 
 	output->base.start_repaint_loop = headless_output_start_repaint_loop;
 	output->base.repaint = headless_output_repaint;
@@ -129,6 +291,16 @@ headless_compositor_create_output(struct headless_compositor *c,
 	wl_list_insert(c->base.output_list.prev, &output->base.link);
 
 	return 0;
+
+err_image:
+	pixman_image_unref(output->image);
+err_buf:
+	free(output->image_buf);
+err_timer:
+	wl_event_source_remove(output->finish_frame_timer);
+err_free:
+	free(output);
+	return -1;
 }
 
 static void
@@ -152,6 +324,7 @@ headless_destroy(struct weston_compositor *ec)
 static struct weston_compositor *
 headless_compositor_create(struct wl_display *display,
 			   int width, int height, const char *display_name,
+			   int use_pixman, int benchmark_frames,
 			   int *argc, char *argv[],
 			   struct weston_config *config)
 {
@@ -169,14 +342,30 @@ headless_compositor_create(struct wl_display *display,
 	c->base.destroy = headless_destroy;
 	c->base.restore = headless_restore;
 
-	if (headless_compositor_create_output(c, width, height) < 0)
-		goto err_compositor;
+	c->use_pixman = use_pixman;
+	c->benchmark_frames = benchmark_frames;
+
+	/* The benchmark repaints back to back and expects each repaint to
+	 * happen as soon as it starts the repaint loop. */
+	if (benchmark_frames > 0)
+		c->base.repaint_window = 0;
 
-	if (noop_renderer_init(&c->base) < 0)
-		goto err_compositor;
+	if (c->use_pixman) {
+		if (pixman_renderer_init(&c->base) < 0)
+			goto err_compositor;
+	} else {
+		if (noop_renderer_init(&c->base) < 0)
+			goto err_compositor;
+	}
+
+	if (headless_compositor_create_output(c, width, height) < 0)
+		goto err_renderer;
 
 	return &c->base;
 
+err_renderer:
+	c->base.renderer->destroy(&c->base);
+
 err_compositor:
 	weston_compositor_shutdown(&c->base);
 err_free:
@@ -190,15 +379,20 @@ backend_init(struct wl_display *display, int *argc, char *argv[],
 {
 	int width = 1024, height = 640;
 	char *display_name = NULL;
+	int use_pixman = 0;
+	int benchmark_frames = 0;
 
 	const struct weston_option headless_options[] = {
 		{ WESTON_OPTION_INTEGER, "width", 0, &width },
 		{ WESTON_OPTION_INTEGER, "height", 0, &height },
+		{ WESTON_OPTION_BOOLEAN, "use-pixman", 0, &use_pixman },
+		{ WESTON_OPTION_INTEGER, "benchmark", 0, &benchmark_frames },
 	};
 
 	parse_options(headless_options,
 		      ARRAY_LENGTH(headless_options), argc, argv);
 
 	return headless_compositor_create(display, width, height, display_name,
+					  use_pixman, benchmark_frames,
 					  argc, argv, config);
 }
@@ -25,6 +25,7 @@
 #include "config.h"
 
 #include <fcntl.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -175,6 +176,7 @@ weston_output_switch_mode(struct weston_output *output, struct weston_mode *mode
 	pixman_region32_init(&output->previous_damage);
 	pixman_region32_init_rect(&output->region, output->x, output->y,
 				  output->width, output->height);
+	output->compositor->pick_grid_dirty = 1;
 
 	weston_output_update_matrix(output);
 
@@ -512,32 +514,126 @@ weston_surface_set_color(struct weston_surface *surface,
 	surface->compositor->renderer->surface_set_color(surface, red, green, blue, alpha);
 }
 
-WL_EXPORT void
-weston_view_to_global_float(struct weston_view *view,
-			    float sx, float sy, float *x, float *y)
+static void
+view_map_translate(struct weston_matrix *matrix,
+		   const float *x, const float *y,
+		   float *out_x, float *out_y, int n)
 {
-	if (view->transform.enabled) {
-		struct weston_vector v = { { sx, sy, 0.0f, 1.0f } };
+	float tx = matrix->d[12], ty = matrix->d[13];
+	int i;
 
-		weston_matrix_transform(&view->transform.matrix, &v);
+	for (i = 0; i < n; i++) {
+		out_x[i] = x[i] + tx;
+		out_y[i] = y[i] + ty;
+	}
+}
+
+static void
+view_map_scale_translate(struct weston_matrix *matrix,
+			 const float *x, const float *y,
+			 float *out_x, float *out_y, int n)
+{
+	float sx = matrix->d[0], sy = matrix->d[5];
+	float tx = matrix->d[12], ty = matrix->d[13];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		out_x[i] = sx * x[i] + tx;
+		out_y[i] = sy * y[i] + ty;
+	}
+}
+
+static void
+view_map_affine(struct weston_matrix *matrix,
+		const float *x, const float *y,
+		float *out_x, float *out_y, int n)
+{
+	const float *d = matrix->d;
+	float px, py;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		px = x[i];
+		py = y[i];
+		out_x[i] = d[0] * px + d[4] * py + d[12];
+		out_y[i] = d[1] * px + d[5] * py + d[13];
+	}
+}
+
+static void
+view_map_projective(struct weston_matrix *matrix,
+		    const float *x, const float *y,
+		    float *out_x, float *out_y, int n)
+{
+	struct weston_vector v;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		v.f[0] = x[i];
+		v.f[1] = y[i];
+		v.f[2] = 0.0f;
+		v.f[3] = 1.0f;
+
+		weston_matrix_transform(matrix, &v);
 
 		if (fabsf(v.f[3]) < 1e-6) {
 			weston_log("warning: numerical instability in "
-				"%s(), divisor = %g\n", __func__,
+				"view point mapping, divisor = %g\n",
 				v.f[3]);
-			*x = 0;
-			*y = 0;
-			return;
+			out_x[i] = 0;
+			out_y[i] = 0;
+			continue;
 		}
 
-		*x = v.f[0] / v.f[3];
-		*y = v.f[1] / v.f[3];
+		out_x[i] = v.f[0] / v.f[3];
+		out_y[i] = v.f[1] / v.f[3];
+	}
+}
+
+/* Look at the entries rather than matrix->type: a rotation by a multiple
+ * of 90 degrees composed with its inverse is still flagged as rotating. */
+static weston_view_map_func_t
+view_map_func(const struct weston_matrix *matrix)
+{
+	const float *d = matrix->d;
+
+	if (d[3] != 0.0f || d[7] != 0.0f || d[15] != 1.0f)
+		return view_map_projective;
+	if (d[1] != 0.0f || d[4] != 0.0f)
+		return view_map_affine;
+	if (d[0] != 1.0f || d[5] != 1.0f)
+		return view_map_scale_translate;
+
+	return view_map_translate;
+}
+
+WL_EXPORT void
+weston_view_to_global_points(struct weston_view *view,
+			     const float *sx, const float *sy,
+			     float *x, float *y, int n)
+{
+	int i;
+
+	if (view->transform.to_global) {
+		view->transform.to_global(&view->transform.matrix,
+					  sx, sy, x, y, n);
+	} else if (view->transform.enabled) {
+		view_map_projective(&view->transform.matrix, sx, sy, x, y, n);
 	} else {
-		*x = sx + view->geometry.x;
-		*y = sy + view->geometry.y;
+		for (i = 0; i < n; i++) {
+			x[i] = sx[i] + view->geometry.x;
+			y[i] = sy[i] + view->geometry.y;
+		}
 	}
 }
 
+WL_EXPORT void
+weston_view_to_global_float(struct weston_view *view,
+			    float sx, float sy, float *x, float *y)
+{
+	weston_view_to_global_points(view, &sx, &sy, x, y, 1);
+}
+
 WL_EXPORT void
 weston_transformed_coord(int width, int height,
 			 enum wl_output_transform transform,
@@ -930,12 +1026,8 @@ view_compute_bbox(struct weston_view *view, int32_t sx, int32_t sy,
 {
 	float min_x = HUGE_VALF,  min_y = HUGE_VALF;
 	float max_x = -HUGE_VALF, max_y = -HUGE_VALF;
-	int32_t s[4][2] = {
-		{ sx,         sy },
-		{ sx,         sy + height },
-		{ sx + width, sy },
-		{ sx + width, sy + height }
-	};
+	float x[4] = { sx, sx, sx + width, sx + width };
+	float y[4] = { sy, sy + height, sy, sy + height };
 	float int_x, int_y;
 	int i;
 
@@ -945,17 +1037,17 @@ view_compute_bbox(struct weston_view *view, int32_t sx, int32_t sy,
 		return;
 	}
 
+	weston_view_to_global_points(view, x, y, x, y, 4);
+
 	for (i = 0; i < 4; ++i) {
-		float x, y;
-		weston_view_to_global_float(view, s[i][0], s[i][1], &x, &y);
-		if (x < min_x)
-			min_x = x;
-		if (x > max_x)
-			max_x = x;
-		if (y < min_y)
-			min_y = y;
-		if (y > max_y)
-			max_y = y;
+		if (x[i] < min_x)
+			min_x = x[i];
+		if (x[i] > max_x)
+			max_x = x[i];
+		if (y[i] < min_y)
+			min_y = y[i];
+		if (y[i] > max_y)
+			max_y = y[i];
 	}
 
 	int_x = floorf(min_x);
@@ -984,6 +1076,9 @@ weston_view_update_transform_disable(struct weston_view *view)
 	view->transform.inverse.d[12] = -view->geometry.x;
 	view->transform.inverse.d[13] = -view->geometry.y;
 
+	view->transform.to_global = view_map_translate;
+	view->transform.from_global = view_map_translate;
+
 	pixman_region32_init_rect(&view->transform.boundingbox,
 				  view->geometry.x,
 				  view->geometry.y,
@@ -1028,6 +1123,9 @@ weston_view_update_transform_enable(struct weston_view *view)
 		return -1;
 	}
 
+	view->transform.to_global = view_map_func(matrix);
+	view->transform.from_global = view_map_func(inverse);
+
 	view_compute_bbox(view, 0, 0,
 			  view->surface->width, view->surface->height,
 			  &view->transform.boundingbox);
@@ -1039,6 +1137,7 @@ WL_EXPORT void
 weston_view_update_transform(struct weston_view *view)
 {
 	struct weston_view *parent = view->geometry.parent;
+	pixman_box32_t old_bbox, *bbox;
 
 	if (!view->transform.dirty)
 		return;
@@ -1050,6 +1149,7 @@ weston_view_update_transform(struct weston_view *view)
 
 	weston_view_damage_below(view);
 
+	old_bbox = *pixman_region32_extents(&view->transform.boundingbox);
 	pixman_region32_fini(&view->transform.boundingbox);
 	pixman_region32_fini(&view->transform.opaque);
 	pixman_region32_init(&view->transform.opaque);
@@ -1070,6 +1170,12 @@ weston_view_update_transform(struct weston_view *view)
 
 	weston_view_assign_output(view);
 
+	/* The pick grids only look at the bounding box. */
+	bbox = pixman_region32_extents(&view->transform.boundingbox);
+	if (bbox->x1 != old_bbox.x1 || bbox->y1 != old_bbox.y1 ||
+	    bbox->x2 != old_bbox.x2 || bbox->y2 != old_bbox.y2)
+		view->surface->compositor->pick_grid_dirty = 1;
+
 	wl_signal_emit(&view->surface->compositor->transform_signal,
 		       view->surface);
 }
@@ -1090,6 +1196,8 @@ weston_view_geometry_dirty(struct weston_view *view)
 		return;
 
 	view->transform.dirty = 1;
+	view->transform.to_global = NULL;
+	view->transform.from_global = NULL;
 
 	wl_list_for_each(child, &view->geometry.child_list,
 			 geometry.parent_link)
@@ -1112,31 +1220,33 @@ weston_view_to_global_fixed(struct weston_view *view,
 }
 
 WL_EXPORT void
-weston_view_from_global_float(struct weston_view *view,
-			      float x, float y, float *vx, float *vy)
+weston_view_from_global_points(struct weston_view *view,
+			       const float *x, const float *y,
+			       float *vx, float *vy, int n)
 {
-	if (view->transform.enabled) {
-		struct weston_vector v = { { x, y, 0.0f, 1.0f } };
-
-		weston_matrix_transform(&view->transform.inverse, &v);
-
-		if (fabsf(v.f[3]) < 1e-6) {
-			weston_log("warning: numerical instability in "
-				"weston_view_from_global(), divisor = %g\n",
-				v.f[3]);
-			*vx = 0;
-			*vy = 0;
-			return;
-		}
+	int i;
 
-		*vx = v.f[0] / v.f[3];
-		*vy = v.f[1] / v.f[3];
+	if (view->transform.from_global) {
+		view->transform.from_global(&view->transform.inverse,
+					    x, y, vx, vy, n);
+	} else if (view->transform.enabled) {
+		view_map_projective(&view->transform.inverse,
+				    x, y, vx, vy, n);
 	} else {
-		*vx = x - view->geometry.x;
-		*vy = y - view->geometry.y;
+		for (i = 0; i < n; i++) {
+			vx[i] = x[i] - view->geometry.x;
+			vy[i] = y[i] - view->geometry.y;
+		}
 	}
 }
 
+WL_EXPORT void
+weston_view_from_global_float(struct weston_view *view,
+			      float x, float y, float *vx, float *vy)
+{
+	weston_view_from_global_points(view, &x, &y, vx, vy, 1);
+}
+
 WL_EXPORT void
 weston_view_from_global_fixed(struct weston_view *view,
 			      wl_fixed_t x, wl_fixed_t y,
@@ -1324,22 +1434,134 @@ weston_compositor_get_time(void)
        return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
+static int
+pick_grid_cell(int32_t offset, int32_t length)
+{
+	return (int64_t) offset * WESTON_PICK_GRID_SIZE / length;
+}
+
+static int
+weston_output_build_pick_grid(struct weston_output *output)
+{
+	struct weston_view *view, **p;
+	pixman_box32_t *bbox;
+	int32_t x1, y1, x2, y2;
+	int cx1, cy1, cx2, cy2, cx, cy;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(output->pick_grid); i++)
+		output->pick_grid[i].size = 0;
+
+	if (output->width <= 0 || output->height <= 0)
+		return 0;
+
+	wl_list_for_each(view, &output->compositor->view_list, link) {
+		bbox = pixman_region32_extents(&view->transform.boundingbox);
+		x1 = bbox->x1 > output->x ? bbox->x1 : output->x;
+		y1 = bbox->y1 > output->y ? bbox->y1 : output->y;
+		x2 = MIN(bbox->x2, output->x + output->width);
+		y2 = MIN(bbox->y2, output->y + output->height);
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+
+		cx1 = pick_grid_cell(x1 - output->x, output->width);
+		cy1 = pick_grid_cell(y1 - output->y, output->height);
+		cx2 = pick_grid_cell(x2 - 1 - output->x, output->width);
+		cy2 = pick_grid_cell(y2 - 1 - output->y, output->height);
+
+		for (cy = cy1; cy <= cy2; cy++) {
+			for (cx = cx1; cx <= cx2; cx++) {
+				i = cy * WESTON_PICK_GRID_SIZE + cx;
+				p = wl_array_add(&output->pick_grid[i],
+						 sizeof *p);
+				if (p == NULL)
+					return -1;
+				*p = view;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void
+weston_compositor_build_pick_grids(struct weston_compositor *compositor)
+{
+	struct weston_output *output;
+
+	wl_list_for_each(output, &compositor->output_list, link)
+		if (weston_output_build_pick_grid(output) < 0)
+			return;
+
+	compositor->pick_grid_dirty = 0;
+}
+
+static int
+view_accepts_input_at(struct weston_view *view, wl_fixed_t x, wl_fixed_t y,
+		      int32_t ix, int32_t iy, wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	if (!pixman_region32_contains_point(&view->transform.boundingbox,
+					    ix, iy, NULL))
+		return 0;
+
+	weston_view_from_global_fixed(view, x, y, vx, vy);
+
+	return pixman_region32_contains_point(&view->surface->input,
+					      wl_fixed_to_int(*vx),
+					      wl_fixed_to_int(*vy),
+					      NULL);
+}
+
 WL_EXPORT struct weston_view *
 weston_compositor_pick_view(struct weston_compositor *compositor,
 			    wl_fixed_t x, wl_fixed_t y,
 			    wl_fixed_t *vx, wl_fixed_t *vy)
 {
-	struct weston_view *view;
+	struct weston_view *view, **v;
+	struct weston_output *output;
+	struct wl_array *cell;
+	int32_t ix, iy;
 
-	wl_list_for_each(view, &compositor->view_list, link) {
-		weston_view_from_global_fixed(view, x, y, vx, vy);
-		if (pixman_region32_contains_point(&view->surface->input,
-						   wl_fixed_to_int(*vx),
-						   wl_fixed_to_int(*vy),
-						   NULL))
-			return view;
+	ix = floor(wl_fixed_to_double(x));
+	iy = floor(wl_fixed_to_double(y));
+
+	if (compositor->pick_grid_dirty)
+		weston_compositor_build_pick_grids(compositor);
+
+	/* Any view under a point on an output overlaps the grid cell of
+	 * that point, so only that cell's views need to be tested. Fall
+	 * back to walking the whole view list for points outside all
+	 * outputs, or when the grids could not be built. */
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (compositor->pick_grid_dirty)
+			break;
+
+		if (!pixman_region32_contains_point(&output->region,
+						    ix, iy, NULL))
+			continue;
+
+		cell = &output->pick_grid[
+			pick_grid_cell(iy - output->y, output->height) *
+			WESTON_PICK_GRID_SIZE +
+			pick_grid_cell(ix - output->x, output->width)];
+
+		wl_array_for_each(v, cell)
+			if (view_accepts_input_at(*v, x, y, ix, iy, vx, vy))
+				return *v;
+
+		*vx = 0;
+		*vy = 0;
+
+		return NULL;
 	}
 
+	wl_list_for_each(view, &compositor->view_list, link)
+		if (view_accepts_input_at(view, x, y, ix, iy, vx, vy))
+			return view;
+
+	*vx = 0;
+	*vy = 0;
+
 	return NULL;
 }
 
@@ -1366,9 +1588,9 @@ weston_view_unmap(struct weston_view *view)
 	weston_view_damage_below(view);
 	view->output = NULL;
 	view->plane = NULL;
-	wl_list_remove(&view->layer_link);
-	wl_list_init(&view->layer_link);
+	weston_view_layer_remove(view);
 	wl_list_remove(&view->link);
+	view->surface->compositor->pick_grid_dirty = 1;
 	wl_list_init(&view->link);
 	wl_list_remove(&view->output_move_listener.link);
 	wl_list_init(&view->output_move_listener.link);
@@ -1421,7 +1643,9 @@ weston_view_destroy(struct weston_view *view)
 	}
 
 	wl_list_remove(&view->link);
-	wl_list_remove(&view->layer_link);
+	if (!wl_list_empty(&view->layer_link))
+		weston_view_layer_remove(view);
+	view->surface->compositor->pick_grid_dirty = 1;
 
 	pixman_region32_fini(&view->clip);
 	pixman_region32_fini(&view->transform.boundingbox);
@@ -1485,6 +1709,16 @@ destroy_surface(struct wl_resource *resource)
 	weston_surface_destroy(surface);
 }
 
+static uint64_t
+weston_compositor_get_time_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static void
 weston_buffer_destroy_handler(struct wl_listener *listener, void *data)
 {
@@ -1492,6 +1726,8 @@ weston_buffer_destroy_handler(struct wl_listener *listener, void *data)
 		container_of(listener, struct weston_buffer, destroy_listener);
 
 	wl_signal_emit(&buffer->destroy_signal, buffer);
+	if (buffer->surface)
+		wl_list_remove(&buffer->surface_destroy_listener.link);
 	free(buffer);
 }
 
@@ -1521,6 +1757,9 @@ weston_buffer_from_resource(struct wl_resource *resource)
 	return buffer;
 }
 
+static void
+weston_buffer_idle(struct weston_buffer *buffer);
+
 static void
 weston_buffer_reference_handle_destroy(struct wl_listener *listener,
 				       void *data)
@@ -1530,9 +1769,88 @@ weston_buffer_reference_handle_destroy(struct wl_listener *listener,
 			     destroy_listener);
 
 	assert((struct weston_buffer *)data == ref->buffer);
+
+	/* A buffer destroyed while busy is never released; stop charging
+	 * its surface once the last reference lets go of it. */
+	if (--ref->buffer->busy_count == 0)
+		weston_buffer_idle(ref->buffer);
 	ref->buffer = NULL;
 }
 
+static void
+weston_buffer_handle_surface_destroy(struct wl_listener *listener,
+				     void *data)
+{
+	struct weston_buffer *buffer =
+		container_of(listener, struct weston_buffer,
+			     surface_destroy_listener);
+
+	wl_list_remove(&buffer->surface_destroy_listener.link);
+	buffer->surface = NULL;
+}
+
+/* Charge the hold time of 'buffer' to 'surface' from now on.  A buffer
+ * that is still busy stays with the surface that took it. */
+static void
+weston_buffer_set_surface(struct weston_buffer *buffer,
+			  struct weston_surface *surface)
+{
+	if (buffer == NULL || buffer->surface == surface ||
+	    buffer->busy_count > 0)
+		return;
+
+	if (buffer->surface)
+		wl_list_remove(&buffer->surface_destroy_listener.link);
+
+	buffer->surface = surface;
+	buffer->surface_destroy_listener.notify =
+		weston_buffer_handle_surface_destroy;
+	wl_signal_add(&surface->destroy_signal,
+		      &buffer->surface_destroy_listener);
+}
+
+static void
+weston_buffer_busy(struct weston_buffer *buffer)
+{
+	struct weston_surface *surface = buffer->surface;
+	struct weston_buffer_stats *stats;
+
+	buffer->busy_since = weston_compositor_get_time_usec();
+	if (surface == NULL)
+		return;
+
+	stats = &surface->buffer_stats;
+	buffer->busy_repaint = surface->compositor->repaint_count;
+	stats->acquired++;
+	stats->busy++;
+	if (stats->busy > stats->max_busy)
+		stats->max_busy = stats->busy;
+}
+
+static void
+weston_buffer_idle(struct weston_buffer *buffer)
+{
+	struct weston_surface *surface = buffer->surface;
+	struct weston_buffer_stats *stats;
+	uint64_t hold;
+
+	hold = weston_compositor_get_time_usec() - buffer->busy_since;
+	buffer->last_hold_usec = hold > UINT32_MAX ? UINT32_MAX : hold;
+	buffer->release_count++;
+	if (surface == NULL)
+		return;
+
+	stats = &surface->buffer_stats;
+	stats->released++;
+	stats->busy--;
+	if (surface->compositor->repaint_count - buffer->busy_repaint > 1)
+		stats->held_across_frames++;
+	weston_timing_histogram_add(&stats->hold, hold);
+}
+
+/* Every reference the core, the renderers and the backends take on a
+ * client buffer goes through here, so this is also where the time the
+ * client has to wait for wl_buffer.release is measured. */
 WL_EXPORT void
 weston_buffer_reference(struct weston_buffer_reference *ref,
 			struct weston_buffer *buffer)
@@ -1540,6 +1858,7 @@ weston_buffer_reference(struct weston_buffer_reference *ref,
 	if (ref->buffer && buffer != ref->buffer) {
 		ref->buffer->busy_count--;
 		if (ref->buffer->busy_count == 0) {
+			weston_buffer_idle(ref->buffer);
 			assert(wl_resource_get_client(ref->buffer->resource));
 			wl_resource_queue_event(ref->buffer->resource,
 						WL_BUFFER_RELEASE);
@@ -1548,7 +1867,8 @@ weston_buffer_reference(struct weston_buffer_reference *ref,
 	}
 
 	if (buffer && buffer != ref->buffer) {
-		buffer->busy_count++;
+		if (buffer->busy_count++ == 0)
+			weston_buffer_busy(buffer);
 		wl_signal_add(&buffer->destroy_signal,
 			      &ref->destroy_listener);
 	}
@@ -1561,6 +1881,7 @@ static void
 weston_surface_attach(struct weston_surface *surface,
 		      struct weston_buffer *buffer)
 {
+	weston_buffer_set_surface(buffer, surface);
 	weston_buffer_reference(&surface->buffer_ref, buffer);
 
 	if (!buffer) {
@@ -1601,12 +1922,47 @@ surface_flush_damage(struct weston_surface *surface)
 	empty_region(&surface->damage);
 }
 
+static int
+view_is_occluded(struct weston_view *view, pixman_region32_t *opaque)
+{
+	pixman_box32_t *bbox;
+
+	bbox = pixman_region32_extents(&view->transform.boundingbox);
+	if (bbox->x1 >= bbox->x2 || bbox->y1 >= bbox->y2)
+		return 0;
+
+	return pixman_region32_contains_rectangle(opaque, bbox) ==
+		PIXMAN_REGION_IN ||
+		pixman_region32_contains_rectangle(&view->plane->clip, bbox) ==
+		PIXMAN_REGION_IN;
+}
+
+/* A surface whose views are all hidden need not be uploaded. Its
+ * damage is kept until one of its views shows up again. */
+static int
+surface_is_occluded(struct weston_surface *surface)
+{
+	struct weston_view *view;
+
+	wl_list_for_each(view, &surface->views, surface_link)
+		if (!view->occluded)
+			return 0;
+
+	return 1;
+}
+
 static void
 view_accumulate_damage(struct weston_view *view,
 		       pixman_region32_t *opaque)
 {
 	pixman_region32_t damage;
 
+	pixman_region32_copy(&view->clip, opaque);
+
+	view->occluded = view_is_occluded(view, opaque);
+	if (view->occluded)
+		return;
+
 	pixman_region32_init(&damage);
 	if (view->transform.enabled) {
 		pixman_box32_t *extents;
@@ -1630,7 +1986,6 @@ view_accumulate_damage(struct weston_view *view,
 	pixman_region32_union(&view->plane->damage,
 			      &view->plane->damage, &damage);
 	pixman_region32_fini(&damage);
-	pixman_region32_copy(&view->clip, opaque);
 	pixman_region32_union(opaque, opaque, &view->transform.opaque);
 }
 
@@ -1669,7 +2024,8 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 			continue;
 		ev->surface->touched = 1;
 
-		surface_flush_damage(ev->surface);
+		if (!surface_is_occluded(ev->surface))
+			surface_flush_damage(ev->surface);
 
 		/* Both the renderer and the backend have seen the buffer
 		 * by now. If renderer needs the buffer, it has its own
@@ -1677,9 +2033,12 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 		 * around for migrating the surface into a non-primary plane
 		 * later, keep_buffer is true. Otherwise, drop the core
 		 * reference now, and allow early buffer release. This enables
-		 * clients to use single-buffering.
+		 * clients to use single-buffering. A hidden surface still
+		 * has damage to upload from the buffer once it is uncovered,
+		 * so it keeps the buffer until then.
 		 */
-		if (!ev->surface->keep_buffer)
+		if (!ev->surface->keep_buffer &&
+		    !pixman_region32_not_empty(&ev->surface->damage))
 			weston_buffer_reference(&ev->surface->buffer_ref, NULL);
 	}
 }
@@ -1786,6 +2145,10 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 	struct weston_view *view;
 	struct weston_layer *layer;
 
+	compositor->view_list_needs_rebuild = 0;
+	compositor->view_list_rebuild_count++;
+	compositor->pick_grid_dirty = 1;
+
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list, layer_link)
 			surface_stash_subsurface_views(view->surface);
@@ -1802,6 +2165,20 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 			surface_free_unused_subsurface_views(view->surface);
 }
 
+/* Record the time spent in @stage since @start and return the current
+ * time, so that the next stage can start from it. */
+static uint64_t
+repaint_stage_end(struct weston_output *output,
+		  enum weston_repaint_stage stage, uint64_t start)
+{
+	uint64_t now = weston_compositor_get_time_usec();
+
+	output->repaint_stage_usec[stage] = now - start;
+	weston_timing_histogram_add(&output->timing.stat[stage], now - start);
+
+	return now;
+}
+
 static int
 weston_output_repaint(struct weston_output *output, uint32_t msecs)
 {
@@ -1811,13 +2188,29 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
 	pixman_region32_t output_damage;
+	uint64_t start, t;
 	int r;
 
 	if (output->destroying)
 		return 0;
 
-	/* Rebuild the surface list and update surface transforms up front. */
-	weston_compositor_build_view_list(ec);
+	ec->repaint_count++;
+
+	if (output->timing.commit_repainted == 0)
+		output->timing.commit_repainted = output->timing.commit_pending;
+	output->timing.commit_pending = 0;
+
+	start = t = weston_compositor_get_time_usec();
+
+	/* Rebuild the view list if the stacking changed since the last
+	 * repaint, and update view transforms up front. */
+	if (ec->view_list_needs_rebuild)
+		weston_compositor_build_view_list(ec);
+	else
+		wl_list_for_each(ev, &ec->view_list, link)
+			weston_view_update_transform(ev);
+
+	t = repaint_stage_end(output, WESTON_REPAINT_STAGE_BUILD_VIEW_LIST, t);
 
 	if (output->assign_planes && !output->disable_planes)
 		output->assign_planes(output);
@@ -1825,6 +2218,8 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 		wl_list_for_each(ev, &ec->view_list, link)
 			weston_view_move_to_plane(ev, &ec->primary_plane);
 
+	t = repaint_stage_end(output, WESTON_REPAINT_STAGE_ASSIGN_PLANES, t);
+
 	wl_list_init(&frame_callback_list);
 	wl_list_for_each(ev, &ec->view_list, link) {
 		/* Note: This operation is safe to do multiple times on the
@@ -1839,6 +2234,8 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 
 	compositor_accumulate_damage(ec);
 
+	t = repaint_stage_end(output, WESTON_REPAINT_STAGE_ACCUMULATE_DAMAGE, t);
+
 	pixman_region32_init(&output_damage);
 	pixman_region32_intersect(&output_damage,
 				  &ec->primary_plane.damage, &output->region);
@@ -1852,16 +2249,28 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 
 	pixman_region32_fini(&output_damage);
 
+	t = repaint_stage_end(output, WESTON_REPAINT_STAGE_REPAINT, t);
+
 	output->repaint_needed = 0;
 
 	weston_compositor_repick(ec);
 	wl_event_loop_dispatch(ec->input_loop, 0);
 
+	t = weston_compositor_get_time_usec();
+
 	wl_list_for_each_safe(cb, cnext, &frame_callback_list, link) {
 		wl_callback_send_done(cb->resource, msecs);
 		wl_resource_destroy(cb->resource);
 	}
 
+	output->timing.repaint_end =
+		repaint_stage_end(output, WESTON_REPAINT_STAGE_FRAME_CALLBACKS, t);
+
+	output->repaint_history_usec[output->repaint_history_pos] =
+		output->timing.repaint_end - start;
+	output->repaint_history_pos =
+		(output->repaint_history_pos + 1) % WESTON_REPAINT_HISTORY;
+
 	wl_list_for_each_safe(animation, next, &output->animation_list, link) {
 		animation->frame_counter++;
 		animation->frame(animation, output, msecs);
@@ -1870,6 +2279,36 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 	return r;
 }
 
+/* Called as a frame hits the screen.  The frame interval is only
+ * sampled while the output keeps repainting, so idle gaps don't end up
+ * in the histogram. */
+static void
+weston_output_timing_finish_frame(struct weston_output *output)
+{
+	struct weston_output_timing *timing = &output->timing;
+	uint64_t now = weston_compositor_get_time_usec();
+
+	if (timing->repaint_end) {
+		weston_timing_histogram_add(
+			&timing->stat[WESTON_TIMING_PRESENT],
+			now - timing->repaint_end);
+		if (timing->last_finish)
+			weston_timing_histogram_add(
+				&timing->stat[WESTON_TIMING_FRAME_INTERVAL],
+				now - timing->last_finish);
+	}
+
+	if (timing->repaint_end && timing->commit_repainted) {
+		weston_timing_histogram_add(
+			&timing->stat[WESTON_TIMING_COMMIT_TO_PRESENT],
+			now - timing->commit_repainted);
+		timing->commit_repainted = 0;
+	}
+
+	timing->repaint_end = 0;
+	timing->last_finish = now;
+}
+
 static int
 weston_compositor_read_input(int fd, uint32_t mask, void *data)
 {
@@ -1880,20 +2319,18 @@ weston_compositor_read_input(int fd, uint32_t mask, void *data)
 	return 1;
 }
 
-WL_EXPORT void
-weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
+static void
+weston_output_start_frame(struct weston_output *output)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct wl_event_loop *loop =
 		wl_display_get_event_loop(compositor->wl_display);
 	int fd, r;
 
-	output->frame_time = msecs;
-
 	if (output->repaint_needed &&
 	    compositor->state != WESTON_COMPOSITOR_SLEEPING &&
 	    compositor->state != WESTON_COMPOSITOR_OFFSCREEN) {
-		r = weston_output_repaint(output, msecs);
+		r = weston_output_repaint(output, output->frame_time);
 		if (!r)
 			return;
 	}
@@ -1908,11 +2345,93 @@ weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
 				     weston_compositor_read_input, compositor);
 }
 
+static int
+output_repaint_timer_handler(void *data)
+{
+	weston_output_start_frame(data);
+
+	return 0;
+}
+
+/* Slack for timer wakeup latency on top of the predicted repaint time. */
+#define REPAINT_WINDOW_MARGIN_USEC 1000
+
+/* How long before the next expected frame the repaint should start, in
+ * microseconds, or 0 to start it right away. */
+static uint32_t
+weston_output_repaint_window(struct weston_output *output)
+{
+	int32_t window = output->compositor->repaint_window;
+	uint32_t predicted = 0;
+	int i;
+
+	if (window >= 0)
+		return window * 1000;
+
+	/* Plan for the slowest of the recent repaints rather than the
+	 * average: a repaint that overruns misses the frame entirely. */
+	for (i = 0; i < WESTON_REPAINT_HISTORY; i++)
+		if (output->repaint_history_usec[i] > predicted)
+			predicted = output->repaint_history_usec[i];
+
+	if (predicted == 0)
+		return 0;
+
+	return predicted + REPAINT_WINDOW_MARGIN_USEC;
+}
+
+/* Called by the backend when a frame has been shown.  Without a repaint
+ * window the next frame is repainted right away, a full refresh period
+ * before it can be shown, so anything committed in between has to wait
+ * for the frame after.  With a window the repaint is pushed back to
+ * just before the next expected frame, counted from the time the frame
+ * was shown.  repaint_scheduled stays set meanwhile, so commits only
+ * mark the output as needing a repaint.  The first frame of a repaint
+ * loop has nothing to wait for and is repainted right away. */
+WL_EXPORT void
+weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
+{
+	uint64_t period, window, elapsed;
+	uint32_t delay = 0;
+	int32_t age;
+
+	output->frame_time = msecs;
+
+	weston_output_timing_finish_frame(output);
+
+	window = weston_output_repaint_window(output);
+	if (output->repaint_loop_starting || window == 0 ||
+	    !output->current_mode || output->current_mode->refresh <= 0) {
+		output->repaint_loop_starting = 0;
+		weston_output_start_frame(output);
+		return;
+	}
+
+	/* Backends that stamp their frames with another clock than ours
+	 * show up as frames from the future or the distant past; count
+	 * those from now. */
+	age = (uint32_t) (weston_compositor_get_time_usec() / 1000) - msecs;
+	elapsed = age > 0 && age < 1000 ? age * 1000 : 0;
+
+	period = 1000000000ULL / output->current_mode->refresh;
+	if (window + elapsed < period)
+		delay = (period - window - elapsed) / 1000;
+
+	/* A zero timeout would disarm the timer. */
+	if (delay == 0) {
+		weston_output_start_frame(output);
+		return;
+	}
+
+	wl_event_source_timer_update(output->repaint_timer, delay);
+}
+
 static void
 idle_repaint(void *data)
 {
 	struct weston_output *output = data;
 
+	output->repaint_loop_starting = 1;
 	output->start_repaint_loop(output);
 }
 
@@ -1924,6 +2443,27 @@ weston_layer_init(struct weston_layer *layer, struct wl_list *below)
 		wl_list_insert(below, &layer->link);
 }
 
+WL_EXPORT void
+weston_compositor_view_list_dirty(struct weston_compositor *compositor)
+{
+	compositor->view_list_needs_rebuild = 1;
+}
+
+WL_EXPORT void
+weston_view_layer_insert(struct weston_view *view, struct wl_list *pos)
+{
+	wl_list_insert(pos, &view->layer_link);
+	weston_compositor_view_list_dirty(view->surface->compositor);
+}
+
+WL_EXPORT void
+weston_view_layer_remove(struct weston_view *view)
+{
+	wl_list_remove(&view->layer_link);
+	wl_list_init(&view->layer_link);
+	weston_compositor_view_list_dirty(view->surface->compositor);
+}
+
 WL_EXPORT void
 weston_output_schedule_repaint(struct weston_output *output)
 {
@@ -2081,12 +2621,46 @@ static void
 weston_surface_commit_subsurface_order(struct weston_surface *surface)
 {
 	struct weston_subsurface *sub;
+	struct wl_list *pos = surface->subsurface_list.next;
+
+	/* Both lists hold the same sub-surfaces, only restack and
+	 * invalidate the view list if the pending order differs. */
+	wl_list_for_each(sub, &surface->subsurface_list_pending,
+			 parent_link_pending) {
+		if (pos != &sub->parent_link)
+			break;
+		pos = pos->next;
+	}
+
+	if (pos == &surface->subsurface_list)
+		return;
 
 	wl_list_for_each_reverse(sub, &surface->subsurface_list_pending,
 				 parent_link_pending) {
 		wl_list_remove(&sub->parent_link);
 		wl_list_insert(&surface->subsurface_list, &sub->parent_link);
 	}
+
+	weston_compositor_view_list_dirty(surface->compositor);
+}
+
+/* Remember when the oldest commit not yet repainted happened on each
+ * output the surface is shown on, for the commit-to-present histogram. */
+static void
+weston_surface_timing_commit(struct weston_surface *surface)
+{
+	struct weston_output *output;
+	uint64_t now = 0;
+
+	wl_list_for_each(output, &surface->compositor->output_list, link) {
+		if (!(surface->output_mask & (1 << output->id)) ||
+		    output->timing.commit_pending)
+			continue;
+
+		if (now == 0)
+			now = weston_compositor_get_time_usec();
+		output->timing.commit_pending = now;
+	}
 }
 
 static void
@@ -2156,6 +2730,7 @@ weston_surface_commit(struct weston_surface *surface)
 
 	weston_surface_commit_subsurface_order(surface);
 
+	weston_surface_timing_commit(surface);
 	weston_surface_schedule_repaint(surface);
 }
 
@@ -2402,6 +2977,7 @@ weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
 
 	if (surface->pending.newly_attached) {
 		sub->cached.newly_attached = 1;
+		weston_buffer_set_surface(surface->pending.buffer, surface);
 		weston_buffer_reference(&sub->cached.buffer_ref,
 					surface->pending.buffer);
 	}
@@ -2709,6 +3285,7 @@ weston_subsurface_cache_fini(struct weston_subsurface *sub)
 static void
 weston_subsurface_unlink_parent(struct weston_subsurface *sub)
 {
+	weston_compositor_view_list_dirty(sub->parent->compositor);
 	wl_list_remove(&sub->parent_link);
 	wl_list_remove(&sub->parent_link_pending);
 	wl_list_remove(&sub->parent_destroy_listener.link);
@@ -2775,6 +3352,8 @@ weston_subsurface_link_parent(struct weston_subsurface *sub,
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+
+	weston_compositor_view_list_dirty(parent->compositor);
 }
 
 static void
@@ -2815,6 +3394,7 @@ weston_subsurface_destroy(struct weston_subsurface *sub)
 		assert(sub->parent_destroy_listener.notify == NULL);
 		wl_list_remove(&sub->parent_link);
 		wl_list_remove(&sub->parent_link_pending);
+		weston_compositor_view_list_dirty(sub->surface->compositor);
 	}
 
 	wl_list_remove(&sub->surface_destroy_listener.link);
@@ -2878,6 +3458,7 @@ weston_subsurface_create_for_parent(struct weston_surface *parent)
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+	weston_compositor_view_list_dirty(parent->compositor);
 
 	return sub;
 }
@@ -3177,6 +3758,8 @@ weston_compositor_verify_pointers(struct weston_compositor *ec)
 WL_EXPORT void
 weston_output_destroy(struct weston_output *output)
 {
+	unsigned int i;
+
 	output->destroying = 1;
 
 	weston_compositor_remove_output(output->compositor, output);
@@ -3189,8 +3772,12 @@ weston_output_destroy(struct weston_output *output)
 	free(output->name);
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
+	for (i = 0; i < ARRAY_LENGTH(output->pick_grid); i++)
+		wl_array_release(&output->pick_grid[i]);
 	output->compositor->output_id_pool &= ~(1 << output->id);
+	output->compositor->pick_grid_dirty = 1;
 
+	wl_event_source_remove(output->repaint_timer);
 	wl_global_destroy(output->global);
 }
 
@@ -3325,6 +3912,7 @@ weston_output_init_geometry(struct weston_output *output, int x, int y)
 	pixman_region32_init_rect(&output->region, x, y,
 				  output->width,
 				  output->height);
+	output->compositor->pick_grid_dirty = 1;
 }
 
 WL_EXPORT void
@@ -3367,6 +3955,8 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 		   int x, int y, int mm_width, int mm_height, uint32_t transform,
 		   int32_t scale)
 {
+	unsigned int i;
+
 	output->compositor = c;
 	output->x = x;
 	output->y = y;
@@ -3375,6 +3965,9 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	output->dirty = 1;
 	output->original_scale = scale;
 
+	for (i = 0; i < ARRAY_LENGTH(output->pick_grid); i++)
+		wl_array_init(&output->pick_grid[i]);
+
 	weston_output_transform_scale_init(output, transform, scale);
 	weston_output_init_zoom(output);
 
@@ -3390,6 +3983,10 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	output->id = ffs(~output->compositor->output_id_pool) - 1;
 	output->compositor->output_id_pool |= 1 << output->id;
 
+	output->repaint_timer =
+		wl_event_loop_add_timer(wl_display_get_event_loop(c->wl_display),
+					output_repaint_timer_handler, output);
+
 	output->global =
 		wl_global_create(c->wl_display, &wl_output_interface, 2,
 				 output, bind_output);
@@ -3622,6 +4219,105 @@ weston_environment_get_fd(const char *env)
 	return fd;
 }
 
+static void
+view_list_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+			void *data)
+{
+	struct weston_compositor *ec = data;
+
+	weston_log("view list rebuilt %u times in %u repaints\n",
+		   ec->view_list_rebuild_count, ec->repaint_count);
+}
+
+/* Lists the surfaces on screen whose buffers the compositor kept past
+ * the repaint that first used them, which is what pushes clients into
+ * allocating a third buffer. */
+static void
+buffer_stats_debug_binding(struct weston_seat *seat, uint32_t time,
+			   uint32_t key, void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_view *view;
+	struct weston_surface *surface;
+	struct weston_buffer_stats *stats;
+	struct wl_client *client;
+	pid_t pid;
+	uid_t uid;
+	gid_t gid;
+
+	weston_log("surfaces holding buffers across frames (us):\n");
+
+	wl_list_for_each(view, &ec->view_list, link)
+		view->surface->touched = 0;
+
+	wl_list_for_each(view, &ec->view_list, link) {
+		surface = view->surface;
+		stats = &surface->buffer_stats;
+		if (surface->touched || stats->held_across_frames == 0)
+			continue;
+		surface->touched = 1;
+
+		pid = 0;
+		if (surface->resource) {
+			client = wl_resource_get_client(surface->resource);
+			wl_client_get_credentials(client, &pid, &uid, &gid);
+		}
+
+		weston_log_continue(STAMP_SPACE
+				    "surface %p pid %d %dx%d: %u buffers, "
+				    "%u held across frames, %u held now "
+				    "(at most %u)\n",
+				    surface, pid, surface->width,
+				    surface->height, stats->acquired,
+				    stats->held_across_frames, stats->busy,
+				    stats->max_busy);
+		if (stats->hold.count == 0)
+			continue;
+		weston_log_continue(STAMP_SPACE
+				    "  hold avg %llu p50 <%u p99 <%u max %u\n",
+				    (unsigned long long)
+				    (stats->hold.sum / stats->hold.count),
+				    weston_timing_histogram_percentile(
+					    &stats->hold, 500),
+				    weston_timing_histogram_percentile(
+					    &stats->hold, 990),
+				    stats->hold.max);
+	}
+}
+
+/* [core] repaint-window is either a number of milliseconds or "auto"
+ * to predict it from the measured repaint times. */
+static void
+weston_compositor_read_repaint_window(struct weston_compositor *ec)
+{
+	struct weston_config_section *s;
+	char *value, *end;
+	long window;
+
+	s = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_string(s, "repaint-window", &value, NULL);
+
+	ec->repaint_window = 0;
+	if (value == NULL)
+		return;
+
+	if (strcmp(value, "auto") == 0) {
+		ec->repaint_window = -1;
+	} else {
+		errno = 0;
+		window = strtol(value, &end, 10);
+		if (errno != 0 || end == value || *end != '\0' ||
+		    window < 0 || window > 1000)
+			weston_log("invalid repaint-window \"%s\", "
+				   "repainting right after each frame\n",
+				   value);
+		else
+			ec->repaint_window = window;
+	}
+
+	free(value);
+}
+
 WL_EXPORT int
 weston_compositor_init(struct weston_compositor *ec,
 		       struct wl_display *display,
@@ -3663,6 +4359,10 @@ weston_compositor_init(struct weston_compositor *ec,
 		return -1;
 
 	wl_list_init(&ec->view_list);
+	ec->view_list_needs_rebuild = 1;
+	ec->view_list_rebuild_count = 0;
+	ec->repaint_count = 0;
+	ec->pick_grid_dirty = 1;
 	wl_list_init(&ec->plane_list);
 	wl_list_init(&ec->layer_list);
 	wl_list_init(&ec->seat_list);
@@ -3692,9 +4392,12 @@ weston_compositor_init(struct weston_compositor *ec,
 	if (weston_compositor_xkb_init(ec, &xkb_names) < 0)
 		return -1;
 
+	weston_compositor_read_repaint_window(ec);
+
 	ec->ping_handler = NULL;
 
 	screenshooter_create(ec);
+	frame_timing_create(ec);
 	text_backend_init(ec);
 
 	wl_data_device_manager_init(ec->wl_display);
@@ -3710,6 +4413,11 @@ weston_compositor_init(struct weston_compositor *ec,
 	weston_layer_init(&ec->fade_layer, &ec->layer_list);
 	weston_layer_init(&ec->cursor_layer, &ec->fade_layer.link);
 
+	weston_compositor_add_debug_binding(ec, KEY_L,
+					    view_list_debug_binding, ec);
+	weston_compositor_add_debug_binding(ec, KEY_B,
+					    buffer_stats_debug_binding, ec);
+
 	weston_compositor_schedule_repaint(ec);
 
 	return 0;
@@ -4035,7 +4743,8 @@ usage(int error_code)
 	fprintf(stderr,
 		"Options for fbdev-backend.so:\n\n"
 		"  --tty=TTY\t\tThe tty to use\n"
-		"  --device=DEVICE\tThe framebuffer device to use\n\n");
+		"  --device=DEVICE\tThe framebuffer device to use\n"
+		"  --no-shadow\t\tComposite straight into the frame buffer\n\n");
 
 	fprintf(stderr,
 		"Options for x11-backend.so:\n\n"
@@ -4056,6 +4765,14 @@ usage(int error_code)
 		"  --output-count=COUNT\tCreate multiple outputs\n"
 		"  --display=DISPLAY\tWayland display to connect to\n\n");
 
+	fprintf(stderr,
+		"Options for headless-backend.so:\n\n"
+		"  --width=WIDTH\t\tWidth of memory surface\n"
+		"  --height=HEIGHT\tHeight of memory surface\n"
+		"  --use-pixman\t\tUse the pixman (CPU) renderer\n"
+		"  --benchmark=N\t\tRepaint N frames back to back, print\n"
+		"\t\t\t\tper-stage timings and exit\n\n");
+
 #if defined(BUILD_RPI_COMPOSITOR) && defined(HAVE_BCM_HOST)
 	fprintf(stderr,
 		"Options for rpi-backend.so:\n\n"
@@ -166,6 +166,56 @@ enum dpms_enum {
 	WESTON_DPMS_OFF
 };
 
+/* Cells per axis of the per-output view picking grid. */
+#define WESTON_PICK_GRID_SIZE 16
+
+/* Stages of weston_output_repaint() that get timed on every frame. */
+enum weston_repaint_stage {
+	WESTON_REPAINT_STAGE_BUILD_VIEW_LIST,
+	WESTON_REPAINT_STAGE_ASSIGN_PLANES,
+	WESTON_REPAINT_STAGE_ACCUMULATE_DAMAGE,
+	WESTON_REPAINT_STAGE_REPAINT,
+	WESTON_REPAINT_STAGE_FRAME_CALLBACKS,
+	WESTON_REPAINT_STAGE_COUNT
+};
+
+/* Per-output frame timing statistics.  The repaint stages come first so
+ * that a weston_repaint_stage can be used as an index directly. */
+enum weston_timing_stat {
+	/* Time from finish_frame to finish_frame on a continuously
+	 * repainting output. */
+	WESTON_TIMING_FRAME_INTERVAL = WESTON_REPAINT_STAGE_COUNT,
+	/* Time from the end of a repaint to its finish_frame. */
+	WESTON_TIMING_PRESENT,
+	/* Time from the oldest surface commit shown in a frame to the
+	 * finish_frame of that frame. */
+	WESTON_TIMING_COMMIT_TO_PRESENT,
+	WESTON_TIMING_COUNT
+};
+
+/* Number of past repaint durations used to predict the next one. */
+#define WESTON_REPAINT_HISTORY 16
+
+/* Bucket 0 counts samples under 1 us and bucket i samples in
+ * [2^(i-1), 2^i) us; the last bucket also takes everything longer. */
+#define WESTON_TIMING_BUCKETS 24
+
+struct weston_timing_histogram {
+	uint32_t count;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t buckets[WESTON_TIMING_BUCKETS];
+};
+
+/* Only ever touched from the main loop, so no locking is needed. */
+struct weston_output_timing {
+	struct weston_timing_histogram stat[WESTON_TIMING_COUNT];
+	uint64_t last_finish;
+	uint64_t repaint_end;
+	uint64_t commit_pending;
+	uint64_t commit_repainted;
+};
+
 enum weston_mode_switch_op {
 	WESTON_MODE_SWITCH_SET_NATIVE,
 	WESTON_MODE_SWITCH_SET_TEMPORARY,
@@ -212,6 +262,23 @@ struct weston_output {
 	struct weston_mode *original_mode;
 	struct wl_list mode_list;
 
+	/* Uniform grid over the output region. Each cell is an array of
+	 * the views whose bounding box overlaps it, in view_list order.
+	 * Rebuilt on demand by weston_compositor_pick_view().
+	 */
+	struct wl_array pick_grid[WESTON_PICK_GRID_SIZE * WESTON_PICK_GRID_SIZE];
+
+	/* Time spent in each stage of the last repaint, in microseconds. */
+	uint32_t repaint_stage_usec[WESTON_REPAINT_STAGE_COUNT];
+	struct weston_output_timing timing;
+
+	/* Delays the repaint after finish_frame when a repaint window is
+	 * set; see weston_output_finish_frame(). */
+	struct wl_event_source *repaint_timer;
+	uint32_t repaint_history_usec[WESTON_REPAINT_HISTORY];
+	int repaint_history_pos;
+	int repaint_loop_starting;
+
 	void (*start_repaint_loop)(struct weston_output *output);
 	int (*repaint)(struct weston_output *output,
 			pixman_region32_t *damage);
@@ -611,6 +678,21 @@ struct weston_compositor {
 	struct weston_plane primary_plane;
 	uint32_t capabilities; /* combination of enum weston_capability */
 
+	/* Set by weston_compositor_view_list_dirty(), view_list is
+	 * rebuilt from the layers on the next repaint only if set. */
+	int view_list_needs_rebuild;
+	uint32_t view_list_rebuild_count;
+	uint32_t repaint_count;
+
+	/* How long before the next expected frame outputs start their
+	 * repaint, in ms.  0 repaints as soon as the previous frame is
+	 * shown, -1 predicts it from the measured repaint times. */
+	int32_t repaint_window;
+
+	/* Set whenever view_list, a view bounding box or an output
+	 * region changes, invalidating weston_output::pick_grid. */
+	int pick_grid_dirty;
+
 	struct weston_renderer *renderer;
 
 	pixman_format_code_t read_format;
@@ -645,6 +727,30 @@ struct weston_buffer {
 	int32_t width, height;
 	uint32_t busy_count;
 	int y_inverted;
+
+	/* Hold time tracking, see weston_buffer_reference().  'surface' is
+	 * the surface the buffer was last attached to, NULL once that
+	 * surface is gone. */
+	struct weston_surface *surface;
+	struct wl_listener surface_destroy_listener;
+	uint64_t busy_since;
+	uint32_t busy_repaint;
+	uint32_t release_count;
+	uint32_t last_hold_usec;
+};
+
+/* How long the compositor holds on to the buffers of a surface, from
+ * the first reference to the wl_buffer.release. */
+struct weston_buffer_stats {
+	uint32_t acquired;
+	uint32_t released;
+	/* Released only after a later repaint than the first one to use
+	 * it, so the client could not reuse it for its next frame. */
+	uint32_t held_across_frames;
+	/* Buffers held right now and the most ever held at once. */
+	uint32_t busy;
+	uint32_t max_busy;
+	struct weston_timing_histogram hold;
 };
 
 struct weston_buffer_reference {
@@ -740,7 +846,9 @@ struct weston_subsurface {
  * to produce the global coordinate vector P. The total transform
  *    Mn * ... * M2 * M1
  * is cached in view->transform.matrix, and the inverse of it in
- * view->transform.inverse.
+ * view->transform.inverse.  Mapping points between view-local and global
+ * coordinates goes through view->transform.to_global and from_global,
+ * which are picked to match the shape of those matrices.
  *
  * The list always contains view->transform.position transformation, which
  * is the translation by view->geometry.x and y.
@@ -755,6 +863,10 @@ struct weston_subsurface {
  *    Mparent * Mn * ... * M2 * M1
  */
 
+typedef void (*weston_view_map_func_t)(struct weston_matrix *matrix,
+				       const float *x, const float *y,
+				       float *out_x, float *out_y, int n);
+
 struct weston_view {
 	struct weston_surface *surface;
 	struct wl_list surface_link;
@@ -767,6 +879,11 @@ struct weston_view {
 	pixman_region32_t clip;
 	float alpha;                     /* part of geometry, see below */
 
+	/* Set while accumulating damage when the bounding box is entirely
+	 * covered by opaque views above it, so that the view is neither
+	 * drawn nor has its surface damage flushed. */
+	int occluded;
+
 	void *renderer_state;
 
 	/* Surface geometry state, mutable.
@@ -802,6 +919,12 @@ struct weston_view {
 		struct weston_matrix matrix;
 		struct weston_matrix inverse;
 
+		/* Map n points through matrix and inverse, specialized for
+		 * what the matrices actually do.  NULL while dirty.
+		 */
+		weston_view_map_func_t to_global;
+		weston_view_map_func_t from_global;
+
 		struct weston_transform position; /* matrix from x, y */
 	} transform;
 
@@ -859,6 +982,7 @@ struct weston_surface {
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_viewport buffer_viewport;
 	int keep_buffer; /* bool for backends to prevent early release */
+	struct weston_buffer_stats buffer_stats;
 
 	/* wl_surface_scaler resource for this surface */
 	struct wl_resource *surface_scaler_resource;
@@ -933,11 +1057,19 @@ weston_view_to_global_fixed(struct weston_view *view,
 void
 weston_view_to_global_float(struct weston_view *view,
 			    float sx, float sy, float *x, float *y);
+void
+weston_view_to_global_points(struct weston_view *view,
+			     const float *sx, const float *sy,
+			     float *x, float *y, int n);
 
 void
 weston_view_from_global_float(struct weston_view *view,
 			      float x, float y, float *vx, float *vy);
 void
+weston_view_from_global_points(struct weston_view *view,
+			       const float *x, const float *y,
+			       float *vx, float *vy, int n);
+void
 weston_view_from_global(struct weston_view *view,
 			int32_t x, int32_t y, int32_t *vx, int32_t *vy);
 void
@@ -1002,6 +1134,22 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 void
 weston_layer_init(struct weston_layer *layer, struct wl_list *below);
 
+/* Whenever you add or remove a view to or from a layer, restack it
+ * within a layer, or add or remove a layer to or from
+ * weston_compositor::layer_list, the compositor view_list must be
+ * rebuilt. Use weston_view_layer_insert() and weston_view_layer_remove()
+ * for views, and call weston_compositor_view_list_dirty() after
+ * manipulating layer links directly.
+ */
+void
+weston_compositor_view_list_dirty(struct weston_compositor *compositor);
+
+void
+weston_view_layer_insert(struct weston_view *view, struct wl_list *pos);
+
+void
+weston_view_layer_remove(struct weston_view *view);
+
 void
 weston_plane_init(struct weston_plane *plane,
 			struct weston_compositor *ec,
@@ -1291,6 +1439,17 @@ tty_activate_vt(struct tty *tty, int vt);
 void
 screenshooter_create(struct weston_compositor *ec);
 
+void
+weston_timing_histogram_add(struct weston_timing_histogram *histogram,
+			    uint64_t usec);
+
+uint32_t
+weston_timing_histogram_percentile(struct weston_timing_histogram *histogram,
+				   uint32_t permille);
+
+void
+frame_timing_create(struct weston_compositor *ec);
+
 struct clipboard *
 clipboard_create(struct weston_seat *seat);
 
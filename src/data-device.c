@@ -200,8 +200,8 @@ drag_surface_configure(struct weston_drag *drag,
 		else
 			list = &es->compositor->cursor_layer.view_list;
 
-		wl_list_remove(&drag->icon->layer_link);
-		wl_list_insert(list, &drag->icon->layer_link);
+		weston_view_layer_remove(drag->icon);
+		weston_view_layer_insert(drag->icon, list);
 		weston_view_update_transform(drag->icon);
 		empty_region(&es->pending.input);
 	}
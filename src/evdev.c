@@ -30,6 +30,10 @@
 #include <fcntl.h>
 #include <mtdev.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include "compositor.h"
 #include "evdev.h"
@@ -98,9 +102,13 @@ evdev_flush_pending_event(struct evdev_device *device, uint32_t time)
 	case EVDEV_NONE:
 		return;
 	case EVDEV_RELATIVE_MOTION:
-		notify_motion(master, time, device->rel.dx, device->rel.dy);
+		notify_motion(master, device->rel.time,
+			      device->rel.dx, device->rel.dy);
 		device->rel.dx = 0;
 		device->rel.dy = 0;
+		if (device->rel.frames > 1)
+			device->stats.motion_merged += device->rel.frames - 1;
+		device->rel.frames = 0;
 		goto handled;
 	case EVDEV_ABSOLUTE_MT_DOWN:
 		weston_output_transform_coordinate(device->output,
@@ -278,12 +286,14 @@ evdev_process_relative(struct evdev_device *device,
 		if (device->pending_event != EVDEV_RELATIVE_MOTION)
 			evdev_flush_pending_event(device, time);
 		device->rel.dx += wl_fixed_from_int(e->value);
+		device->rel.time = time;
 		device->pending_event = EVDEV_RELATIVE_MOTION;
 		break;
 	case REL_Y:
 		if (device->pending_event != EVDEV_RELATIVE_MOTION)
 			evdev_flush_pending_event(device, time);
 		device->rel.dy += wl_fixed_from_int(e->value);
+		device->rel.time = time;
 		device->pending_event = EVDEV_RELATIVE_MOTION;
 		break;
 	case REL_WHEEL:
@@ -333,12 +343,24 @@ evdev_process_absolute(struct evdev_device *device,
 	}
 }
 
+static inline int
+is_relative_motion(struct input_event *e)
+{
+	return e->type == EV_REL && (e->code == REL_X || e->code == REL_Y);
+}
+
 static void
 fallback_process(struct evdev_dispatch *dispatch,
 		 struct evdev_device *device,
 		 struct input_event *event,
 		 uint32_t time)
 {
+	/* Held back motion goes out before anything that isn't more
+	 * motion, so buttons and keys stay in order with it. */
+	if (device->rel.frames > 0 &&
+	    event->type != EV_SYN && !is_relative_motion(event))
+		evdev_flush_pending_event(device, time);
+
 	switch (event->type) {
 	case EV_REL:
 		evdev_process_relative(device, event, time);
@@ -350,6 +372,15 @@ fallback_process(struct evdev_dispatch *dispatch,
 		evdev_process_key(device, event, time);
 		break;
 	case EV_SYN:
+		/* Don't send relative motion yet: if the compositor fell
+		 * behind, the next frames read may be more motion, which
+		 * we merge into a single notify_motion().
+		 * evdev_device_data() sends it once the fd is drained. */
+		if (device->pending_event == EVDEV_RELATIVE_MOTION) {
+			device->rel.frames++;
+			device->stats.motion_frames++;
+			break;
+		}
 		evdev_flush_pending_event(device, time);
 		break;
 	}
@@ -426,13 +457,16 @@ evdev_device_data(int fd, uint32_t mask, void *data)
 				device->source = NULL;
 			}
 
-			return 1;
+			break;
 		}
 
 		evdev_process_events(device, ev, len / sizeof ev[0]);
 
 	} while (len > 0);
 
+	if (device->rel.frames > 0)
+		evdev_flush_pending_event(device, device->rel.time);
+
 	return 1;
 }
 
@@ -630,6 +664,8 @@ evdev_device_destroy(struct evdev_device *device)
 {
 	struct evdev_dispatch *dispatch;
 
+	evdev_input_thread_remove_device(device);
+
 	if (device->seat_caps & EVDEV_SEAT_POINTER)
 		weston_seat_release_pointer(device->seat);
 	if (device->seat_caps & EVDEV_SEAT_KEYBOARD)
@@ -694,3 +730,338 @@ evdev_notify_keyboard_focus(struct weston_seat *seat,
 
 	wl_array_release(&keys);
 }
+
+/* With an input thread, the evdev fds are read as soon as events
+ * arrive instead of between repaints.  Raw events go through a
+ * single-producer, single-consumer ring and are processed on the main
+ * loop as usual, which the thread wakes through an eventfd. */
+#define INPUT_RING_SIZE 4096	/* a power of two */
+#define INPUT_THREAD_QUIT ((uint32_t) -1)
+
+struct evdev_input_entry {
+	struct evdev_device *device;
+	struct input_event event;
+};
+
+struct evdev_input_thread {
+	struct weston_compositor *compositor;
+	pthread_t thread;
+	int epoll_fd;
+	int wake_fd;		/* thread -> main loop */
+	int quit_fd;		/* main loop -> thread */
+	struct wl_event_source *source;
+
+	/* The thread only reads devices[] with the mutex held, so
+	 * removing a device on the main loop can't race with a read. */
+	pthread_mutex_t mutex;
+	struct evdev_device **devices;
+	int devices_size;
+
+	/* head is only written by the thread and tail by the main
+	 * loop; each side reads the other's with acquire semantics. */
+	uint32_t head, tail;
+	struct evdev_input_entry ring[INPUT_RING_SIZE];
+};
+
+/* Read what fits in the ring.  Returns 0 once the fd is drained and 1
+ * if the ring filled up first. */
+static int
+input_thread_read(struct evdev_input_thread *thread,
+		  struct evdev_device *device, int slot)
+{
+	struct input_event ev[32];
+	uint32_t head, tail, room;
+	int i, len, count;
+
+	head = thread->head;
+	for (;;) {
+		tail = __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE);
+		room = INPUT_RING_SIZE - (head - tail);
+		if (room == 0)
+			break;
+		if (room > ARRAY_LENGTH(ev))
+			room = ARRAY_LENGTH(ev);
+
+		if (device->mtdev)
+			len = mtdev_get(device->mtdev, device->fd, ev, room) *
+				sizeof (struct input_event);
+		else
+			len = read(device->fd, ev, room * sizeof ev[0]);
+
+		if (len < 0 || len % sizeof ev[0] != 0) {
+			if (len < 0 && errno != EAGAIN && errno != EINTR) {
+				weston_log("device %s died\n",
+					   device->devnode);
+				epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL,
+					  device->fd, NULL);
+				thread->devices[slot] = NULL;
+			}
+			break;
+		}
+		if (len == 0)
+			break;
+
+		count = len / sizeof ev[0];
+		for (i = 0; i < count; i++) {
+			thread->ring[head & (INPUT_RING_SIZE - 1)].device =
+				device;
+			thread->ring[head & (INPUT_RING_SIZE - 1)].event =
+				ev[i];
+			head++;
+		}
+		__atomic_store_n(&thread->head, head, __ATOMIC_RELEASE);
+	}
+
+	return room == 0;
+}
+
+static void *
+input_thread_func(void *data)
+{
+	struct evdev_input_thread *thread = data;
+	struct epoll_event events[16];
+	struct timespec pause = { 0, 1000000 };
+	struct evdev_device *device;
+	uint32_t head;
+	uint64_t one = 1;
+	int i, n, slot, full;
+
+	for (;;) {
+		n = epoll_wait(thread->epoll_fd, events,
+			       ARRAY_LENGTH(events), -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			break;
+
+		head = thread->head;
+		full = 0;
+		for (i = 0; i < n; i++) {
+			slot = events[i].data.u32;
+			if (slot == (int) INPUT_THREAD_QUIT)
+				return NULL;
+
+			pthread_mutex_lock(&thread->mutex);
+			device = NULL;
+			if (slot < thread->devices_size)
+				device = thread->devices[slot];
+			if (device)
+				full |= input_thread_read(thread, device, slot);
+			pthread_mutex_unlock(&thread->mutex);
+		}
+
+		if (thread->head != head &&
+		    write(thread->wake_fd, &one, sizeof one) < 0)
+			weston_log("input thread: failed to wake main loop\n");
+
+		/* The fds are level triggered, so whatever didn't fit
+		 * will be read once the main loop has caught up. */
+		if (full)
+			nanosleep(&pause, NULL);
+	}
+
+	weston_log("input thread: epoll_wait failed: %m\n");
+
+	return NULL;
+}
+
+static void
+input_thread_drain(struct evdev_input_thread *thread)
+{
+	struct evdev_input_entry *entry;
+	struct evdev_device *device;
+	uint32_t head, tail, time;
+	int i;
+
+	tail = thread->tail;
+	head = __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE);
+	while (tail != head) {
+		entry = &thread->ring[tail & (INPUT_RING_SIZE - 1)];
+		device = entry->device;
+		time = entry->event.time.tv_sec * 1000 +
+			entry->event.time.tv_usec / 1000;
+
+		if (thread->compositor->session_active)
+			device->dispatch->interface->process(device->dispatch,
+							     device,
+							     &entry->event,
+							     time);
+		tail++;
+	}
+	__atomic_store_n(&thread->tail, tail, __ATOMIC_RELEASE);
+
+	/* Same as the end of evdev_device_data(). */
+	pthread_mutex_lock(&thread->mutex);
+	for (i = 0; i < thread->devices_size; i++) {
+		device = thread->devices[i];
+		if (device && device->rel.frames > 0)
+			evdev_flush_pending_event(device, device->rel.time);
+	}
+	pthread_mutex_unlock(&thread->mutex);
+}
+
+static int
+input_thread_wake(int fd, uint32_t mask, void *data)
+{
+	struct evdev_input_thread *thread = data;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		weston_log("input thread: eventfd read failed: %m\n");
+
+	input_thread_drain(thread);
+
+	return 1;
+}
+
+struct evdev_input_thread *
+evdev_input_thread_create(struct weston_compositor *compositor)
+{
+	struct evdev_input_thread *thread;
+	struct epoll_event ep;
+	struct wl_event_loop *loop;
+
+	thread = zalloc(sizeof *thread);
+	if (thread == NULL)
+		return NULL;
+
+	thread->compositor = compositor;
+	thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	thread->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	thread->quit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (thread->epoll_fd < 0 || thread->wake_fd < 0 ||
+	    thread->quit_fd < 0)
+		goto err_fds;
+
+	memset(&ep, 0, sizeof ep);
+	ep.events = EPOLLIN;
+	ep.data.u32 = INPUT_THREAD_QUIT;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD,
+		      thread->quit_fd, &ep) < 0)
+		goto err_fds;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	thread->source = wl_event_loop_add_fd(loop, thread->wake_fd,
+					      WL_EVENT_READABLE,
+					      input_thread_wake, thread);
+	if (thread->source == NULL)
+		goto err_fds;
+
+	pthread_mutex_init(&thread->mutex, NULL);
+	if (pthread_create(&thread->thread, NULL,
+			   input_thread_func, thread) != 0) {
+		pthread_mutex_destroy(&thread->mutex);
+		wl_event_source_remove(thread->source);
+		goto err_fds;
+	}
+
+	return thread;
+
+err_fds:
+	if (thread->epoll_fd >= 0)
+		close(thread->epoll_fd);
+	if (thread->wake_fd >= 0)
+		close(thread->wake_fd);
+	if (thread->quit_fd >= 0)
+		close(thread->quit_fd);
+	free(thread);
+
+	return NULL;
+}
+
+void
+evdev_input_thread_destroy(struct evdev_input_thread *thread)
+{
+	uint64_t one = 1;
+	int i;
+
+	for (i = 0; i < thread->devices_size; i++)
+		if (thread->devices[i])
+			evdev_input_thread_remove_device(thread->devices[i]);
+
+	if (write(thread->quit_fd, &one, sizeof one) < 0)
+		weston_log("input thread: failed to stop thread: %m\n");
+	pthread_join(thread->thread, NULL);
+
+	wl_event_source_remove(thread->source);
+	pthread_mutex_destroy(&thread->mutex);
+	close(thread->epoll_fd);
+	close(thread->wake_fd);
+	close(thread->quit_fd);
+	free(thread->devices);
+	free(thread);
+}
+
+int
+evdev_input_thread_add_device(struct evdev_input_thread *thread,
+			      struct evdev_device *device)
+{
+	struct evdev_device **devices;
+	struct epoll_event ep;
+	int slot, size;
+
+	pthread_mutex_lock(&thread->mutex);
+
+	for (slot = 0; slot < thread->devices_size; slot++)
+		if (thread->devices[slot] == NULL)
+			break;
+
+	if (slot == thread->devices_size) {
+		size = thread->devices_size ? thread->devices_size * 2 : 8;
+		devices = realloc(thread->devices, size * sizeof *devices);
+		if (devices == NULL)
+			goto err;
+		memset(devices + thread->devices_size, 0,
+		       (size - thread->devices_size) * sizeof *devices);
+		thread->devices = devices;
+		thread->devices_size = size;
+	}
+
+	memset(&ep, 0, sizeof ep);
+	ep.events = EPOLLIN;
+	ep.data.u32 = slot;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, device->fd, &ep) < 0)
+		goto err;
+
+	thread->devices[slot] = device;
+	device->thread = thread;
+	device->thread_slot = slot;
+
+	pthread_mutex_unlock(&thread->mutex);
+
+	/* Nothing reads the fd on the input loop anymore. */
+	if (device->source) {
+		wl_event_source_remove(device->source);
+		device->source = NULL;
+	}
+
+	return 0;
+
+err:
+	pthread_mutex_unlock(&thread->mutex);
+	weston_log("input thread: failed to add %s, "
+		   "reading it on the main loop\n", device->devnode);
+
+	return -1;
+}
+
+/* Called before the device's fd is closed.  Events already in the ring
+ * are processed while the device is still around. */
+void
+evdev_input_thread_remove_device(struct evdev_device *device)
+{
+	struct evdev_input_thread *thread = device->thread;
+
+	if (thread == NULL)
+		return;
+
+	pthread_mutex_lock(&thread->mutex);
+	if (thread->devices[device->thread_slot] == device) {
+		epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, device->fd, NULL);
+		thread->devices[device->thread_slot] = NULL;
+	}
+	pthread_mutex_unlock(&thread->mutex);
+
+	input_thread_drain(thread);
+	device->thread = NULL;
+}
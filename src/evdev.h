@@ -74,12 +74,26 @@ struct evdev_device {
 
 	struct {
 		wl_fixed_t dx, dy;
+		uint32_t time;
+		/* Motion frames held back over their SYN_REPORT, to be
+		 * merged with the following ones read in the same pass. */
+		int frames;
 	} rel;
 
+	struct {
+		uint32_t motion_frames;
+		uint32_t motion_merged;
+	} stats;
+
 	enum evdev_event_type pending_event;
 	enum evdev_device_seat_capability seat_caps;
 
 	int is_mt;
+
+	/* Set when the fd is read by an evdev_input_thread instead of
+	 * compositor->input_loop. */
+	struct evdev_input_thread *thread;
+	int thread_slot;
 };
 
 /* copied from udev/extras/input_id/input_id.c */
@@ -127,4 +141,17 @@ void
 evdev_notify_keyboard_focus(struct weston_seat *seat,
 			    struct wl_list *evdev_devices);
 
+struct evdev_input_thread *
+evdev_input_thread_create(struct weston_compositor *compositor);
+
+void
+evdev_input_thread_destroy(struct evdev_input_thread *thread);
+
+int
+evdev_input_thread_add_device(struct evdev_input_thread *thread,
+			      struct evdev_device *device);
+
+void
+evdev_input_thread_remove_device(struct evdev_device *device);
+
 #endif /* EVDEV_H */
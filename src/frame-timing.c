@@ -0,0 +1,253 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <linux/input.h>
+
+#include "compositor.h"
+#include "frame-timing-server-protocol.h"
+
+struct frame_timing {
+	struct weston_compositor *ec;
+	struct wl_global *global;
+	struct wl_listener destroy_listener;
+};
+
+static const char *stat_names[WESTON_TIMING_COUNT] = {
+	[WESTON_REPAINT_STAGE_BUILD_VIEW_LIST] = "build view list",
+	[WESTON_REPAINT_STAGE_ASSIGN_PLANES] = "assign planes",
+	[WESTON_REPAINT_STAGE_ACCUMULATE_DAMAGE] = "accumulate damage",
+	[WESTON_REPAINT_STAGE_REPAINT] = "repaint",
+	[WESTON_REPAINT_STAGE_FRAME_CALLBACKS] = "frame callbacks",
+	[WESTON_TIMING_FRAME_INTERVAL] = "frame interval",
+	[WESTON_TIMING_PRESENT] = "present",
+	[WESTON_TIMING_COMMIT_TO_PRESENT] = "commit to present",
+};
+
+WL_EXPORT void
+weston_timing_histogram_add(struct weston_timing_histogram *histogram,
+			    uint64_t usec)
+{
+	int bucket = 0;
+
+	if (usec)
+		bucket = 64 - __builtin_clzll(usec);
+	if (bucket >= WESTON_TIMING_BUCKETS)
+		bucket = WESTON_TIMING_BUCKETS - 1;
+
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->sum += usec;
+	if (usec > histogram->max)
+		histogram->max = usec > UINT32_MAX ? UINT32_MAX : usec;
+}
+
+/* Upper bound of the bucket holding the sample at 'permille' of the
+ * way through the histogram. */
+WL_EXPORT uint32_t
+weston_timing_histogram_percentile(struct weston_timing_histogram *histogram,
+				   uint32_t permille)
+{
+	uint64_t target, n = 0;
+	int i;
+
+	target = ((uint64_t) histogram->count * permille + 999) / 1000;
+	for (i = 0; i < WESTON_TIMING_BUCKETS - 1; i++) {
+		n += histogram->buckets[i];
+		if (n >= target)
+			return 1u << i;
+	}
+
+	return histogram->max;
+}
+
+static void
+frame_timing_debug_binding(struct weston_seat *seat, uint32_t time,
+			   uint32_t key, void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_output *output;
+	struct weston_timing_histogram *h;
+	uint32_t p50, p99;
+	int i;
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		weston_log("frame timing for output %s (us):\n",
+			   output->name ? output->name : "(unnamed)");
+
+		for (i = 0; i < WESTON_TIMING_COUNT; i++) {
+			h = &output->timing.stat[i];
+			if (h->count == 0)
+				continue;
+
+			p50 = weston_timing_histogram_percentile(h, 500);
+			p99 = weston_timing_histogram_percentile(h, 990);
+			weston_log_continue(STAMP_SPACE
+					    "%-18s n %-7u avg %-7llu "
+					    "p50 <%-7u p99 <%-7u max %u\n",
+					    stat_names[i], h->count,
+					    (unsigned long long)
+					    (h->sum / h->count),
+					    p50, p99, h->max);
+		}
+	}
+}
+
+static void
+frame_timing_destroy_request(struct wl_client *client,
+			     struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+/* The output behind a wl_output resource, or NULL if it is gone and the
+ * resource's user data is stale. */
+static struct weston_output *
+frame_timing_get_output(struct wl_resource *resource,
+			struct wl_resource *output_resource)
+{
+	struct frame_timing *timing = wl_resource_get_user_data(resource);
+	struct weston_output *data = wl_resource_get_user_data(output_resource);
+	struct weston_output *output;
+
+	wl_list_for_each(output, &timing->ec->output_list, link)
+		if (output == data)
+			return output;
+
+	return NULL;
+}
+
+static void
+frame_timing_get(struct wl_client *client,
+		 struct wl_resource *resource,
+		 struct wl_resource *output_resource)
+{
+	struct weston_output *output =
+		frame_timing_get_output(resource, output_resource);
+	struct weston_timing_histogram *h;
+	struct wl_array buckets;
+	int i;
+
+	/* No histograms for an output that is gone, just the end of them. */
+	if (output == NULL) {
+		weston_frame_timing_send_done(resource);
+		return;
+	}
+
+	wl_array_init(&buckets);
+	if (!wl_array_add(&buckets, sizeof h->buckets)) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	for (i = 0; i < WESTON_TIMING_COUNT; i++) {
+		h = &output->timing.stat[i];
+		memcpy(buckets.data, h->buckets, sizeof h->buckets);
+		weston_frame_timing_send_histogram(resource, i, h->count,
+						   h->sum >> 32,
+						   h->sum & 0xffffffff,
+						   h->max, &buckets);
+	}
+	weston_frame_timing_send_done(resource);
+
+	wl_array_release(&buckets);
+}
+
+static void
+frame_timing_reset(struct wl_client *client,
+		   struct wl_resource *resource,
+		   struct wl_resource *output_resource)
+{
+	struct weston_output *output =
+		frame_timing_get_output(resource, output_resource);
+
+	if (output)
+		memset(output->timing.stat, 0, sizeof output->timing.stat);
+}
+
+static const struct weston_frame_timing_interface frame_timing_implementation = {
+	frame_timing_destroy_request,
+	frame_timing_get,
+	frame_timing_reset
+};
+
+static void
+bind_frame_timing(struct wl_client *client,
+		  void *data, uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &weston_frame_timing_interface, 1, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &frame_timing_implementation,
+				       data, NULL);
+}
+
+static void
+frame_timing_destroy(struct wl_listener *listener, void *data)
+{
+	struct frame_timing *timing =
+		container_of(listener, struct frame_timing, destroy_listener);
+
+	if (timing->global)
+		wl_global_destroy(timing->global);
+	free(timing);
+}
+
+void
+frame_timing_create(struct weston_compositor *ec)
+{
+	struct frame_timing *timing;
+	struct weston_config_section *s;
+	int expose;
+
+	timing = zalloc(sizeof *timing);
+	if (timing == NULL)
+		return;
+
+	timing->ec = ec;
+
+	/* The histograms are always kept; only hand them to clients when
+	 * asked to, since they leak what other clients are doing. */
+	s = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(s, "frame-timing-protocol",
+				       &expose, 0);
+	if (expose)
+		timing->global =
+			wl_global_create(ec->wl_display,
+					 &weston_frame_timing_interface, 1,
+					 timing, bind_frame_timing);
+
+	weston_compositor_add_debug_binding(ec, KEY_T,
+					    frame_timing_debug_binding, ec);
+
+	timing->destroy_listener.notify = frame_timing_destroy;
+	wl_signal_add(&ec->destroy_signal, &timing->destroy_listener);
+}
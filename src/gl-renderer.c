@@ -101,6 +101,12 @@ struct gl_renderer {
 	int fan_debug;
 	struct weston_binding *fragment_binding;
 	struct weston_binding *fan_binding;
+	struct weston_binding *upload_binding;
+
+	/* Bytes of SHM texture data uploaded since the last repaint,
+	 * logged every frame while upload_debug is set. */
+	uint64_t upload_bytes;
+	int upload_debug;
 
 	EGLDisplay egl_display;
 	EGLContext egl_context;
@@ -108,6 +114,14 @@ struct gl_renderer {
 
 	struct wl_array vertices;
 	struct wl_array vtxcnt;
+	struct wl_array indices;
+	struct wl_array clip_buffer;
+
+	/* Reused for every repaint_region(), which uploads the vertices
+	 * and triangle indices of a whole region at once. */
+	GLuint vertex_buffer;
+	GLuint index_buffer;
+	struct wl_array upload_buffer;
 
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 	PFNEGLCREATEIMAGEKHRPROC create_image;
@@ -197,81 +211,6 @@ gl_renderer_print_egl_error_state(void)
 		egl_error_string(code), (long)code);
 }
 
-#define max(a, b) (((a) > (b)) ? (a) : (b))
-#define min(a, b) (((a) > (b)) ? (b) : (a))
-
-/*
- * Compute the boundary vertices of the intersection of the global coordinate
- * aligned rectangle 'rect', and an arbitrary quadrilateral produced from
- * 'surf_rect' when transformed from surface coordinates into global coordinates.
- * The vertices are written to 'ex' and 'ey', and the return value is the
- * number of vertices. Vertices are produced in clockwise winding order.
- * Guarantees to produce either zero vertices, or 3-8 vertices with non-zero
- * polygon area.
- */
-static int
-calculate_edges(struct weston_view *ev, pixman_box32_t *rect,
-		pixman_box32_t *surf_rect, GLfloat *ex, GLfloat *ey)
-{
-
-	struct clip_context ctx;
-	int i, n;
-	GLfloat min_x, max_x, min_y, max_y;
-	struct polygon8 surf = {
-		{ surf_rect->x1, surf_rect->x2, surf_rect->x2, surf_rect->x1 },
-		{ surf_rect->y1, surf_rect->y1, surf_rect->y2, surf_rect->y2 },
-		4
-	};
-
-	ctx.clip.x1 = rect->x1;
-	ctx.clip.y1 = rect->y1;
-	ctx.clip.x2 = rect->x2;
-	ctx.clip.y2 = rect->y2;
-
-	/* transform surface to screen space: */
-	for (i = 0; i < surf.n; i++)
-		weston_view_to_global_float(ev, surf.x[i], surf.y[i],
-					    &surf.x[i], &surf.y[i]);
-
-	/* find bounding box: */
-	min_x = max_x = surf.x[0];
-	min_y = max_y = surf.y[0];
-
-	for (i = 1; i < surf.n; i++) {
-		min_x = min(min_x, surf.x[i]);
-		max_x = max(max_x, surf.x[i]);
-		min_y = min(min_y, surf.y[i]);
-		max_y = max(max_y, surf.y[i]);
-	}
-
-	/* First, simple bounding box check to discard early transformed
-	 * surface rects that do not intersect with the clip region:
-	 */
-	if ((min_x >= ctx.clip.x2) || (max_x <= ctx.clip.x1) ||
-	    (min_y >= ctx.clip.y2) || (max_y <= ctx.clip.y1))
-		return 0;
-
-	/* Simple case, bounding box edges are parallel to surface edges,
-	 * there will be only four edges.  We just need to clip the surface
-	 * vertices to the clip rect bounds:
-	 */
-	if (!ev->transform.enabled)
-		return clip_simple(&ctx, &surf, ex, ey);
-
-	/* Transformed case: use a general polygon clipping algorithm to
-	 * clip the surface rectangle with each side of 'rect'.
-	 * The algorithm is Sutherland-Hodgman, as explained in
-	 * http://www.codeguru.com/cpp/misc/misc/graphics/article.php/c8965/Polygon-Clipping.htm
-	 * but without looking at any of that code.
-	 */
-	n = clip_transformed(&ctx, &surf, ex, ey);
-
-	if (n < 3)
-		return 0;
-
-	return n;
-}
-
 static int
 texture_region(struct weston_view *ev, pixman_region32_t *region,
 		pixman_region32_t *surf_region)
@@ -280,9 +219,12 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
 	GLfloat *v, inv_width, inv_height;
+	GLfloat *qx, *qy, *ex, *ey;
 	unsigned int *vtxcnt, nvtx = 0;
 	pixman_box32_t *rects, *surf_rects;
-	int i, j, k, nrects, nsurf;
+	struct clip_context ctx;
+	struct clip_quads quads;
+	int i, j, k, nrects, nsurf, *quad_vtxcnt;
 
 	rects = pixman_region32_rectangles(region, &nrects);
 	surf_rects = pixman_region32_rectangles(surf_region, &nsurf);
@@ -293,45 +235,80 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 	v = wl_array_add(&gr->vertices, nrects * nsurf * 8 * 4 * sizeof *v);
 	vtxcnt = wl_array_add(&gr->vtxcnt, nrects * nsurf * sizeof *vtxcnt);
 
+	/* Room for the transformed surface rectangles as quads, and for
+	 * the up to eight clipped edge points of each of them: */
+	gr->clip_buffer.size = 0;
+	qx = wl_array_add(&gr->clip_buffer,
+			  nsurf * (24 * sizeof *qx + sizeof *quad_vtxcnt));
+	if (!v || !vtxcnt || !qx)
+		return 0;
+	qy = qx + 4 * nsurf;
+	ex = qy + 4 * nsurf;
+	ey = ex + 8 * nsurf;
+	quad_vtxcnt = (int *) (ey + 8 * nsurf);
+
 	inv_width = 1.0 / gs->pitch;
         inv_height = 1.0 / gs->height;
 
+	/* Transform all surface rectangles to screen space at once, laid
+	 * out as clip_quads() wants them, corners in clockwise order: */
+	for (k = 0; k < 4; k++) {
+		quads.x[k] = qx + k * nsurf;
+		quads.y[k] = qy + k * nsurf;
+	}
+	quads.n = nsurf;
+	for (j = 0; j < nsurf; j++) {
+		quads.x[0][j] = quads.x[3][j] = surf_rects[j].x1;
+		quads.x[1][j] = quads.x[2][j] = surf_rects[j].x2;
+		quads.y[0][j] = quads.y[1][j] = surf_rects[j].y1;
+		quads.y[2][j] = quads.y[3][j] = surf_rects[j].y2;
+	}
+	weston_view_to_global_points(ev, qx, qy, qx, qy, 4 * nsurf);
+
 	for (i = 0; i < nrects; i++) {
 		pixman_box32_t *rect = &rects[i];
+
+		/* The transformed surface, after clipping to the clip region,
+		 * can have as many as eight sides, emitted as a triangle-fan.
+		 * The first vertex in the triangle fan can be chosen arbitrarily,
+		 * since the area is guaranteed to be convex.
+		 *
+		 * If a corner of the transformed surface falls outside of the
+		 * clip region, instead of emitting one vertex for the corner
+		 * of the surface, up to two are emitted for two corresponding
+		 * intersection point(s) between the surface and the clip region.
+		 *
+		 * To do this, we first calculate the (up to eight) points that
+		 * form the intersection of the clip rect and each transformed
+		 * surface rect.
+		 */
+		ctx.clip.x1 = rect->x1;
+		ctx.clip.y1 = rect->y1;
+		ctx.clip.x2 = rect->x2;
+		ctx.clip.y2 = rect->y2;
+
+		if (clip_quads(&ctx, &quads, ex, ey, quad_vtxcnt) == 0)
+			continue;
+
 		for (j = 0; j < nsurf; j++) {
-			pixman_box32_t *surf_rect = &surf_rects[j];
-			GLfloat sx, sy, bx, by;
-			GLfloat ex[8], ey[8];          /* edge points in screen space */
-			int n;
-
-			/* The transformed surface, after clipping to the clip region,
-			 * can have as many as eight sides, emitted as a triangle-fan.
-			 * The first vertex in the triangle fan can be chosen arbitrarily,
-			 * since the area is guaranteed to be convex.
-			 *
-			 * If a corner of the transformed surface falls outside of the
-			 * clip region, instead of emitting one vertex for the corner
-			 * of the surface, up to two are emitted for two corresponding
-			 * intersection point(s) between the surface and the clip region.
-			 *
-			 * To do this, we first calculate the (up to eight) points that
-			 * form the intersection of the clip rect and the transformed
-			 * surface.
-			 */
-			n = calculate_edges(ev, rect, surf_rect, ex, ey);
+			GLfloat *px = ex + 8 * j, *py = ey + 8 * j;
+			GLfloat sx[8], sy[8];          /* edge points in surface space */
+			GLfloat bx, by;
+			int n = quad_vtxcnt[j];
+
 			if (n < 3)
 				continue;
 
+			weston_view_from_global_points(ev, px, py, sx, sy, n);
+
 			/* emit edge points: */
 			for (k = 0; k < n; k++) {
-				weston_view_from_global_float(ev, ex[k], ey[k],
-							      &sx, &sy);
 				/* position: */
-				*(v++) = ex[k];
-				*(v++) = ey[k];
+				*(v++) = px[k];
+				*(v++) = py[k];
 				/* texcoord: */
 				weston_surface_to_buffer_float(ev->surface,
-							       sx, sy,
+							       sx[k], sy[k],
 							       &bx, &by);
 				*(v++) = bx * inv_width;
 				if (gs->y_inverted) {
@@ -388,15 +365,41 @@ triangle_fan_debug(struct weston_view *view, int first, int count)
 	free(buffer);
 }
 
+/* Draw the triangles indexed so far, which refer to vertices counted from
+ * 'first' in the vertex buffer. */
+static void
+draw_indexed_triangles(struct gl_renderer *gr, unsigned int first)
+{
+	GLsizei stride = 4 * sizeof(GLfloat);
+	GLsizei count = gr->indices.size / sizeof(GLushort);
+
+	if (count == 0)
+		return;
+
+	/* position: */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride,
+			      (void *) (uintptr_t) (first * stride));
+	/* texcoord: */
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,
+			      (void *) (uintptr_t) (first * stride +
+						    2 * sizeof(GLfloat)));
+
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, gr->indices.size,
+		     gr->indices.data, GL_STREAM_DRAW);
+	glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, NULL);
+
+	gr->indices.size = 0;
+}
+
 static void
 repaint_region(struct weston_view *ev, pixman_region32_t *region,
 		pixman_region32_t *surf_region)
 {
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v;
 	unsigned int *vtxcnt;
-	int i, first, nfans;
+	unsigned int i, k, first, base, nfans;
+	GLushort *index;
 
 	/* The final region to be painted is the intersection of
 	 * 'region' and 'surf_region'. However, 'region' is in the global
@@ -407,30 +410,64 @@ repaint_region(struct weston_view *ev, pixman_region32_t *region,
 	 * it has a non-zero area (at least 3 vertices1, actually).
 	 */
 	nfans = texture_region(ev, region, surf_region);
+	if (nfans == 0)
+		goto out;
 
-	v = gr->vertices.data;
 	vtxcnt = gr->vtxcnt.data;
 
-	/* position: */
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
-	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, gr->vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, gr->vertices.size,
+		     gr->vertices.data, GL_STREAM_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gr->index_buffer);
 
-	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
+	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 
-	for (i = 0, first = 0; i < nfans; i++) {
-		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
-		if (gr->fan_debug)
+	/* Split the fans into triangles so that the whole region is one
+	 * draw call, or one per 64k vertices since GLES2 only guarantees
+	 * 16 bit indices. */
+	for (i = 0, first = 0, base = 0; i < nfans; i++) {
+		if (base + vtxcnt[i] - first > 0x10000) {
+			draw_indexed_triangles(gr, first);
+			first = base;
+		}
+
+		index = wl_array_add(&gr->indices,
+				     (vtxcnt[i] - 2) * 3 * sizeof *index);
+		if (index == NULL)
+			break;
+
+		for (k = 2; k < vtxcnt[i]; k++) {
+			*index++ = base - first;
+			*index++ = base - first + k - 1;
+			*index++ = base - first + k;
+		}
+
+		base += vtxcnt[i];
+	}
+	draw_indexed_triangles(gr, first);
+
+	if (gr->fan_debug) {
+		/* triangle_fan_debug() uses client side indices. */
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE,
+				      4 * sizeof(GLfloat), NULL);
+		for (i = 0, first = 0; i < nfans; i++) {
 			triangle_fan_debug(ev, first, vtxcnt[i]);
-		first += vtxcnt[i];
+			first += vtxcnt[i];
+		}
 	}
 
 	glDisableVertexAttribArray(1);
 	glDisableVertexAttribArray(0);
 
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+out:
 	gr->vertices.size = 0;
 	gr->vtxcnt.size = 0;
+	gr->indices.size = 0;
 }
 
 static int
@@ -592,7 +629,8 @@ repaint_views(struct weston_output *output, pixman_region32_t *damage)
 	struct weston_view *view;
 
 	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
+		if (view->plane == &compositor->primary_plane &&
+		    !view->occluded)
 			draw_view(view, output, damage);
 }
 
@@ -807,6 +845,11 @@ gl_renderer_repaint_output(struct weston_output *output,
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
 
+	if (gr->upload_debug)
+		weston_log("gl: uploaded %llu bytes of shm texture data\n",
+			   (unsigned long long) gr->upload_bytes);
+	gr->upload_bytes = 0;
+
 	ret = eglSwapBuffers(gr->egl_display, go->egl_surface);
 	if (ret == EGL_FALSE && !errored) {
 		errored = 1;
@@ -845,6 +888,73 @@ gl_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+/* Without GL_EXT_unpack_subimage, glTexSubImage2D() can only read
+ * tightly packed rows. Copy each damaged rectangle into a staging
+ * buffer, with rows padded to the default unpack alignment of 4, and
+ * upload only that. */
+static void
+texture_upload_damage_packed(struct gl_renderer *gr,
+			     struct gl_surface_state *gs,
+			     struct weston_surface *surface,
+			     struct wl_shm_buffer *shm_buffer,
+			     GLenum format, GLenum pixel_type, int bpp)
+{
+	pixman_box32_t *rectangles, r;
+	uint8_t *data, *src, *dst, *packed;
+	int32_t stride, row, packed_stride;
+	int i, n, y;
+
+	data = wl_shm_buffer_get_data(shm_buffer);
+	stride = wl_shm_buffer_get_stride(shm_buffer);
+
+	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
+	for (i = 0; i < n; i++) {
+		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
+
+		if (r.x1 < 0)
+			r.x1 = 0;
+		if (r.y1 < 0)
+			r.y1 = 0;
+		if (r.x2 > gs->pitch)
+			r.x2 = gs->pitch;
+		if (r.y2 > gs->height)
+			r.y2 = gs->height;
+		if (r.x1 >= r.x2 || r.y1 >= r.y2)
+			continue;
+
+		row = (r.x2 - r.x1) * bpp;
+		src = data + r.y1 * stride + r.x1 * bpp;
+
+		/* Whole rows are already laid out the way GL wants them. */
+		if (row == stride && stride % 4 == 0) {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, r.x1, r.y1,
+					r.x2 - r.x1, r.y2 - r.y1,
+					format, pixel_type, src);
+			gr->upload_bytes += row * (r.y2 - r.y1);
+			continue;
+		}
+
+		packed_stride = (row + 3) & ~3;
+		gr->upload_buffer.size = 0;
+		packed = wl_array_add(&gr->upload_buffer,
+				      packed_stride * (r.y2 - r.y1));
+		if (!packed)
+			return;
+
+		dst = packed;
+		for (y = r.y1; y < r.y2; y++) {
+			memcpy(dst, src, row);
+			dst += packed_stride;
+			src += stride;
+		}
+
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x1, r.y1,
+				r.x2 - r.x1, r.y2 - r.y1,
+				format, pixel_type, packed);
+		gr->upload_bytes += packed_stride * (r.y2 - r.y1);
+	}
+}
+
 static void
 gl_renderer_flush_damage(struct weston_surface *surface)
 {
@@ -855,6 +965,7 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	int texture_used;
 	GLenum format;
 	int pixel_type;
+	int bpp;
 
 #ifdef GL_EXT_unpack_subimage
 	pixman_box32_t *rectangles;
@@ -892,25 +1003,35 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	case WL_SHM_FORMAT_ARGB8888:
 		format = GL_BGRA_EXT;
 		pixel_type = GL_UNSIGNED_BYTE;
+		bpp = 4;
 		break;
 	case WL_SHM_FORMAT_RGB565:
 		format = GL_RGB;
 		pixel_type = GL_UNSIGNED_SHORT_5_6_5;
+		bpp = 2;
 		break;
 	default:
 		weston_log("warning: unknown shm buffer format\n");
 		format = GL_BGRA_EXT;
 		pixel_type = GL_UNSIGNED_BYTE;
+		bpp = 4;
 	}
 
 	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
 
 	if (!gr->has_unpack_subimage) {
 		wl_shm_buffer_begin_access(buffer->shm_buffer);
-		glTexImage2D(GL_TEXTURE_2D, 0, format,
-			     gs->pitch, buffer->height, 0,
-			     format, pixel_type,
-			     wl_shm_buffer_get_data(buffer->shm_buffer));
+		if (gs->needs_full_upload) {
+			glTexImage2D(GL_TEXTURE_2D, 0, format,
+				     gs->pitch, buffer->height, 0,
+				     format, pixel_type,
+				     wl_shm_buffer_get_data(buffer->shm_buffer));
+			gr->upload_bytes += gs->pitch * bpp * buffer->height;
+		} else {
+			texture_upload_damage_packed(gr, gs, surface,
+						     buffer->shm_buffer,
+						     format, pixel_type, bpp);
+		}
 		wl_shm_buffer_end_access(buffer->shm_buffer);
 
 		goto done;
@@ -928,6 +1049,7 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 				0, 0, gs->pitch, buffer->height,
 				format, pixel_type, data);
 		wl_shm_buffer_end_access(buffer->shm_buffer);
+		gr->upload_bytes += gs->pitch * bpp * buffer->height;
 		goto done;
 	}
 
@@ -943,6 +1065,7 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x1, r.y1,
 				r.x2 - r.x1, r.y2 - r.y1,
 				format, pixel_type, data);
+		gr->upload_bytes += (r.x2 - r.x1) * bpp * (r.y2 - r.y1);
 	}
 	wl_shm_buffer_end_access(buffer->shm_buffer);
 #endif
@@ -1605,6 +1728,9 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
+	glDeleteBuffers(1, &gr->vertex_buffer);
+	glDeleteBuffers(1, &gr->index_buffer);
+
 	/* Work around crash in egl_dri2.c's dri2_make_current() - when does this apply? */
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -1615,9 +1741,13 @@ gl_renderer_destroy(struct weston_compositor *ec)
 
 	wl_array_release(&gr->vertices);
 	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->indices);
+	wl_array_release(&gr->clip_buffer);
+	wl_array_release(&gr->upload_buffer);
 
 	weston_binding_destroy(gr->fragment_binding);
 	weston_binding_destroy(gr->fan_binding);
+	weston_binding_destroy(gr->upload_binding);
 
 	free(gr);
 }
@@ -1812,6 +1942,16 @@ fan_debug_repaint_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	weston_compositor_damage_all(compositor);
 }
 
+static void
+upload_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		     void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct gl_renderer *gr = get_renderer(compositor);
+
+	gr->upload_debug = !gr->upload_debug;
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 {
@@ -1908,6 +2048,9 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 
 	glActiveTexture(GL_TEXTURE0);
 
+	glGenBuffers(1, &gr->vertex_buffer);
+	glGenBuffers(1, &gr->index_buffer);
+
 	if (compile_shaders(ec))
 		return -1;
 
@@ -1919,6 +2062,10 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		weston_compositor_add_debug_binding(ec, KEY_F,
 						    fan_debug_repaint_binding,
 						    ec);
+	gr->upload_binding =
+		weston_compositor_add_debug_binding(ec, KEY_U,
+						    upload_debug_binding,
+						    ec);
 
 	weston_log("GL ES 2 renderer features:\n");
 	weston_log_continue(STAMP_SPACE "read-back format: %s\n",
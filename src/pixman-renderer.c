@@ -25,37 +25,103 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "pixman-renderer.h"
 
 #include <linux/input.h>
 
+#define BUFFER_HISTORY_COUNT 3
+
 struct pixman_output_state {
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
 	pixman_image_t *hw_buffer;
+
+	/* In direct mode the views are composited straight into
+	 * hw_buffer. The buffers of the last frames and their damage,
+	 * newest first, tell how much of a reused buffer is stale. */
+	int direct;
+	pixman_image_t *history_buffer[BUFFER_HISTORY_COUNT];
+	pixman_region32_t history_damage[BUFFER_HISTORY_COUNT];
 };
 
 struct pixman_surface_state {
 	struct weston_surface *surface;
 
 	pixman_image_t *image;
+	pixman_color_t color;
 	struct weston_buffer_reference buffer_ref;
 
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
 
+/* Height in rows of the output bands handed out to the workers. */
+#define PIXMAN_TILE_HEIGHT 64
+#define PIXMAN_MAX_THREADS 16
+
+/* A single composite of a view into the shadow image. The main thread
+ * records these back-to-front, and each worker replays all of them
+ * clipped to its tile. The source is described rather than shared so
+ * that every worker can build its own pixman image and set the
+ * transform and clip without touching the others' state. */
+struct pixman_composite_op {
+	pixman_region32_t region;	/* in output coordinates */
+	pixman_op_t op;
+	pixman_transform_t transform;
+	pixman_filter_t filter;
+
+	struct wl_shm_buffer *shm_buffer;
+	pixman_format_code_t format;
+	int width, height, stride;
+	uint32_t *bits;			/* NULL for solid fills */
+	pixman_color_t color;
+};
+
+struct pixman_tile_job {
+	struct pixman_composite_op *ops;
+	int op_count;
+	int repaint_debug;
+
+	pixman_format_code_t format;
+	uint32_t *bits;
+	int width, height, stride;
+
+	int tile_count;
+	int next_tile;			/* protected by pool mutex */
+};
+
+struct pixman_worker_pool {
+	pthread_t *threads;
+	int thread_count;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	uint32_t generation;
+	int busy;
+	int quit;
+	struct pixman_tile_job *job;
+};
+
 struct pixman_renderer {
 	struct weston_renderer base;
 
 	int repaint_debug;
-	pixman_image_t *debug_color;
 	struct weston_binding *debug_binding;
 
+	struct wl_array ops;
+	struct pixman_worker_pool pool;
+
 	struct wl_signal destroy_signal;
 };
 
+static const pixman_color_t debug_red = {
+	0x3fff, 0x0000, 0x0000, 0x3fff
+};
+
 static inline struct pixman_output_state *
 get_output_state(struct weston_output *output)
 {
@@ -88,13 +154,17 @@ pixman_renderer_read_pixels(struct weston_output *output,
 {
 	struct pixman_output_state *po = get_output_state(output);
 	pixman_transform_t transform;
-	pixman_image_t *out_buf;
+	pixman_image_t *out_buf, *src;
 
 	if (!po->hw_buffer) {
 		errno = ENODEV;
 		return -1;
 	}
 
+	/* The shadow holds the same pixels, in memory that is cheap to
+	 * read, unlike a frame buffer mapping. */
+	src = po->shadow_image ? po->shadow_image : po->hw_buffer;
+
 	out_buf = pixman_image_create_bits(format,
 		width,
 		height,
@@ -104,22 +174,22 @@ pixman_renderer_read_pixels(struct weston_output *output,
 	/* Caller expects vflipped source image */
 	pixman_transform_init_translate(&transform,
 					pixman_int_to_fixed (x),
-					pixman_int_to_fixed (y - pixman_image_get_height (po->hw_buffer)));
+					pixman_int_to_fixed (y - pixman_image_get_height (src)));
 	pixman_transform_scale(&transform, NULL,
 			       pixman_fixed_1,
 			       pixman_fixed_minus_1);
-	pixman_image_set_transform(po->hw_buffer, &transform);
+	pixman_image_set_transform(src, &transform);
 
 	pixman_image_composite32(PIXMAN_OP_SRC,
-				 po->hw_buffer, /* src */
+				 src, /* src */
 				 NULL /* mask */,
 				 out_buf, /* dest */
 				 0, 0, /* src_x, src_y */
 				 0, 0, /* mask_x, mask_y */
 				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->hw_buffer), /* width */
-				 pixman_image_get_height (po->hw_buffer) /* height */);
-	pixman_image_set_transform(po->hw_buffer, NULL);
+				 pixman_image_get_width (src), /* width */
+				 pixman_image_get_height (src) /* height */);
+	pixman_image_set_transform(src, NULL);
 
 	pixman_image_unref(out_buf);
 
@@ -145,7 +215,7 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	struct pixman_renderer *pr =
 		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_composite_op *op;
 	pixman_region32_t final_region;
 	float view_x, view_y;
 	pixman_transform_t transform;
@@ -178,8 +248,10 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	/* Convert from global to output coord */
 	region_global_to_output(output, &final_region);
 
-	/* And clip to it */
-	pixman_image_set_clip_region32 (po->shadow_image, &final_region);
+	if (!pixman_region32_not_empty(&final_region)) {
+		pixman_region32_fini(&final_region);
+		return;
+	}
 
 	/* Set up the source transformation based on the surface
 	   position, the output position/transform/scale and the client
@@ -316,43 +388,258 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		break;
 	}
 
-	pixman_image_set_transform(ps->image, &transform);
+	op = wl_array_add(&pr->ops, sizeof *op);
+	if (!op) {
+		pixman_region32_fini(&final_region);
+		return;
+	}
+
+	op->region = final_region;
+	op->op = pixman_op;
+	op->transform = transform;
 
 	if (ev->transform.enabled || output->current_scale != ev->surface->buffer_viewport.scale)
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
+		op->filter = PIXMAN_FILTER_BILINEAR;
 	else
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_NEAREST, NULL, 0);
+		op->filter = PIXMAN_FILTER_NEAREST;
 
+	op->shm_buffer = NULL;
 	if (ps->buffer_ref.buffer)
-		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
+		op->shm_buffer = ps->buffer_ref.buffer->shm_buffer;
+
+	op->bits = pixman_image_get_data(ps->image);
+	if (op->bits) {
+		op->format = pixman_image_get_format(ps->image);
+		op->width = pixman_image_get_width(ps->image);
+		op->height = pixman_image_get_height(ps->image);
+		op->stride = pixman_image_get_stride(ps->image);
+	} else {
+		op->color = ps->color;
+	}
+}
 
-	pixman_image_composite32(pixman_op,
-				 ps->image, /* src */
-				 NULL /* mask */,
-				 po->shadow_image, /* dest */
-				 0, 0, /* src_x, src_y */
-				 0, 0, /* mask_x, mask_y */
-				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->shadow_image), /* width */
-				 pixman_image_get_height (po->shadow_image) /* height */);
+static pixman_image_t *
+composite_op_create_source(struct pixman_composite_op *op)
+{
+	pixman_image_t *image;
 
-	if (ps->buffer_ref.buffer)
-		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
+	if (op->bits)
+		image = pixman_image_create_bits(op->format,
+						 op->width, op->height,
+						 op->bits, op->stride);
+	else
+		image = pixman_image_create_solid_fill(&op->color);
 
-	if (pr->repaint_debug)
-		pixman_image_composite32(PIXMAN_OP_OVER,
-					 pr->debug_color, /* src */
+	if (!image)
+		return NULL;
+
+	pixman_image_set_transform(image, &op->transform);
+	pixman_image_set_filter(image, op->filter, NULL, 0);
+
+	return image;
+}
+
+/* Replay every recorded op, back to front, clipped to the band of rows
+ * [y1, y2). Each destination pixel only depends on the source and on
+ * its own previous value, so the result is the same as compositing the
+ * whole output at once. */
+static void
+composite_tile(struct pixman_tile_job *job, pixman_image_t *dest,
+	       pixman_image_t *debug_color, int y1, int y2)
+{
+	struct pixman_composite_op *op;
+	pixman_region32_t clip;
+	pixman_image_t *src;
+	int i;
+
+	pixman_region32_init(&clip);
+
+	for (i = 0; i < job->op_count; i++) {
+		op = &job->ops[i];
+
+		pixman_region32_intersect_rect(&clip, &op->region,
+					       0, y1, job->width, y2 - y1);
+		if (!pixman_region32_not_empty(&clip))
+			continue;
+
+		src = composite_op_create_source(op);
+		if (!src)
+			continue;
+
+		pixman_image_set_clip_region32(dest, &clip);
+
+		if (op->shm_buffer)
+			wl_shm_buffer_begin_access(op->shm_buffer);
+
+		pixman_image_composite32(op->op,
+					 src, /* src */
 					 NULL /* mask */,
-					 po->shadow_image, /* dest */
+					 dest, /* dest */
 					 0, 0, /* src_x, src_y */
 					 0, 0, /* mask_x, mask_y */
 					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
+					 job->width, /* width */
+					 job->height /* height */);
+
+		if (op->shm_buffer)
+			wl_shm_buffer_end_access(op->shm_buffer);
+
+		if (debug_color)
+			pixman_image_composite32(PIXMAN_OP_OVER,
+						 debug_color, /* src */
+						 NULL /* mask */,
+						 dest, /* dest */
+						 0, 0, /* src_x, src_y */
+						 0, 0, /* mask_x, mask_y */
+						 0, 0, /* dest_x, dest_y */
+						 job->width, /* width */
+						 job->height /* height */);
+
+		pixman_image_unref(src);
+	}
+
+	pixman_region32_fini(&clip);
+}
+
+/* Pull tiles off the job until none are left. Runs on the main thread
+ * and on every worker, each with its own destination image over the
+ * shared shadow buffer. */
+static void
+run_tile_job(struct pixman_worker_pool *pool, struct pixman_tile_job *job)
+{
+	pixman_image_t *dest, *debug_color = NULL;
+	int tile, y1, y2;
+
+	dest = pixman_image_create_bits(job->format,
+					job->width, job->height,
+					job->bits, job->stride);
+	if (!dest)
+		return;
+
+	if (job->repaint_debug)
+		debug_color = pixman_image_create_solid_fill(&debug_red);
+
+	for (;;) {
+		pthread_mutex_lock(&pool->mutex);
+		tile = job->next_tile++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (tile >= job->tile_count)
+			break;
+
+		y1 = tile * PIXMAN_TILE_HEIGHT;
+		y2 = y1 + PIXMAN_TILE_HEIGHT;
+		if (y2 > job->height)
+			y2 = job->height;
+
+		composite_tile(job, dest, debug_color, y1, y2);
+	}
+
+	if (debug_color)
+		pixman_image_unref(debug_color);
+	pixman_image_unref(dest);
+}
+
+static void *
+worker_thread(void *data)
+{
+	struct pixman_worker_pool *pool = data;
+	uint32_t generation = 0;
+	struct pixman_tile_job *job;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+
+		if (pool->quit)
+			break;
+
+		generation = pool->generation;
+		job = pool->job;
+		pthread_mutex_unlock(&pool->mutex);
+
+		run_tile_job(pool, job);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
 
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+static void
+worker_pool_run(struct pixman_worker_pool *pool, struct pixman_tile_job *job)
+{
+	if (pool->thread_count > 0) {
+		pthread_mutex_lock(&pool->mutex);
+		pool->job = job;
+		pool->busy = pool->thread_count;
+		pool->generation++;
+		pthread_cond_broadcast(&pool->work_cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	run_tile_job(pool, job);
+
+	if (pool->thread_count > 0) {
+		pthread_mutex_lock(&pool->mutex);
+		while (pool->busy > 0)
+			pthread_cond_wait(&pool->done_cond, &pool->mutex);
+		pool->job = NULL;
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+static int
+worker_pool_init(struct pixman_worker_pool *pool, int thread_count)
+{
+	int i;
 
-	pixman_region32_fini(&final_region);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	pool->thread_count = 0;
+	if (thread_count <= 0)
+		return 0;
+
+	pool->threads = calloc(thread_count, sizeof *pool->threads);
+	if (!pool->threads)
+		return -1;
+
+	for (i = 0; i < thread_count; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   worker_thread, pool) != 0) {
+			weston_log("pixman renderer: failed to start worker "
+				   "thread, using %d\n", i);
+			break;
+		}
+		pool->thread_count++;
+	}
+
+	return 0;
+}
+
+static void
+worker_pool_release(struct pixman_worker_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->thread_count; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	free(pool->threads);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
 }
 
 static void
@@ -410,11 +697,39 @@ static void
 repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
+	struct pixman_renderer *pr = get_renderer(compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	pixman_image_t *target = po->direct ? po->hw_buffer : po->shadow_image;
 	struct weston_view *view;
+	struct pixman_composite_op *op;
+	struct pixman_tile_job job;
+
+	pr->ops.size = 0;
 
 	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
+		if (view->plane == &compositor->primary_plane &&
+		    !view->occluded)
 			draw_view(view, output, damage);
+
+	if (pr->ops.size == 0)
+		return;
+
+	job.ops = pr->ops.data;
+	job.op_count = pr->ops.size / sizeof *op;
+	job.repaint_debug = pr->repaint_debug;
+	job.format = pixman_image_get_format(target);
+	job.bits = pixman_image_get_data(target);
+	job.width = pixman_image_get_width(target);
+	job.height = pixman_image_get_height(target);
+	job.stride = pixman_image_get_stride(target);
+	job.tile_count = (job.height + PIXMAN_TILE_HEIGHT - 1) /
+		PIXMAN_TILE_HEIGHT;
+	job.next_tile = 0;
+
+	worker_pool_run(&pr->pool, &job);
+
+	wl_array_for_each(op, &pr->ops)
+		pixman_region32_fini(&op->region);
 }
 
 static void
@@ -443,17 +758,72 @@ copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
 }
 
+/* Add to buffer_damage whatever changed since hw_buffer was last
+ * rendered to, or the whole output if it is not in the history. */
+static void
+output_get_buffer_damage(struct weston_output *output,
+			 pixman_region32_t *buffer_damage)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	int i;
+
+	for (i = 0; i < BUFFER_HISTORY_COUNT && po->history_buffer[i]; i++) {
+		if (po->history_buffer[i] == po->hw_buffer)
+			return;
+
+		pixman_region32_union(buffer_damage, buffer_damage,
+				      &po->history_damage[i]);
+	}
+
+	pixman_region32_copy(buffer_damage, &output->region);
+}
+
+static void
+output_rotate_damage(struct weston_output *output,
+		     pixman_region32_t *output_damage)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	int i;
+
+	/* The history keeps a reference so that a freed buffer can't be
+	 * mistaken for a new one allocated at the same address. */
+	if (po->history_buffer[BUFFER_HISTORY_COUNT - 1])
+		pixman_image_unref(po->history_buffer[BUFFER_HISTORY_COUNT - 1]);
+
+	for (i = BUFFER_HISTORY_COUNT - 1; i >= 1; i--) {
+		po->history_buffer[i] = po->history_buffer[i - 1];
+		pixman_region32_copy(&po->history_damage[i],
+				     &po->history_damage[i - 1]);
+	}
+
+	po->history_buffer[0] = pixman_image_ref(po->hw_buffer);
+	pixman_region32_copy(&po->history_damage[0], output_damage);
+}
+
 static void
 pixman_renderer_repaint_output(struct weston_output *output,
 			     pixman_region32_t *output_damage)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	pixman_region32_t total_damage;
 
 	if (!po->hw_buffer)
 		return;
 
-	repaint_surfaces(output, output_damage);
-	copy_to_hw_buffer(output, output_damage);
+	if (po->direct) {
+		pixman_region32_init(&total_damage);
+		output_get_buffer_damage(output, &total_damage);
+		output_rotate_damage(output, output_damage);
+		pixman_region32_union(&total_damage,
+				      &total_damage, output_damage);
+
+		repaint_surfaces(output, &total_damage);
+
+		pixman_region32_fini(&total_damage);
+	} else {
+		repaint_surfaces(output, output_damage);
+		copy_to_hw_buffer(output, output_damage);
+	}
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
@@ -602,6 +972,7 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 		ps->image = NULL;
 	}
 
+	ps->color = color;
 	ps->image = pixman_image_create_solid_fill(&color);
 }
 
@@ -612,6 +983,8 @@ pixman_renderer_destroy(struct weston_compositor *ec)
 
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
+	worker_pool_release(&pr->pool);
+	wl_array_release(&pr->ops);
 	free(pr);
 
 	ec->renderer = NULL;
@@ -626,16 +999,32 @@ debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 
 	pr->repaint_debug ^= 1;
 
-	if (pr->repaint_debug) {
-		pixman_color_t red = {
-			0x3fff, 0x0000, 0x0000, 0x3fff
-		};
-
-		pr->debug_color = pixman_image_create_solid_fill(&red);
-	} else {
-		pixman_image_unref(pr->debug_color);
+	if (!pr->repaint_debug)
 		weston_compositor_damage_all(ec);
-	}
+}
+
+static int
+pixman_renderer_get_thread_count(struct weston_compositor *ec)
+{
+	struct weston_config_section *section;
+	long cpus;
+	int threads;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+	if (cpus > PIXMAN_MAX_THREADS)
+		cpus = PIXMAN_MAX_THREADS;
+
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_int(section, "pixman-threads",
+				      &threads, cpus);
+	if (threads < 1)
+		threads = 1;
+	if (threads > PIXMAN_MAX_THREADS)
+		threads = PIXMAN_MAX_THREADS;
+
+	return threads;
 }
 
 WL_EXPORT int
@@ -647,8 +1036,16 @@ pixman_renderer_init(struct weston_compositor *ec)
 	if (renderer == NULL)
 		return -1;
 
+	/* The main thread takes part in compositing, so start one
+	 * worker fewer than the requested thread count. */
+	wl_array_init(&renderer->ops);
+	if (worker_pool_init(&renderer->pool,
+			     pixman_renderer_get_thread_count(ec) - 1) < 0) {
+		free(renderer);
+		return -1;
+	}
+
 	renderer->repaint_debug = 0;
-	renderer->debug_color = NULL;
 	renderer->base.read_pixels = pixman_renderer_read_pixels;
 	renderer->base.repaint_output = pixman_renderer_repaint_output;
 	renderer->base.flush_damage = pixman_renderer_flush_damage;
@@ -675,10 +1072,23 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 {
 	struct pixman_output_state *po = get_output_state(output);
 
+	int i;
+
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
 	po->hw_buffer = buffer;
 
+	/* Clearing the buffer means the old ones are going away, so the
+	 * history can't vouch for their contents any more. */
+	if (!buffer) {
+		for (i = 0; i < BUFFER_HISTORY_COUNT; i++) {
+			if (po->history_buffer[i])
+				pixman_image_unref(po->history_buffer[i]);
+			po->history_buffer[i] = NULL;
+			pixman_region32_clear(&po->history_damage[i]);
+		}
+	}
+
 	if (po->hw_buffer) {
 		output->compositor->read_format = pixman_image_get_format(po->hw_buffer);
 		pixman_image_ref(po->hw_buffer);
@@ -686,14 +1096,25 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 }
 
 WL_EXPORT int
-pixman_renderer_output_create(struct weston_output *output)
+pixman_renderer_output_create_with_flags(struct weston_output *output,
+					 uint32_t flags)
 {
 	struct pixman_output_state *po = calloc(1, sizeof *po);
-	int w, h;
+	int w, h, i;
 
 	if (!po)
 		return -1;
 
+	for (i = 0; i < BUFFER_HISTORY_COUNT; i++)
+		pixman_region32_init(&po->history_damage[i]);
+
+	if (flags & PIXMAN_RENDERER_OUTPUT_DIRECT) {
+		po->direct = 1;
+		output->renderer_state = po;
+
+		return 0;
+	}
+
 	/* set shadow image transformation */
 	w = output->current_mode->width;
 	h = output->current_mode->height;
@@ -720,12 +1141,26 @@ pixman_renderer_output_create(struct weston_output *output)
 	return 0;
 }
 
+WL_EXPORT int
+pixman_renderer_output_create(struct weston_output *output)
+{
+	return pixman_renderer_output_create_with_flags(output, 0);
+}
+
 WL_EXPORT void
 pixman_renderer_output_destroy(struct weston_output *output)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	int i;
+
+	for (i = 0; i < BUFFER_HISTORY_COUNT; i++) {
+		if (po->history_buffer[i])
+			pixman_image_unref(po->history_buffer[i]);
+		pixman_region32_fini(&po->history_damage[i]);
+	}
 
-	pixman_image_unref(po->shadow_image);
+	if (po->shadow_image)
+		pixman_image_unref(po->shadow_image);
 
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
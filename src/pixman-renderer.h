@@ -27,9 +27,21 @@
 int
 pixman_renderer_init(struct weston_compositor *ec);
 
+enum pixman_renderer_output_flags {
+	/* Composite straight into the buffer given to
+	 * pixman_renderer_output_set_buffer() instead of into a shadow
+	 * image that is copied to it. The buffer is read back for
+	 * blending, so it should live in cached memory. */
+	PIXMAN_RENDERER_OUTPUT_DIRECT = (1 << 0),
+};
+
 int
 pixman_renderer_output_create(struct weston_output *output);
 
+int
+pixman_renderer_output_create_with_flags(struct weston_output *output,
+					 uint32_t flags);
+
 void
 pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *buffer);
 
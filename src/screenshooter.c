@@ -28,7 +28,13 @@
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/uio.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "compositor.h"
 #include "screenshooter-server-protocol.h"
@@ -260,14 +266,80 @@ screenshooter_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 					screenshooter_exe, screenshooter_sigchld);
 }
 
+/* Frames queued between the output repaint and the encoder thread. */
+#define RECORDER_QUEUE_SIZE 4
+/* Damage rectangles are cut into bands of this many rows, which are
+ * delta and RLE encoded in parallel. */
+#define RECORDER_BAND_ROWS 32
+#define RECORDER_MAX_THREADS 4
+#define RECORDER_WRITE_BUFFER_SIZE (256 * 1024)
+/* Every so often the whole output is coded against black, so that
+ * decoders can start there instead of at the beginning of the file. */
+#define RECORDER_KEYFRAME_INTERVAL 2000	/* msecs */
+
+/* The damage of one repaint, as read back on the main thread. */
+struct recorder_frame {
+	uint32_t msecs;
+	int key;
+	int nrects;
+	pixman_box32_t *rects;
+	int rects_size;
+	uint32_t *pixels;		/* all rectangles, back to back */
+	size_t pixels_size;
+};
+
+/* One band of rows of a rectangle. The first and last runs are left
+ * unencoded, so that runs spanning two bands can be merged and the
+ * file comes out exactly as if the rectangle was encoded in one go. */
+struct recorder_band {
+	int rect, width;
+	int j1, j2;			/* rows within the rectangle */
+	uint32_t *src;
+
+	uint32_t *words;
+	size_t words_size;
+	int nwords;
+	int single;
+	uint32_t head_delta, tail_delta;
+	int head_run, tail_run;
+};
+
 struct weston_recorder {
 	struct weston_output *output;
-	uint32_t *frame, *rect;
-	uint32_t *tmpbuf;
-	uint32_t total;
+	uint32_t *frame;
+	uint64_t total;
 	int fd;
 	struct wl_listener frame_listener;
 	int count, destroying;
+	int do_yflip;
+	int width, height;
+	uint32_t key_msecs;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t frame_ready;
+	pthread_cond_t slot_free;
+	struct recorder_frame queue[RECORDER_QUEUE_SIZE];
+	uint32_t head, tail;		/* protected by mutex */
+	int stopping;
+
+	/* Only touched by the encoder threads from here on. */
+	struct recorder_band *bands;
+	int band_count, bands_size;
+
+	pthread_t helpers[RECORDER_MAX_THREADS - 1];
+	int helper_count;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	uint32_t generation;
+	int next_band, busy, quit;
+
+	uint8_t *wbuf;
+	size_t wbuf_len;
+
+	struct wcap_index_entry *index;
+	uint32_t index_count, index_size;
+	int index_failed;
 };
 
 static uint32_t *
@@ -301,6 +373,46 @@ component_delta(uint32_t next, uint32_t prev)
 	return (dr << 16) | (dg << 8) | (db << 0);
 }
 
+/* component_delta() over a row, replacing prev with next. The deltas
+ * are just bytewise differences with the top byte cleared, which maps
+ * directly onto packed 8-bit subtraction. */
+static void
+component_delta_row(uint32_t *delta, const uint32_t *next,
+		    uint32_t *prev, int width)
+{
+	int k = 0;
+
+#if defined(__SSE2__)
+	const __m128i mask = _mm_set1_epi32(0x00ffffff);
+	__m128i n, p;
+
+	for (; k + 4 <= width; k += 4) {
+		n = _mm_loadu_si128((const __m128i *) (next + k));
+		p = _mm_loadu_si128((const __m128i *) (prev + k));
+		_mm_storeu_si128((__m128i *) (delta + k),
+				 _mm_and_si128(_mm_sub_epi8(n, p), mask));
+		_mm_storeu_si128((__m128i *) (prev + k), n);
+	}
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+	const uint32x4_t mask = vdupq_n_u32(0x00ffffff);
+	uint8x16_t n, p;
+
+	for (; k + 4 <= width; k += 4) {
+		n = vld1q_u8((const uint8_t *) (next + k));
+		p = vld1q_u8((const uint8_t *) (prev + k));
+		vst1q_u32(delta + k,
+			  vandq_u32(vreinterpretq_u32_u8(vsubq_u8(n, p)),
+				    mask));
+		vst1q_u8((uint8_t *) (prev + k), n);
+	}
+#endif
+
+	for (; k < width; k++) {
+		delta[k] = component_delta(next[k], prev[k]);
+		prev[k] = next[k];
+	}
+}
+
 static void
 transform_rect(struct weston_output *output, pixman_box32_t *r)
 {
@@ -355,6 +467,379 @@ transform_rect(struct weston_output *output, pixman_box32_t *r)
 	r->y2 *= output->current_scale;
 }
 
+static void
+recorder_encode_band(struct weston_recorder *recorder,
+		     struct recorder_frame *frame, struct recorder_band *band)
+{
+	pixman_box32_t *r = &frame->rects[band->rect];
+	uint32_t *delta = band->words, *p = band->words, *d;
+	uint32_t prev = 0, next;
+	int j, k, y, count, run = 0, head_done = 0;
+
+	for (j = band->j1; j < band->j2; j++) {
+		if (recorder->do_yflip)
+			y = r->y2 - j - 1;
+		else
+			y = r->y1 + j;
+		d = recorder->frame + recorder->width * y + r->x1;
+
+		component_delta_row(delta + (j - band->j1) * band->width,
+				    band->src + (j - band->j1) * band->width,
+				    d, band->width);
+	}
+
+	/* RLE in place: a run is never encoded into more words than it
+	 * has pixels, so the output stays behind the deltas still to be
+	 * read. */
+	count = band->width * (band->j2 - band->j1);
+	for (k = 0; k < count; k++) {
+		next = delta[k];
+		if (run == 0 || next == prev) {
+			run++;
+		} else {
+			if (head_done) {
+				p = output_run(p, prev, run);
+			} else {
+				band->head_delta = prev;
+				band->head_run = run;
+				head_done = 1;
+			}
+			run = 1;
+		}
+		prev = next;
+	}
+
+	band->single = !head_done;
+	if (band->single) {
+		band->head_delta = prev;
+		band->head_run = run;
+	}
+	band->tail_delta = prev;
+	band->tail_run = run;
+	band->nwords = p - band->words;
+}
+
+static void
+recorder_flush(struct weston_recorder *recorder)
+{
+	ssize_t ret;
+	size_t done = 0;
+
+	while (done < recorder->wbuf_len) {
+		ret = write(recorder->fd, recorder->wbuf + done,
+			    recorder->wbuf_len - done);
+		if (ret <= 0)
+			break;
+		done += ret;
+	}
+
+	recorder->total += done;
+	recorder->wbuf_len = 0;
+}
+
+static void
+recorder_write(struct weston_recorder *recorder, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	size_t n;
+
+	while (size > 0) {
+		if (recorder->wbuf_len == RECORDER_WRITE_BUFFER_SIZE)
+			recorder_flush(recorder);
+
+		n = RECORDER_WRITE_BUFFER_SIZE - recorder->wbuf_len;
+		if (n > size)
+			n = size;
+		memcpy(recorder->wbuf + recorder->wbuf_len, p, n);
+		recorder->wbuf_len += n;
+		p += n;
+		size -= n;
+	}
+}
+
+static void
+recorder_write_run(struct weston_recorder *recorder, uint32_t delta, int run)
+{
+	/* A run of up to 2^31 pixels takes at most 24 words. */
+	uint32_t words[32], *p;
+
+	p = output_run(words, delta, run);
+	recorder_write(recorder, words, (p - words) * 4);
+}
+
+static void
+recorder_run_bands(struct weston_recorder *recorder,
+		   struct recorder_frame *frame)
+{
+	int band;
+
+	for (;;) {
+		pthread_mutex_lock(&recorder->mutex);
+		band = recorder->next_band++;
+		pthread_mutex_unlock(&recorder->mutex);
+
+		if (band >= recorder->band_count)
+			break;
+
+		recorder_encode_band(recorder, frame, &recorder->bands[band]);
+	}
+}
+
+static void *
+recorder_helper_thread(void *data)
+{
+	struct weston_recorder *recorder = data;
+	uint32_t generation = 0;
+	struct recorder_frame *frame;
+
+	pthread_mutex_lock(&recorder->mutex);
+	for (;;) {
+		while (!recorder->quit && recorder->generation == generation)
+			pthread_cond_wait(&recorder->work_cond,
+					  &recorder->mutex);
+
+		if (recorder->quit)
+			break;
+
+		generation = recorder->generation;
+		frame = &recorder->queue[recorder->tail % RECORDER_QUEUE_SIZE];
+		pthread_mutex_unlock(&recorder->mutex);
+
+		recorder_run_bands(recorder, frame);
+
+		pthread_mutex_lock(&recorder->mutex);
+		if (--recorder->busy == 0)
+			pthread_cond_signal(&recorder->done_cond);
+	}
+	pthread_mutex_unlock(&recorder->mutex);
+
+	return NULL;
+}
+
+static int
+recorder_prepare_bands(struct weston_recorder *recorder,
+		       struct recorder_frame *frame)
+{
+	struct recorder_band *band;
+	uint32_t *src = frame->pixels;
+	size_t size;
+	int i, j, width, height, count = 0;
+
+	for (i = 0; i < frame->nrects; i++) {
+		height = frame->rects[i].y2 - frame->rects[i].y1;
+		count += (height + RECORDER_BAND_ROWS - 1) / RECORDER_BAND_ROWS;
+	}
+
+	if (count > recorder->bands_size) {
+		band = realloc(recorder->bands, count * sizeof *band);
+		if (!band)
+			return -1;
+		memset(band + recorder->bands_size, 0,
+		       (count - recorder->bands_size) * sizeof *band);
+		recorder->bands = band;
+		recorder->bands_size = count;
+	}
+
+	band = recorder->bands;
+	for (i = 0; i < frame->nrects; i++) {
+		width = frame->rects[i].x2 - frame->rects[i].x1;
+		height = frame->rects[i].y2 - frame->rects[i].y1;
+
+		for (j = 0; j < height; j += RECORDER_BAND_ROWS, band++) {
+			band->rect = i;
+			band->width = width;
+			band->j1 = j;
+			band->j2 = j + RECORDER_BAND_ROWS;
+			if (band->j2 > height)
+				band->j2 = height;
+			band->src = src + j * width;
+
+			size = width * (band->j2 - band->j1);
+			if (size > band->words_size) {
+				free(band->words);
+				band->words = malloc(size * 4);
+				if (!band->words) {
+					band->words_size = 0;
+					return -1;
+				}
+				band->words_size = size;
+			}
+		}
+
+		src += width * height;
+	}
+
+	recorder->band_count = count;
+
+	return 0;
+}
+
+static void
+recorder_index_frame(struct weston_recorder *recorder,
+		     struct recorder_frame *frame)
+{
+	struct wcap_index_entry *entry;
+	uint64_t offset;
+	uint32_t size;
+
+	if (recorder->index_failed)
+		return;
+
+	if (recorder->index_count == recorder->index_size) {
+		size = recorder->index_size ? recorder->index_size * 2 : 1024;
+		entry = realloc(recorder->index, size * sizeof *entry);
+		if (!entry) {
+			/* wcap-decode rebuilds a missing index. */
+			weston_log("recorder: out of memory, "
+				   "not writing frame index\n");
+			recorder->index_failed = 1;
+			return;
+		}
+		recorder->index = entry;
+		recorder->index_size = size;
+	}
+
+	offset = recorder->total + recorder->wbuf_len;
+	entry = &recorder->index[recorder->index_count++];
+	entry->offset_lo = offset;
+	entry->offset_hi = offset >> 32;
+	entry->msecs = frame->msecs;
+	entry->flags = frame->key ? WCAP_INDEX_KEY : 0;
+}
+
+static void
+recorder_write_index(struct weston_recorder *recorder)
+{
+	struct wcap_index_trailer trailer;
+	uint64_t offset;
+
+	if (recorder->index_failed)
+		return;
+
+	offset = recorder->total + recorder->wbuf_len;
+	recorder_write(recorder, recorder->index,
+		       recorder->index_count * sizeof *recorder->index);
+
+	trailer.offset_lo = offset;
+	trailer.offset_hi = offset >> 32;
+	trailer.count = recorder->index_count;
+	trailer.magic = WCAP_INDEX_MAGIC;
+	recorder_write(recorder, &trailer, sizeof trailer);
+}
+
+static void
+recorder_encode_frame(struct weston_recorder *recorder,
+		      struct recorder_frame *frame)
+{
+	struct recorder_band *band;
+	struct {
+		uint32_t msecs;
+		uint32_t nrects;
+	} header;
+	uint32_t carry_delta = 0;
+	int i, carry_run = 0;
+
+	if (recorder_prepare_bands(recorder, frame) < 0) {
+		weston_log("recorder: out of memory, frame dropped\n");
+		return;
+	}
+
+	if (frame->key)
+		memset(recorder->frame, 0,
+		       recorder->width * recorder->height * 4);
+
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->next_band = 0;
+	if (recorder->helper_count > 0) {
+		recorder->busy = recorder->helper_count;
+		recorder->generation++;
+		pthread_cond_broadcast(&recorder->work_cond);
+	}
+	pthread_mutex_unlock(&recorder->mutex);
+
+	recorder_run_bands(recorder, frame);
+
+	pthread_mutex_lock(&recorder->mutex);
+	while (recorder->busy > 0)
+		pthread_cond_wait(&recorder->done_cond, &recorder->mutex);
+	pthread_mutex_unlock(&recorder->mutex);
+
+	recorder_index_frame(recorder, frame);
+
+	header.msecs = frame->msecs;
+	header.nrects = frame->nrects;
+	if (frame->key)
+		header.nrects |= WCAP_FRAME_KEY;
+	recorder_write(recorder, &header, sizeof header);
+	recorder_write(recorder, frame->rects,
+		       frame->nrects * sizeof *frame->rects);
+
+	for (i = 0; i < recorder->band_count; i++) {
+		band = &recorder->bands[i];
+
+		if (carry_run > 0 && band->head_delta == carry_delta) {
+			carry_run += band->head_run;
+		} else {
+			recorder_write_run(recorder, carry_delta, carry_run);
+			carry_delta = band->head_delta;
+			carry_run = band->head_run;
+		}
+
+		if (!band->single) {
+			recorder_write_run(recorder, carry_delta, carry_run);
+			recorder_write(recorder, band->words, band->nwords * 4);
+			carry_delta = band->tail_delta;
+			carry_run = band->tail_run;
+		}
+
+		/* Runs never continue into the next rectangle. */
+		if (i + 1 == recorder->band_count ||
+		    band[1].rect != band->rect) {
+			recorder_write_run(recorder, carry_delta, carry_run);
+			carry_run = 0;
+		}
+	}
+}
+
+static void *
+recorder_thread(void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct recorder_frame *frame;
+	int i;
+
+	pthread_mutex_lock(&recorder->mutex);
+	for (;;) {
+		while (recorder->head == recorder->tail && !recorder->stopping)
+			pthread_cond_wait(&recorder->frame_ready,
+					  &recorder->mutex);
+
+		if (recorder->head == recorder->tail)
+			break;
+
+		frame = &recorder->queue[recorder->tail % RECORDER_QUEUE_SIZE];
+		pthread_mutex_unlock(&recorder->mutex);
+
+		recorder_encode_frame(recorder, frame);
+
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->tail++;
+		pthread_cond_signal(&recorder->slot_free);
+	}
+
+	recorder->quit = 1;
+	pthread_cond_broadcast(&recorder->work_cond);
+	pthread_mutex_unlock(&recorder->mutex);
+
+	for (i = 0; i < recorder->helper_count; i++)
+		pthread_join(recorder->helpers[i], NULL);
+
+	recorder_write_index(recorder);
+	recorder_flush(recorder);
+
+	return NULL;
+}
+
 static void
 weston_recorder_destroy(struct weston_recorder *recorder);
 
@@ -365,105 +850,140 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 		container_of(listener, struct weston_recorder, frame_listener);
 	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
-	uint32_t msecs = output->frame_time;
-	pixman_box32_t *r;
+	struct recorder_frame *frame;
+	pixman_box32_t *r, *rects, full;
 	pixman_region32_t damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
-	struct iovec v[2];
-	int do_yflip;
-	int y_orig;
-	uint32_t *outbuf;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
+	int i, n, width, height, y_orig, key;
+	size_t size;
+	uint32_t *pixels;
 
 	pixman_region32_init(&damage);
 	pixman_region32_intersect(&damage, &output->region,
 				  &output->previous_damage);
 
-	r = pixman_region32_rectangles(&damage, &n);
+	rects = pixman_region32_rectangles(&damage, &n);
 	if (n == 0)
-		return;
+		goto out;
+
+	key = recorder->count == 0 ||
+		output->frame_time - recorder->key_msecs >=
+		RECORDER_KEYFRAME_INTERVAL;
+	if (key) {
+		full.x1 = 0;
+		full.y1 = 0;
+		full.x2 = recorder->width;
+		full.y2 = recorder->height;
+		rects = &full;
+		n = 1;
+	}
 
-	for (i = 0; i < n; i++)
-		transform_rect(output, &r[i]);
+	for (i = 0, size = 0; i < n; i++) {
+		if (!key)
+			transform_rect(output, &rects[i]);
+		size += (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+	}
 
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
+	/* Wait for the encoder if it has fallen a whole queue behind;
+	 * dropping a frame would corrupt every delta after it. */
+	pthread_mutex_lock(&recorder->mutex);
+	while (recorder->head - recorder->tail == RECORDER_QUEUE_SIZE)
+		pthread_cond_wait(&recorder->slot_free, &recorder->mutex);
+	pthread_mutex_unlock(&recorder->mutex);
+
+	frame = &recorder->queue[recorder->head % RECORDER_QUEUE_SIZE];
+
+	if (n > frame->rects_size) {
+		r = realloc(frame->rects, n * sizeof *r);
+		if (!r)
+			goto out;
+		frame->rects = r;
+		frame->rects_size = n;
+	}
+	if (size > frame->pixels_size) {
+		pixels = realloc(frame->pixels, size * 4);
+		if (!pixels)
+			goto out;
+		frame->pixels = pixels;
+		frame->pixels_size = size;
+	}
+
+	frame->msecs = output->frame_time;
+	frame->key = key;
+	frame->nrects = n;
+	memcpy(frame->rects, rects, n * sizeof *r);
 
+	pixels = frame->pixels;
 	for (i = 0; i < n; i++) {
-		width = r[i].x2 - r[i].x1;
-		height = r[i].y2 - r[i].y1;
+		r = &frame->rects[i];
+		width = r->x2 - r->x1;
+		height = r->y2 - r->y1;
 
-		if (do_yflip)
-			y_orig = output->current_mode->height - r[i].y2;
+		if (recorder->do_yflip)
+			y_orig = output->current_mode->height - r->y2;
 		else
-			y_orig = r[i].y1;
+			y_orig = r->y1;
 
 		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
-				r[i].x1, y_orig, width, height);
-
-		s = recorder->rect;
-		p = outbuf;
-		run = prev = 0; /* quiet gcc */
-		for (j = 0; j < height; j++) {
-			if (do_yflip)
-				y_orig = r[i].y2 - j - 1;
-			else
-				y_orig = r[i].y1 + j;
-			d = recorder->frame + stride * y_orig + r[i].x1;
-
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
-		}
-
-		p = output_run(p, prev, run);
+				compositor->read_format, pixels,
+				r->x1, y_orig, width, height);
+		pixels += width * height;
+	}
 
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->head++;
+	pthread_cond_signal(&recorder->frame_ready);
+	pthread_mutex_unlock(&recorder->mutex);
 
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - outbuf) * 4,
-			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
-	}
+	recorder->count++;
+	if (key)
+		recorder->key_msecs = frame->msecs;
 
+out:
 	pixman_region32_fini(&damage);
-	recorder->count++;
 
 	if (recorder->destroying)
 		weston_recorder_destroy(recorder);
 }
 
+static int
+weston_recorder_start_threads(struct weston_recorder *recorder)
+{
+	long cpus;
+	int i;
+
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->frame_ready, NULL);
+	pthread_cond_init(&recorder->slot_free, NULL);
+	pthread_cond_init(&recorder->work_cond, NULL);
+	pthread_cond_init(&recorder->done_cond, NULL);
+
+	/* Leave a core to the compositor itself. */
+	cpus = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if (cpus > RECORDER_MAX_THREADS)
+		cpus = RECORDER_MAX_THREADS;
+
+	for (i = 0; i < cpus - 1; i++) {
+		if (pthread_create(&recorder->helpers[i], NULL,
+				   recorder_helper_thread, recorder) != 0)
+			break;
+		recorder->helper_count++;
+	}
+
+	if (pthread_create(&recorder->thread, NULL,
+			   recorder_thread, recorder) != 0) {
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->quit = 1;
+		pthread_cond_broadcast(&recorder->work_cond);
+		pthread_mutex_unlock(&recorder->mutex);
+		for (i = 0; i < recorder->helper_count; i++)
+			pthread_join(recorder->helpers[i], NULL);
+		return -1;
+	}
+
+	return 0;
+}
+
 static void
 weston_recorder_create(struct weston_output *output, const char *filename)
 {
@@ -471,27 +991,25 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	struct weston_recorder *recorder;
 	int stride, size;
 	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
-	recorder = malloc(sizeof *recorder);
+	recorder = zalloc(sizeof *recorder);
+	if (recorder == NULL)
+		return;
 
 	stride = output->current_mode->width;
 	size = stride * 4 * output->current_mode->height;
 	recorder->frame = zalloc(size);
-	recorder->rect = malloc(size);
-	recorder->total = 0;
-	recorder->count = 0;
-	recorder->destroying = 0;
+	recorder->wbuf = malloc(RECORDER_WRITE_BUFFER_SIZE);
 	recorder->output = output;
+	recorder->width = output->current_mode->width;
+	recorder->height = output->current_mode->height;
+	recorder->do_yflip =
+		!!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
-	if (do_yflip)
-		recorder->tmpbuf = NULL;
-	else
-		recorder->tmpbuf = malloc(size);
+	if (!recorder->frame || !recorder->wbuf)
+		goto err_recorder;
 
-	header.magic = WCAP_HEADER_MAGIC;
+	header.magic = WCAP_HEADER_MAGIC_V2;
 
 	switch (compositor->read_format) {
 	case PIXMAN_x8r8g8b8:
@@ -503,8 +1021,7 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		break;
 	default:
 		weston_log("unknown recorder format\n");
-		free(recorder);
-		return;
+		goto err_recorder;
 	}
 
 	recorder->fd = open(filename,
@@ -512,28 +1029,68 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 
 	if (recorder->fd < 0) {
 		weston_log("problem opening output file %s: %m\n", filename);
-		free(recorder);
-		return;
+		goto err_recorder;
 	}
 
 	header.width = output->current_mode->width;
 	header.height = output->current_mode->height;
 	recorder->total += write(recorder->fd, &header, sizeof header);
 
+	if (weston_recorder_start_threads(recorder) < 0) {
+		weston_log("failed to start recorder thread\n");
+		close(recorder->fd);
+		goto err_recorder;
+	}
+
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
 	output->disable_planes++;
 	weston_output_damage(output);
+
+	return;
+
+err_recorder:
+	free(recorder->wbuf);
+	free(recorder->frame);
+	free(recorder);
 }
 
 static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
+	int i;
+
 	wl_list_remove(&recorder->frame_listener.link);
+
+	/* Let the encoder drain the queue and flush the file. */
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->stopping = 1;
+	pthread_cond_signal(&recorder->frame_ready);
+	pthread_mutex_unlock(&recorder->mutex);
+	pthread_join(recorder->thread, NULL);
+
+	weston_log("stopping recorder, total file size %dM, %d frames\n",
+		   (int) (recorder->total / (1024 * 1024)), recorder->count);
+
 	close(recorder->fd);
-	free(recorder->tmpbuf);
+
+	for (i = 0; i < RECORDER_QUEUE_SIZE; i++) {
+		free(recorder->queue[i].rects);
+		free(recorder->queue[i].pixels);
+	}
+	for (i = 0; i < recorder->bands_size; i++)
+		free(recorder->bands[i].words);
+	free(recorder->bands);
+	free(recorder->index);
+
+	pthread_cond_destroy(&recorder->done_cond);
+	pthread_cond_destroy(&recorder->work_cond);
+	pthread_cond_destroy(&recorder->slot_free);
+	pthread_cond_destroy(&recorder->frame_ready);
+	pthread_mutex_destroy(&recorder->mutex);
+
+	free(recorder->wbuf);
 	free(recorder->frame);
-	free(recorder->rect);
 	recorder->output->disable_planes--;
 	free(recorder);
 }
@@ -556,10 +1113,6 @@ recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *da
 		recorder = container_of(listener, struct weston_recorder,
 					frame_listener);
 
-		weston_log(
-			"stopping recorder, total file size %dM, %d frames\n",
-			recorder->total / (1024 * 1024), recorder->count);
-
 		recorder->destroying = 1;
 		weston_output_schedule_repaint(recorder->output);
 	} else {
@@ -116,6 +116,9 @@ device_added(struct udev_device *udev_device, struct udev_input *input)
 
 	wl_list_insert(seat->devices_list.prev, &device->link);
 
+	if (input->thread)
+		evdev_input_thread_add_device(input->thread, device);
+
 	if (seat->base.output && seat->base.pointer)
 		weston_pointer_clamp(seat->base.pointer,
 				     &seat->base.pointer->x,
@@ -219,6 +222,7 @@ evdev_udev_handler(int fd, uint32_t mask, void *data)
 				if (!strcmp(device->devnode, devnode)) {
 					weston_log("input device %s, %s removed\n",
 							device->devname, device->devnode);
+					evdev_input_thread_remove_device(device);
 					weston_launcher_close(input->compositor->launcher,
 							      device->fd);
 					evdev_device_destroy(device);
@@ -281,6 +285,7 @@ udev_input_remove_devices(struct udev_input *input)
 
 	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
 		wl_list_for_each_safe(device, next, &seat->devices_list, link) {
+			evdev_input_thread_remove_device(device);
 			weston_launcher_close(input->compositor->launcher,
 					      device->fd);
 			evdev_device_destroy(device);
@@ -306,19 +311,58 @@ udev_input_disable(struct udev_input *input)
 }
 
 
+static void
+input_stats_binding(struct weston_seat *seat_base, uint32_t time,
+		    uint32_t key, void *data)
+{
+	struct udev_input *input = data;
+	struct udev_seat *seat;
+	struct evdev_device *device;
+
+	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
+		wl_list_for_each(device, &seat->devices_list, link) {
+			if (device->stats.motion_frames == 0)
+				continue;
+			weston_log("input device %s: %u motion frames, "
+				   "%u merged into later ones\n",
+				   device->devname,
+				   device->stats.motion_frames,
+				   device->stats.motion_merged);
+		}
+	}
+}
+
 int
 udev_input_init(struct udev_input *input, struct weston_compositor *c, struct udev *udev,
 		const char *seat_id)
 {
+	struct weston_config_section *s;
+	int input_thread;
+
 	memset(input, 0, sizeof *input);
 	input->seat_id = strdup(seat_id);
 	input->compositor = c;
+
+	s = weston_config_get_section(c->config, "core", NULL, NULL);
+	weston_config_section_get_bool(s, "input-thread", &input_thread, 0);
+	if (input_thread) {
+		input->thread = evdev_input_thread_create(c);
+		if (!input->thread)
+			weston_log("failed to start input thread, "
+				   "reading input on the main loop\n");
+	}
+
 	if (udev_input_enable(input, udev) < 0)
 		goto err;
 
+	weston_compositor_add_debug_binding(c, KEY_I,
+					    input_stats_binding, input);
+
 	return 0;
 
  err:
+	if (input->thread)
+		evdev_input_thread_destroy(input->thread);
 	free(input->seat_id);
 	return -1;
 }
@@ -330,6 +374,8 @@ udev_input_destroy(struct udev_input *input)
 	udev_input_disable(input);
 	wl_list_for_each_safe(seat, next, &input->compositor->seat_list, base.link)
 		udev_seat_destroy(seat);
+	if (input->thread)
+		evdev_input_thread_destroy(input->thread);
 	free(input->seat_id);
 }
 
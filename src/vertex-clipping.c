@@ -23,6 +23,10 @@
 #include <float.h>
 #include <math.h>
 
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
 #include "vertex-clipping.h"
 
 float
@@ -281,6 +285,33 @@ clip_simple(struct clip_context *ctx,
 	return surf->n;
 }
 
+/* Copy the polygon to ex, ey without consecutive duplicate vertices. */
+static int
+clip_dedup(const float *x, const float *y, int count, float *ex, float *ey)
+{
+	int i, n;
+
+	if (count == 0)
+		return 0;
+
+	ex[0] = x[0];
+	ey[0] = y[0];
+	n = 1;
+	for (i = 1; i < count; i++) {
+		if (float_difference(ex[n - 1], x[i]) == 0.0f &&
+		    float_difference(ey[n - 1], y[i]) == 0.0f)
+			continue;
+		ex[n] = x[i];
+		ey[n] = y[i];
+		n++;
+	}
+	if (float_difference(ex[n - 1], x[0]) == 0.0f &&
+	    float_difference(ey[n - 1], y[0]) == 0.0f)
+		n--;
+
+	return n;
+}
+
 int
 clip_transformed(struct clip_context *ctx,
 		 struct polygon8 *surf,
@@ -288,7 +319,6 @@ clip_transformed(struct clip_context *ctx,
 		 float *ey)
 {
 	struct polygon8 polygon;
-	int i, n;
 
 	polygon.n = clip_polygon_left(ctx, surf, polygon.x, polygon.y);
 	surf->n = clip_polygon_right(ctx, &polygon, surf->x, surf->y);
@@ -296,20 +326,173 @@ clip_transformed(struct clip_context *ctx,
 	surf->n = clip_polygon_bottom(ctx, &polygon, surf->x, surf->y);
 
 	/* Get rid of duplicate vertices */
-	ex[0] = surf->x[0];
-	ey[0] = surf->y[0];
-	n = 1;
-	for (i = 1; i < surf->n; i++) {
-		if (float_difference(ex[n - 1], surf->x[i]) == 0.0f &&
-		    float_difference(ey[n - 1], surf->y[i]) == 0.0f)
-			continue;
-		ex[n] = surf->x[i];
-		ey[n] = surf->y[i];
-		n++;
+	return clip_dedup(surf->x, surf->y, surf->n, ex, ey);
+}
+
+enum quad_class {
+	QUAD_GENERAL = 0,
+	QUAD_OUTSIDE = 1,
+	QUAD_INSIDE = 2,
+	QUAD_AXIS_ALIGNED = 4,
+};
+
+static int
+clip_quad_class(const struct clip_context *ctx,
+		const struct clip_quads *quads, int i)
+{
+	float *const *x = quads->x, *const *y = quads->y;
+	float min_x, max_x, min_y, max_y;
+	int class = QUAD_GENERAL;
+
+	min_x = min(min(x[0][i], x[1][i]), min(x[2][i], x[3][i]));
+	max_x = max(max(x[0][i], x[1][i]), max(x[2][i], x[3][i]));
+	min_y = min(min(y[0][i], y[1][i]), min(y[2][i], y[3][i]));
+	max_y = max(max(y[0][i], y[1][i]), max(y[2][i], y[3][i]));
+
+	if (min_x >= ctx->clip.x2 || max_x <= ctx->clip.x1 ||
+	    min_y >= ctx->clip.y2 || max_y <= ctx->clip.y1)
+		class |= QUAD_OUTSIDE;
+	if (min_x >= ctx->clip.x1 && max_x <= ctx->clip.x2 &&
+	    min_y >= ctx->clip.y1 && max_y <= ctx->clip.y2)
+		class |= QUAD_INSIDE;
+	if ((x[0][i] == x[3][i] && x[1][i] == x[2][i] &&
+	     y[0][i] == y[1][i] && y[2][i] == y[3][i]) ||
+	    (x[0][i] == x[1][i] && x[2][i] == x[3][i] &&
+	     y[0][i] == y[3][i] && y[1][i] == y[2][i]))
+		class |= QUAD_AXIS_ALIGNED;
+
+	return class;
+}
+
+#if defined(__SSE__)
+/* The same as clip_quad_class() for quads i to i + 3. */
+static void
+clip_quad_class4(const struct clip_context *ctx,
+		 const struct clip_quads *quads, int i, int *class)
+{
+	__m128 x0 = _mm_loadu_ps(&quads->x[0][i]);
+	__m128 x1 = _mm_loadu_ps(&quads->x[1][i]);
+	__m128 x2 = _mm_loadu_ps(&quads->x[2][i]);
+	__m128 x3 = _mm_loadu_ps(&quads->x[3][i]);
+	__m128 y0 = _mm_loadu_ps(&quads->y[0][i]);
+	__m128 y1 = _mm_loadu_ps(&quads->y[1][i]);
+	__m128 y2 = _mm_loadu_ps(&quads->y[2][i]);
+	__m128 y3 = _mm_loadu_ps(&quads->y[3][i]);
+	__m128 cx1 = _mm_set1_ps(ctx->clip.x1);
+	__m128 cx2 = _mm_set1_ps(ctx->clip.x2);
+	__m128 cy1 = _mm_set1_ps(ctx->clip.y1);
+	__m128 cy2 = _mm_set1_ps(ctx->clip.y2);
+	__m128 min_x, max_x, min_y, max_y, outside, inside, axis;
+	int out_mask, in_mask, axis_mask, k;
+
+	min_x = _mm_min_ps(_mm_min_ps(x0, x1), _mm_min_ps(x2, x3));
+	max_x = _mm_max_ps(_mm_max_ps(x0, x1), _mm_max_ps(x2, x3));
+	min_y = _mm_min_ps(_mm_min_ps(y0, y1), _mm_min_ps(y2, y3));
+	max_y = _mm_max_ps(_mm_max_ps(y0, y1), _mm_max_ps(y2, y3));
+
+	outside = _mm_or_ps(_mm_or_ps(_mm_cmpge_ps(min_x, cx2),
+				      _mm_cmple_ps(max_x, cx1)),
+			    _mm_or_ps(_mm_cmpge_ps(min_y, cy2),
+				      _mm_cmple_ps(max_y, cy1)));
+	inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(min_x, cx1),
+				       _mm_cmple_ps(max_x, cx2)),
+			    _mm_and_ps(_mm_cmpge_ps(min_y, cy1),
+				       _mm_cmple_ps(max_y, cy2)));
+	axis = _mm_or_ps(_mm_and_ps(_mm_and_ps(_mm_cmpeq_ps(x0, x3),
+					       _mm_cmpeq_ps(x1, x2)),
+				    _mm_and_ps(_mm_cmpeq_ps(y0, y1),
+					       _mm_cmpeq_ps(y2, y3))),
+			 _mm_and_ps(_mm_and_ps(_mm_cmpeq_ps(x0, x1),
+					       _mm_cmpeq_ps(x2, x3)),
+				    _mm_and_ps(_mm_cmpeq_ps(y0, y3),
+					       _mm_cmpeq_ps(y1, y2))));
+
+	out_mask = _mm_movemask_ps(outside);
+	in_mask = _mm_movemask_ps(inside);
+	axis_mask = _mm_movemask_ps(axis);
+
+	for (k = 0; k < 4; k++)
+		class[k] = (((out_mask >> k) & 1) * QUAD_OUTSIDE) |
+			   (((in_mask >> k) & 1) * QUAD_INSIDE) |
+			   (((axis_mask >> k) & 1) * QUAD_AXIS_ALIGNED);
+}
+#endif
+
+/* Classify the quads from i up to four at a time. */
+static void
+clip_quad_classes(const struct clip_context *ctx,
+		  const struct clip_quads *quads, int i, int *class)
+{
+	int k;
+
+#if defined(__SSE__)
+	if (i + 4 <= quads->n) {
+		clip_quad_class4(ctx, quads, i, class);
+		return;
 	}
-	if (float_difference(ex[n - 1], surf->x[0]) == 0.0f &&
-	    float_difference(ey[n - 1], surf->y[0]) == 0.0f)
-		n--;
+#endif
 
-	return n;
+	for (k = 0; k < 4 && i + k < quads->n; k++)
+		class[k] = clip_quad_class(ctx, quads, i + k);
+}
+
+/* Clip each quad against ctx->clip, with the same results as
+ * clip_transformed() up to where each polygon starts.  The vertices of
+ * quad i are written to ex and ey starting at 8 * i, and their number to
+ * vtxcnt[i], which is 0 if less than three vertices are left.  Returns
+ * the number of quads that weren't clipped away.
+ *
+ * Quads entirely outside or inside the clip box, and axis-aligned quads,
+ * are handled without running the general polygon clipper.
+ */
+int
+clip_quads(struct clip_context *ctx,
+	   const struct clip_quads *quads,
+	   float *ex,
+	   float *ey,
+	   int *vtxcnt)
+{
+	struct polygon8 polygon;
+	int class[4];
+	int i, k, n, count = 0;
+
+	for (i = 0; i < quads->n; i++) {
+		if ((i & 3) == 0)
+			clip_quad_classes(ctx, quads, i, class);
+
+		for (k = 0; k < 4; k++) {
+			polygon.x[k] = quads->x[k][i];
+			polygon.y[k] = quads->y[k][i];
+		}
+		polygon.n = 4;
+
+		if (class[i & 3] & QUAD_OUTSIDE) {
+			n = 0;
+		} else if (class[i & 3] & QUAD_INSIDE) {
+			n = clip_dedup(polygon.x, polygon.y, 4,
+				       ex + 8 * i, ey + 8 * i);
+		} else if (class[i & 3] & QUAD_AXIS_ALIGNED) {
+			for (k = 0; k < 4; k++) {
+				polygon.x[k] = clip(polygon.x[k],
+						    ctx->clip.x1,
+						    ctx->clip.x2);
+				polygon.y[k] = clip(polygon.y[k],
+						    ctx->clip.y1,
+						    ctx->clip.y2);
+			}
+			n = clip_dedup(polygon.x, polygon.y, 4,
+				       ex + 8 * i, ey + 8 * i);
+		} else {
+			n = clip_transformed(ctx, &polygon,
+					     ex + 8 * i, ey + 8 * i);
+		}
+
+		if (n < 3)
+			n = 0;
+		else
+			count++;
+		vtxcnt[i] = n;
+	}
+
+	return count;
 }
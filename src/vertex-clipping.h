@@ -58,6 +58,22 @@ int
 clip_transformed(struct clip_context *ctx,
 		 struct polygon8 *surf,
 		 float *ex,
-		 float *ey);\
+		 float *ey);
+
+/* Quads in struct-of-arrays layout: corner k of quad i is at
+ * (x[k][i], y[k][i]), and the corners go around each quad in order.
+ */
+struct clip_quads {
+	float *x[4];
+	float *y[4];
+	int n;
+};
+
+int
+clip_quads(struct clip_context *ctx,
+	   const struct clip_quads *quads,
+	   float *ex,
+	   float *ey,
+	   int *vtxcnt);
 
 #endif
@@ -0,0 +1,294 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "../shared/matrix.h"
+
+/* Times the weston_matrix operations against the plain C versions they
+ * replaced, which are copied below, and checks that both give the same
+ * results. */
+
+#define N_MATRICES 1024
+
+static void __attribute__((noinline))
+ref_multiply(struct weston_matrix *m, const struct weston_matrix *n)
+{
+	struct weston_matrix tmp;
+	const float *row, *column;
+	div_t d;
+	int i, j;
+
+	for (i = 0; i < 16; i++) {
+		tmp.d[i] = 0;
+		d = div(i, 4);
+		row = m->d + d.quot * 4;
+		column = n->d + d.rem;
+		for (j = 0; j < 4; j++)
+			tmp.d[i] += row[j] * column[j * 4];
+	}
+	tmp.type = m->type | n->type;
+	memcpy(m, &tmp, sizeof tmp);
+}
+
+static void __attribute__((noinline))
+ref_translate(struct weston_matrix *matrix, float x, float y, float z)
+{
+	struct weston_matrix translate = {
+		.d = { 1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  x, y, z, 1 },
+		.type = WESTON_MATRIX_TRANSFORM_TRANSLATE,
+	};
+
+	ref_multiply(matrix, &translate);
+}
+
+static void __attribute__((noinline))
+ref_scale(struct weston_matrix *matrix, float x, float y, float z)
+{
+	struct weston_matrix scale = {
+		.d = { x, 0, 0, 0,  0, y, 0, 0,  0, 0, z, 0,  0, 0, 0, 1 },
+		.type = WESTON_MATRIX_TRANSFORM_SCALE,
+	};
+
+	ref_multiply(matrix, &scale);
+}
+
+static void __attribute__((noinline))
+ref_rotate_xy(struct weston_matrix *matrix, float cos, float sin)
+{
+	struct weston_matrix rotate = {
+		.d = { cos, sin, 0, 0,  -sin, cos, 0, 0,  0, 0, 1, 0,  0, 0, 0, 1 },
+		.type = WESTON_MATRIX_TRANSFORM_ROTATE,
+	};
+
+	ref_multiply(matrix, &rotate);
+}
+
+static void __attribute__((noinline))
+ref_transform(struct weston_matrix *matrix, struct weston_vector *v)
+{
+	int i, j;
+	struct weston_vector t;
+
+	for (i = 0; i < 4; i++) {
+		t.f[i] = 0;
+		for (j = 0; j < 4; j++)
+			t.f[i] += v->f[j] * matrix->d[i + j * 4];
+	}
+
+	*v = t;
+}
+
+static int __attribute__((noinline))
+ref_invert(struct weston_matrix *inverse, const struct weston_matrix *matrix)
+{
+	double LU[16];
+	unsigned perm[4];
+	unsigned c;
+
+	if (matrix_invert(LU, perm, matrix) < 0)
+		return -1;
+
+	weston_matrix_init(inverse);
+	for (c = 0; c < 4; ++c)
+		inverse_transform(LU, perm, &inverse->d[c * 4]);
+	inverse->type = matrix->type;
+
+	return 0;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static float
+frand(void)
+{
+	return random() / (float) RAND_MAX * 200.0f - 100.0f;
+}
+
+static void
+random_matrix(struct weston_matrix *m)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		m->d[i] = frand();
+	m->type = WESTON_MATRIX_TRANSFORM_OTHER;
+}
+
+/* A typical view transform: scale and translate only. */
+static void
+random_scale_translate(struct weston_matrix *m)
+{
+	weston_matrix_init(m);
+	weston_matrix_scale(m, frand(), frand(), 1);
+	weston_matrix_translate(m, frand(), frand(), 0);
+}
+
+/* Equal as floats, so that 0 and -0 match. */
+static int
+same(const float *a, const float *b, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (a[i] != b[i])
+			return 0;
+
+	return 1;
+}
+
+static struct weston_matrix general[N_MATRICES];
+static struct weston_matrix simple[N_MATRICES];
+
+static int
+check(void)
+{
+	struct weston_matrix a, b, m;
+	struct weston_vector v, w;
+	int i, j, fail = 0;
+
+	for (i = 0; i < N_MATRICES; i++) {
+		j = (i + 1) % N_MATRICES;
+
+		a = b = general[i];
+		weston_matrix_multiply(&a, &general[j]);
+		ref_multiply(&b, &general[j]);
+		fail |= !same(a.d, b.d, 16) << 0;
+
+		a = b = general[i];
+		weston_matrix_translate(&a, 3.5f, -7.25f, 1);
+		weston_matrix_scale(&a, 0.5f, 2.0f, 1);
+		weston_matrix_rotate_xy(&a, 0.6f, 0.8f);
+		ref_translate(&b, 3.5f, -7.25f, 1);
+		ref_scale(&b, 0.5f, 2.0f, 1);
+		ref_rotate_xy(&b, 0.6f, 0.8f);
+		fail |= !same(a.d, b.d, 16) << 1;
+
+		v.f[0] = frand();
+		v.f[1] = frand();
+		v.f[2] = 0;
+		v.f[3] = 1;
+		w = v;
+		weston_matrix_transform(&general[i], &v);
+		ref_transform(&general[i], &w);
+		fail |= !same(v.f, w.f, 4) << 2;
+
+		if (weston_matrix_invert(&a, &general[i]) == 0 &&
+		    ref_invert(&b, &general[i]) == 0)
+			fail |= !same(a.d, b.d, 16) << 3;
+
+		/* Type flags that don't match the contents. */
+		m = general[i];
+		m.type = 0;
+		if (weston_matrix_invert(&a, &m) == 0 &&
+		    ref_invert(&b, &m) == 0)
+			fail |= !same(a.d, b.d, 16) << 5;
+
+		if (weston_matrix_invert(&a, &simple[i]) !=
+		    ref_invert(&b, &simple[i]) || !same(a.d, b.d, 16))
+			fail |= 1 << 4;
+	}
+
+	if (fail)
+		printf("results differ from the reference: %#x\n", fail);
+
+	return fail;
+}
+
+#define BENCH(name, iterations, stmt)					\
+	do {								\
+		double start = now();					\
+		int k;							\
+		for (k = 0; k < (iterations); k++) {			\
+			i = k % N_MATRICES;				\
+			stmt;						\
+		}							\
+		t = now() - start;					\
+		printf("%-34s %7.1f ns\n", name, t * 1e9 / (iterations));\
+	} while (0)
+
+int
+main(int argc, char *argv[])
+{
+	struct weston_matrix m;
+	struct weston_vector u = { { 1, 2, 0, 1 } }, v;
+	int i, iterations = 2000000;
+	float sink = 0;
+	double t;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+
+	srandom(13);
+	for (i = 0; i < N_MATRICES; i++) {
+		random_matrix(&general[i]);
+		random_scale_translate(&simple[i]);
+	}
+
+	if (check())
+		return 1;
+
+	BENCH("multiply, reference", iterations,
+	      m = general[i]; ref_multiply(&m, &general[(i + 1) % N_MATRICES]);
+	      sink += m.d[i & 15]);
+	BENCH("multiply", iterations,
+	      m = general[i];
+	      weston_matrix_multiply(&m, &general[(i + 1) % N_MATRICES]);
+	      sink += m.d[i & 15]);
+	BENCH("translate, reference", iterations,
+	      m = general[i]; ref_translate(&m, 1, 2, 0);
+	      sink += m.d[i & 15]);
+	BENCH("translate", iterations,
+	      m = general[i]; weston_matrix_translate(&m, 1, 2, 0);
+	      sink += m.d[i & 15]);
+	BENCH("transform, reference", iterations,
+	      v = u; ref_transform(&general[i], &v); sink += v.f[i & 3]);
+	BENCH("transform", iterations,
+	      v = u; weston_matrix_transform(&general[i], &v);
+	      sink += v.f[i & 3]);
+	BENCH("invert general, reference", iterations,
+	      ref_invert(&m, &general[i]); sink += m.d[i & 15]);
+	BENCH("invert general", iterations,
+	      weston_matrix_invert(&m, &general[i]); sink += m.d[i & 15]);
+	BENCH("invert scale/translate, reference", iterations,
+	      ref_invert(&m, &simple[i]); sink += m.d[i & 15]);
+	BENCH("invert scale/translate", iterations,
+	      weston_matrix_invert(&m, &simple[i]); sink += m.d[i & 15]);
+
+	/* Keep the results alive. */
+	if (sink == 12345.0f)
+		printf("\n");
+
+	return 0;
+}
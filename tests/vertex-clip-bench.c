@@ -0,0 +1,226 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "../src/vertex-clipping.h"
+
+/* Times clip_quads() against clipping one quad at a time the way the GL
+ * renderer used to, and checks that both give the same polygons. */
+
+#define N_QUADS 256
+#define N_CLIPS 64
+
+static float quad_x[4][N_QUADS], quad_y[4][N_QUADS];
+static struct clip_quads quads;
+static struct clip_context clips[N_CLIPS];
+
+static float ref_ex[N_QUADS * 8], ref_ey[N_QUADS * 8];
+static int ref_vtxcnt[N_QUADS];
+static float ex[N_QUADS * 8], ey[N_QUADS * 8];
+static int vtxcnt[N_QUADS];
+
+static int __attribute__((noinline))
+ref_clip(struct clip_context *ctx)
+{
+	struct polygon8 polygon;
+	float min_x, max_x, min_y, max_y;
+	int i, k, n, count = 0;
+
+	for (i = 0; i < N_QUADS; i++) {
+		for (k = 0; k < 4; k++) {
+			polygon.x[k] = quad_x[k][i];
+			polygon.y[k] = quad_y[k][i];
+		}
+		polygon.n = 4;
+
+		min_x = max_x = polygon.x[0];
+		min_y = max_y = polygon.y[0];
+		for (k = 1; k < 4; k++) {
+			min_x = fminf(min_x, polygon.x[k]);
+			max_x = fmaxf(max_x, polygon.x[k]);
+			min_y = fminf(min_y, polygon.y[k]);
+			max_y = fmaxf(max_y, polygon.y[k]);
+		}
+
+		n = 0;
+		if (min_x < ctx->clip.x2 && max_x > ctx->clip.x1 &&
+		    min_y < ctx->clip.y2 && max_y > ctx->clip.y1)
+			n = clip_transformed(ctx, &polygon,
+					     ref_ex + 8 * i, ref_ey + 8 * i);
+		if (n < 3)
+			n = 0;
+		else
+			count++;
+		ref_vtxcnt[i] = n;
+	}
+
+	return count;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static float
+frand(float scale)
+{
+	return random() / (float) RAND_MAX * scale;
+}
+
+/* Half of the quads are axis-aligned rectangles, the rest are rotated,
+ * like the surface rectangles of a transformed view. */
+static void
+setup(void)
+{
+	float cx, cy, w, h, c, s;
+	int i, k;
+
+	for (i = 0; i < N_QUADS; i++) {
+		cx = frand(1000);
+		cy = frand(1000);
+		w = frand(200) + 1;
+		h = frand(200) + 1;
+		if (i & 1) {
+			c = cosf(frand(6.28f));
+			s = sinf(frand(6.28f));
+		} else {
+			c = 1;
+			s = 0;
+		}
+
+		for (k = 0; k < 4; k++) {
+			float dx = (k == 1 || k == 2) ? w : -w;
+			float dy = (k >= 2) ? h : -h;
+
+			quad_x[k][i] = (i & 1) ? cx + c * dx - s * dy
+					       : cx + dx;
+			quad_y[k][i] = (i & 1) ? cy + s * dx + c * dy
+					       : cy + dy;
+		}
+	}
+
+	for (k = 0; k < 4; k++) {
+		quads.x[k] = quad_x[k];
+		quads.y[k] = quad_y[k];
+	}
+	quads.n = N_QUADS;
+
+	for (i = 0; i < N_CLIPS; i++) {
+		clips[i].clip.x1 = frand(800);
+		clips[i].clip.y1 = frand(800);
+		clips[i].clip.x2 = clips[i].clip.x1 + frand(400) + 1;
+		clips[i].clip.y2 = clips[i].clip.y1 + frand(400) + 1;
+	}
+}
+
+/* The same polygon, possibly starting at a different vertex. */
+static int
+same_polygon(const float *ax, const float *ay,
+	     const float *bx, const float *by, int n)
+{
+	int start, k;
+
+	for (start = 0; start < n; start++) {
+		for (k = 0; k < n; k++)
+			if (ax[k] != bx[(start + k) % n] ||
+			    ay[k] != by[(start + k) % n])
+				break;
+		if (k == n)
+			return 1;
+	}
+
+	return n == 0;
+}
+
+static int
+check(void)
+{
+	int i, j, fail = 0;
+
+	for (j = 0; j < N_CLIPS; j++) {
+		if (ref_clip(&clips[j]) != clip_quads(&clips[j], &quads,
+						      ex, ey, vtxcnt))
+			fail = 1;
+
+		for (i = 0; i < N_QUADS; i++)
+			if (ref_vtxcnt[i] != vtxcnt[i] ||
+			    !same_polygon(ref_ex + 8 * i, ref_ey + 8 * i,
+					  ex + 8 * i, ey + 8 * i, vtxcnt[i]))
+				fail = 1;
+	}
+
+	if (fail)
+		printf("results differ from the reference\n");
+
+	return fail;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int j, k, iterations = 20000, sink = 0;
+	double start, t;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+
+	srandom(13);
+	setup();
+
+	if (check())
+		return 1;
+
+	start = now();
+	for (k = 0; k < iterations; k++) {
+		j = k % N_CLIPS;
+		sink += ref_clip(&clips[j]);
+	}
+	t = now() - start;
+	printf("%-24s %7.1f ns per quad\n", "clip, reference",
+	       t * 1e9 / iterations / N_QUADS);
+
+	start = now();
+	for (k = 0; k < iterations; k++) {
+		j = k % N_CLIPS;
+		sink += clip_quads(&clips[j], &quads, ex, ey, vtxcnt);
+	}
+	t = now() - start;
+	printf("%-24s %7.1f ns per quad\n", "clip_quads",
+	       t * 1e9 / iterations / N_QUADS);
+
+	/* Keep the results alive. */
+	if (sink == 12345)
+		printf("\n");
+
+	return 0;
+}
@@ -217,3 +217,40 @@ TEST(float_difference_same)
 	assert(float_difference(1.0f, 1.0f) == 0.0f);
 }
 
+
+TEST_P(clip_quads_expected_vertices, test_data)
+{
+	struct vertex_clip_test_data *tdata = data;
+	struct clip_context ctx;
+	struct clip_quads quads;
+	float quad_x[4], quad_y[4];
+	float vertices_x[8];
+	float vertices_y[8];
+	int vtxcnt, start, i, k;
+
+	for (k = 0; k < 4; k++) {
+		quad_x[k] = tdata->surface.x[k];
+		quad_y[k] = tdata->surface.y[k];
+		quads.x[k] = &quad_x[k];
+		quads.y[k] = &quad_y[k];
+	}
+	quads.n = 1;
+
+	populate_clip_context(&ctx);
+	assert(clip_quads(&ctx, &quads, vertices_x, vertices_y, &vtxcnt) == 1);
+	assert(vtxcnt == tdata->expected.n);
+
+	/* The polygon may start at any of the expected vertices. */
+	for (start = 0; start < vtxcnt; start++)
+		if (vertices_x[0] == tdata->expected.x[start] &&
+		    vertices_y[0] == tdata->expected.y[start])
+			break;
+	assert(start < vtxcnt);
+
+	for (i = 0; i < vtxcnt; i++) {
+		assert(vertices_x[i] ==
+		       tdata->expected.x[(start + i) % vtxcnt]);
+		assert(vertices_y[i] ==
+		       tdata->expected.y[(start + i) % vtxcnt]);
+	}
+}
@@ -32,11 +32,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
-#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include <cairo.h>
 
 #include "wcap-decode.h"
+#include "wcap-yuv.h"
 
 static void
 write_png(struct wcap_decoder *decoder, const char *filename)
@@ -52,142 +54,234 @@ write_png(struct wcap_decoder *decoder, const char *filename)
 	cairo_surface_destroy(surface);
 }
 
-static inline int
-rgb_to_yuv(uint32_t format, uint32_t p, int *u, int *v)
+/* Converting and writing a frame takes longer than decoding one, so
+ * the main thread only decodes and copies frames into a ring of slots.
+ * Worker threads convert whole frames and a writer thread writes them
+ * out in order. */
+#define PIPELINE_MAX_THREADS 16
+
+enum slot_state {
+	SLOT_FREE,
+	SLOT_DECODED,
+	SLOT_CONVERTED
+};
+
+struct pipeline_slot {
+	uint32_t *frame;
+	unsigned char *out;
+	enum slot_state state;
+};
+
+struct yuv_pipeline {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct pipeline_slot *slots;
+	int nslots;
+	uint32_t head, next_convert, next_write;
+	int done;
+
+	pthread_t workers[PIPELINE_MAX_THREADS];
+	int nworkers;
+	pthread_t writer;
+
+	uint32_t format;
+	int width, height, depth;
+	size_t frame_size, out_size;
+};
+
+static void *
+pipeline_worker(void *data)
 {
-	int r, g, b, y;
-
-	switch (format) {
-	case WCAP_FORMAT_XRGB8888:
-		r = (p >> 16) & 0xff;
-		g = (p >> 8) & 0xff;
-		b = (p >> 0) & 0xff;
-		break;
-	case WCAP_FORMAT_XBGR8888:
-		r = (p >> 0) & 0xff;
-		g = (p >> 8) & 0xff;
-		b = (p >> 16) & 0xff;
-		break;
-	default:
-		assert(0);
-	}
+	struct yuv_pipeline *pipeline = data;
+	struct pipeline_slot *slot;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	for (;;) {
+		while (pipeline->next_convert == pipeline->head &&
+		       !pipeline->done)
+			pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+		if (pipeline->next_convert == pipeline->head)
+			break;
 
-	y = (19595 * r + 38469 * g + 7472 * b) >> 16;
-	if (y > 255)
-		y = 255;
+		slot = &pipeline->slots[pipeline->next_convert++ %
+					pipeline->nslots];
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		if (pipeline->depth == 444)
+			wcap_convert_to_yuv444(pipeline->format, slot->frame,
+					       pipeline->width,
+					       pipeline->height, slot->out);
+		else
+			wcap_convert_to_yv12(pipeline->format, slot->frame,
+					     pipeline->width,
+					     pipeline->height, slot->out);
+
+		pthread_mutex_lock(&pipeline->mutex);
+		slot->state = SLOT_CONVERTED;
+		pthread_cond_broadcast(&pipeline->cond);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
 
-	*u += 46727 * (r - y);
-	*v += 36962 * (b - y);
+	return NULL;
+}
 
-	return y;
+static void
+write_all(const void *data, size_t size)
+{
+	const char *p = data;
+	ssize_t len;
+
+	while (size > 0) {
+		len = write(STDOUT_FILENO, p, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0) {
+			fprintf(stderr, "write failed: %m\n");
+			exit(EXIT_FAILURE);
+		}
+		p += len;
+		size -= len;
+	}
 }
 
-static inline
-int clamp_uv(int u)
+static void *
+pipeline_writer(void *data)
 {
-	int clamp = (u >> 18) + 128;
+	struct yuv_pipeline *pipeline = data;
+	struct pipeline_slot *slot;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	for (;;) {
+		slot = &pipeline->slots[pipeline->next_write %
+					pipeline->nslots];
+		while (slot->state != SLOT_CONVERTED &&
+		       !(pipeline->done &&
+			 pipeline->next_write == pipeline->head))
+			pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+		if (slot->state != SLOT_CONVERTED)
+			break;
+		pthread_mutex_unlock(&pipeline->mutex);
 
-	if (clamp < 0)
-		return 0;
-	else if (clamp > 255)
-		return 255;
-	else
-		return clamp;
+		write_all("FRAME\n", 6);
+		write_all(slot->out, pipeline->out_size);
+
+		pthread_mutex_lock(&pipeline->mutex);
+		slot->state = SLOT_FREE;
+		pipeline->next_write++;
+		pthread_cond_broadcast(&pipeline->cond);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	return NULL;
 }
 
-static void
-convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
+static struct yuv_pipeline *
+yuv_pipeline_create(struct wcap_decoder *decoder, int depth, int threads)
 {
-	unsigned char *y1, *y2, *u, *v;
-	uint32_t *p1, *p2, *end;
-	int i, u_accum, v_accum, stride0, stride1;
-	uint32_t format = decoder->format;
-
-	stride0 = decoder->width;
-	stride1 = decoder->width / 2;
-	for (i = 0; i < decoder->height; i += 2) {
-		y1 = out + stride0 * i;
-		y2 = y1 + stride0;
-		v = out + stride0 * decoder->height + stride1 * i / 2;
-		u = v + stride1 * decoder->height / 2;
-		p1 = decoder->frame + decoder->width * i;
-		p2 = p1 + decoder->width;
-		end = p1 + decoder->width;
-
-		while (p1 < end) {
-			u_accum = 0;
-			v_accum = 0;
-			y1[0] = rgb_to_yuv(format, p1[0], &u_accum, &v_accum);
-			y1[1] = rgb_to_yuv(format, p1[1], &u_accum, &v_accum);
-			y2[0] = rgb_to_yuv(format, p2[0], &u_accum, &v_accum);
-			y2[1] = rgb_to_yuv(format, p2[1], &u_accum, &v_accum);
-			u[0] = clamp_uv(u_accum);
-			v[0] = clamp_uv(v_accum);
-
-			y1 += 2;
-			p1 += 2;
-			y2 += 2;
-			p2 += 2;
-			u++;
-			v++;
+	struct yuv_pipeline *pipeline;
+	int i;
+
+	pipeline = calloc(1, sizeof *pipeline);
+	if (pipeline == NULL)
+		return NULL;
+
+	pipeline->format = decoder->format;
+	pipeline->width = decoder->width;
+	pipeline->height = decoder->height;
+	pipeline->depth = depth;
+	pipeline->frame_size = decoder->width * decoder->height * 4;
+	if (depth == 444)
+		pipeline->out_size = decoder->width * decoder->height * 3;
+	else
+		pipeline->out_size = decoder->width * decoder->height * 3 / 2;
+
+	/* One frame being decoded, one being written and one for each
+	 * worker keeps everybody busy. */
+	pipeline->nslots = threads + 2;
+	pipeline->slots = calloc(pipeline->nslots, sizeof *pipeline->slots);
+	if (pipeline->slots == NULL)
+		goto err;
+	for (i = 0; i < pipeline->nslots; i++) {
+		pipeline->slots[i].frame = malloc(pipeline->frame_size);
+		pipeline->slots[i].out = malloc(pipeline->out_size);
+		if (!pipeline->slots[i].frame || !pipeline->slots[i].out)
+			goto err;
+	}
+
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->cond, NULL);
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&pipeline->workers[i], NULL,
+				   pipeline_worker, pipeline) != 0)
+			break;
+		pipeline->nworkers++;
+	}
+	if (pipeline->nworkers == 0 ||
+	    pthread_create(&pipeline->writer, NULL,
+			   pipeline_writer, pipeline) != 0) {
+		fprintf(stderr, "failed to start conversion threads\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return pipeline;
+
+err:
+	if (pipeline->slots) {
+		for (i = 0; i < pipeline->nslots; i++) {
+			free(pipeline->slots[i].frame);
+			free(pipeline->slots[i].out);
 		}
 	}
+	free(pipeline->slots);
+	free(pipeline);
+
+	return NULL;
 }
 
 static void
-convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
+yuv_pipeline_push(struct yuv_pipeline *pipeline, const uint32_t *frame)
 {
+	struct pipeline_slot *slot;
 
-	unsigned char *yp, *up, *vp;
-	uint32_t *rp, *end;
-	int u, v;
-	int i, stride, psize;
-	uint32_t format = decoder->format;
-
-	stride = decoder->width;
-	psize = stride * decoder->height;
-	for (i = 0; i < decoder->height; i++) {
-		yp = out + stride * i;
-		up = yp + (psize * 2);
-		vp = yp + (psize * 1);
-		rp = decoder->frame + decoder->width * i;
-		end = rp + decoder->width;	
-		while (rp < end) {
-			u = 0;
-			v = 0;
-			yp[0] = rgb_to_yuv(format, rp[0], &u, &v);
-			up[0] = clamp_uv(u/.3);
-			vp[0] = clamp_uv(v/.3);
-			up++;
-			vp++;
-			yp++;
-			rp++;
-		}
-	}
+	pthread_mutex_lock(&pipeline->mutex);
+	slot = &pipeline->slots[pipeline->head % pipeline->nslots];
+	while (slot->state != SLOT_FREE)
+		pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	memcpy(slot->frame, frame, pipeline->frame_size);
+
+	pthread_mutex_lock(&pipeline->mutex);
+	slot->state = SLOT_DECODED;
+	pipeline->head++;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
 }
 
 static void
-output_yuv_frame(struct wcap_decoder *decoder, int depth)
+yuv_pipeline_destroy(struct yuv_pipeline *pipeline)
 {
-	static unsigned char *out;
-	int size;
+	int i;
 
-	if (depth == 444) {
-		size = decoder->width * decoder->height * 3;
-	} else {
-		size = decoder->width * decoder->height * 3 / 2;
-	}
-	if (out == NULL)
-		out = malloc(size);
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->done = 1;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
 
-	if (depth == 444) {
-		convert_to_yuv444(decoder, out);
-	} else {
-		convert_to_yv12(decoder, out);
-	}
+	for (i = 0; i < pipeline->nworkers; i++)
+		pthread_join(pipeline->workers[i], NULL);
+	pthread_join(pipeline->writer, NULL);
 
-	printf("FRAME\n");
-	fwrite(out, 1, size, stdout);
+	pthread_cond_destroy(&pipeline->cond);
+	pthread_mutex_destroy(&pipeline->mutex);
+
+	for (i = 0; i < pipeline->nslots; i++) {
+		free(pipeline->slots[i].frame);
+		free(pipeline->slots[i].out);
+	}
+	free(pipeline->slots);
+	free(pipeline);
 }
 
 static void
@@ -195,14 +289,17 @@ usage(int exit_code)
 {
 	fprintf(stderr, "usage: wcap-decode "
 		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--all] \n"
-		"\t[--rate=<num:denom>] <wcap file>\n\n"
+		"\t[--frames=<first>-<last>] [--rate=<num:denom>] <wcap file>\n\n"
 		"\t--help\t\t\tthis help text\n"
 		"\t--yuv4mpeg2\t\tdump wcap file to stdout in yuv4mpeg2 format\n"
 		"\t--yuv4mpeg2-444\t\tdump wcap file to stdout in yuv4mpeg2 444 format\n"
 		"\t--frame=<frame>\t\twrite out the given frame number as png\n"
 		"\t--all\t\t\twrite all frames as pngs\n"
+		"\t--frames=<first>-<last>\tonly decode the given range of frames,\n"
+		"\t\t\t\twith --all or --yuv4mpeg2\n"
 		"\t--rate=<num:denom>\treplay frame rate for yuv4mpeg2,\n"
-		"\t\t\t\tspecified as an integer fraction\n\n");
+		"\t\t\t\tspecified as an integer fraction\n"
+		"\t--threads=<n>\t\tnumber of yuv4mpeg2 conversion threads\n\n");
 
 	exit(exit_code);
 }
@@ -211,6 +308,8 @@ int main(int argc, char *argv[])
 {
 	struct wcap_decoder *decoder;
 	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame;
+	int first = 0, last = -1, threads = 0;
+	struct yuv_pipeline *pipeline = NULL;
 	int num = 30, denom = 1;
 	char filename[200];
 	char *mode;
@@ -226,6 +325,10 @@ int main(int argc, char *argv[])
 		} else if (strcmp(argv[i], "--all") == 0) {
 			all = 1;
 		} else if (sscanf(argv[i], "--frame=%d", &output_frame) == 1) {
+			first = last = output_frame;
+		} else if (sscanf(argv[i], "--frames=%d-%d", &first, &last) == 2) {
+			;
+		} else if (sscanf(argv[i], "--threads=%d", &threads) == 1) {
 			;
 		} else if (sscanf(argv[i], "--rate=%d", &num) == 1) {
 			;
@@ -249,6 +352,10 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "invalid rate, denom can not be 0\n");
 		exit(EXIT_FAILURE);
 	}
+	if (first < 0 || (last >= 0 && last < first)) {
+		fprintf(stderr, "invalid frame range\n");
+		exit(EXIT_FAILURE);
+	}
 
 	decoder = wcap_decoder_create(argv[1]);
 
@@ -270,15 +377,37 @@ int main(int argc, char *argv[])
 		printf("YUV4MPEG2 %s W%d H%d F%d:%d Ip A0:0\n",
 					 mode, decoder->width, decoder->height, num, denom);
 		fflush(stdout);
+
+		/* Leave a core for decoding. */
+		if (threads <= 0)
+			threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+		if (threads < 1)
+			threads = 1;
+		if (threads > PIPELINE_MAX_THREADS)
+			threads = PIPELINE_MAX_THREADS;
+
+		pipeline = yuv_pipeline_create(decoder, yuv4mpeg2, threads);
+		if (pipeline == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	i = 0;
-	has_frame = wcap_decoder_get_frame(decoder);
-	msecs = decoder->msecs;
+	/* Frame numbers count frames at the replay rate, so the first
+	 * frame of the range is found by time rather than by position in
+	 * the file.  The index lets us get there from the closest
+	 * keyframe instead of decoding everything before it. */
 	frame_time = 1000 * denom / num;
+	i = first;
+	if (decoder->index_count > 0) {
+		msecs = decoder->index[0].msecs + first * frame_time;
+		has_frame = wcap_decoder_seek(decoder, msecs);
+	} else {
+		has_frame = 0;
+	}
 	frame_size = decoder->width * decoder->height * 4;
 	frame = malloc(frame_size);
-	while (has_frame) {
+	while (has_frame && (last < 0 || i <= last)) {
 		if (decoder->msecs >= msecs)
 			memcpy(frame, decoder->frame, frame_size);
 		if (all || i == output_frame) {
@@ -287,16 +416,20 @@ int main(int argc, char *argv[])
 			write_png(decoder, filename);
 			fprintf(stderr, "wrote %s\n", filename);
 		}
-		if (yuv4mpeg2)
-			output_yuv_frame(decoder, yuv4mpeg2);
+		if (pipeline)
+			yuv_pipeline_push(pipeline, decoder->frame);
 		i++;
 		msecs += frame_time;
 		while (decoder->msecs < msecs && has_frame)
 			has_frame = wcap_decoder_get_frame(decoder);
 	}
 
-	fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
-		decoder->width, decoder->height, i);
+	if (pipeline)
+		yuv_pipeline_destroy(pipeline);
+
+	if (last < 0)
+		fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
+			decoder->width, decoder->height, i);
 
 	wcap_decoder_destroy(decoder);
 
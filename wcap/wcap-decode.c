@@ -87,7 +87,7 @@ wcap_decoder_get_frame(struct wcap_decoder *decoder)
 {
 	struct wcap_rectangle *rects;
 	struct wcap_frame_header *header;
-	uint32_t i;
+	uint32_t i, nrects;
 
 	if (decoder->p == decoder->end)
 		return 0;
@@ -96,14 +96,205 @@ wcap_decoder_get_frame(struct wcap_decoder *decoder)
 	decoder->msecs = header->msecs;
 	decoder->count++;
 
+	nrects = header->nrects;
+	if (decoder->version == 2 && (nrects & WCAP_FRAME_KEY)) {
+		nrects &= ~WCAP_FRAME_KEY;
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+	}
+
 	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
-	for (i = 0; i < header->nrects; i++)
+	decoder->p = (uint32_t *) (rects + nrects);
+	for (i = 0; i < nrects; i++)
 		wcap_decoder_decode_rectangle(decoder, &rects[i]);
 
 	return 1;
 }
 
+static uint64_t
+index_entry_offset(struct wcap_index_entry *entry)
+{
+	return ((uint64_t) entry->offset_hi << 32) | entry->offset_lo;
+}
+
+/* Decode forward so that frame number 'target' is the current frame,
+ * starting from the closest keyframe unless the decoder is already
+ * between that keyframe and the target. */
+static void
+wcap_decoder_seek_index(struct wcap_decoder *decoder, uint32_t target)
+{
+	struct wcap_index_entry *index = decoder->index;
+	uint32_t key;
+
+	key = target;
+	while (key > 0 && !(index[key].flags & WCAP_INDEX_KEY))
+		key--;
+
+	if (decoder->count <= key || decoder->count > target + 1) {
+		decoder->p = decoder->map + index_entry_offset(&index[key]);
+		decoder->count = key;
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+	}
+
+	while (decoder->count <= target)
+		if (!wcap_decoder_get_frame(decoder))
+			break;
+}
+
+/* Leave the decoder on the first frame recorded at or after 'msecs',
+ * the same frame that decoding sequentially and stopping once
+ * decoder->msecs >= msecs would leave.  Returns 0 if there is no such
+ * frame. */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs)
+{
+	uint32_t lo = 0, hi = decoder->index_count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (decoder->index[mid].msecs < msecs)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == decoder->index_count)
+		return 0;
+
+	wcap_decoder_seek_index(decoder, lo);
+
+	return 1;
+}
+
+int
+wcap_decoder_seek_frame(struct wcap_decoder *decoder, uint32_t frame)
+{
+	if (frame >= decoder->index_count)
+		return 0;
+
+	wcap_decoder_seek_index(decoder, frame);
+
+	return 1;
+}
+
+static int
+wcap_decoder_read_index(struct wcap_decoder *decoder)
+{
+	struct wcap_index_trailer trailer;
+	uint64_t offset, first, prev, entry;
+	size_t size;
+	uint32_t i;
+
+	first = decoder->start - decoder->map;
+	if (decoder->size < first + sizeof trailer)
+		return 0;
+
+	memcpy(&trailer, decoder->map + decoder->size - sizeof trailer,
+	       sizeof trailer);
+	if (trailer.magic != WCAP_INDEX_MAGIC)
+		return 0;
+
+	offset = ((uint64_t) trailer.offset_hi << 32) | trailer.offset_lo;
+	size = (size_t) trailer.count * sizeof *decoder->index;
+	if (offset < first || (offset & 3) ||
+	    offset + size != decoder->size - sizeof trailer)
+		return 0;
+
+	decoder->index = malloc(size);
+	if (decoder->index == NULL)
+		return 0;
+
+	memcpy(decoder->index, decoder->map + offset, size);
+
+	/* Every frame has to start between the header and the index, in
+	 * file order, or seeking would decode from outside the frames. */
+	prev = first;
+	for (i = 0; i < trailer.count; i++) {
+		entry = index_entry_offset(&decoder->index[i]);
+		if (entry < prev || entry >= offset || (entry & 3)) {
+			free(decoder->index);
+			decoder->index = NULL;
+			return 0;
+		}
+		prev = entry;
+	}
+
+	decoder->index_count = trailer.count;
+	decoder->end = decoder->map + offset;
+
+	return 1;
+}
+
+/* Build the index by walking the frame and rectangle headers and
+ * skipping over the run-length data without decoding it.  A frame cut
+ * short by the end of the file is dropped. */
+static void
+wcap_decoder_skim(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_header *header;
+	struct wcap_rectangle *rect;
+	struct wcap_index_entry *entry;
+	uint32_t *p, *end, *last, nrects, flags, i, l;
+	uint64_t count, n, alloc = 0;
+
+	decoder->index = NULL;
+	decoder->index_count = 0;
+
+	p = decoder->start;
+	last = p;
+	end = decoder->map + (decoder->size & ~3);
+	while ((void *) (p + sizeof *header / 4) <= (void *) end) {
+		header = (struct wcap_frame_header *) p;
+		nrects = header->nrects;
+		flags = 0;
+		if (decoder->version == 2 && (nrects & WCAP_FRAME_KEY)) {
+			nrects &= ~WCAP_FRAME_KEY;
+			flags = WCAP_INDEX_KEY;
+		}
+		if (decoder->index_count == 0)
+			flags = WCAP_INDEX_KEY;
+
+		rect = (struct wcap_rectangle *) (header + 1);
+		if ((uint64_t) nrects * sizeof *rect >
+		    (uint64_t) ((char *) end - (char *) rect))
+			break;
+
+		p = (uint32_t *) (rect + nrects);
+		for (i = 0; i < nrects; i++) {
+			count = (uint64_t) (rect[i].x2 - rect[i].x1) *
+				(rect[i].y2 - rect[i].y1);
+			for (n = 0; n < count && p < end; n += l) {
+				l = *p++ >> 24;
+				l = l < 0xe0 ? l + 1 : 1u << (l - 0xe0 + 7);
+			}
+			if (n < count)
+				break;
+		}
+		if (i < nrects)
+			break;
+
+		if (decoder->index_count == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			entry = realloc(decoder->index,
+					alloc * sizeof *entry);
+			if (entry == NULL)
+				break;
+			decoder->index = entry;
+		}
+
+		entry = &decoder->index[decoder->index_count++];
+		entry->offset_lo = (char *) header - (char *) decoder->map;
+		entry->offset_hi =
+			(uint64_t) ((char *) header - (char *) decoder->map) >> 32;
+		entry->msecs = header->msecs;
+		entry->flags = flags;
+		last = p;
+	}
+
+	decoder->end = last;
+}
+
 struct wcap_decoder *
 wcap_decoder_create(const char *filename)
 {
@@ -128,17 +319,24 @@ wcap_decoder_create(const char *filename)
 			    PROT_READ, MAP_PRIVATE, decoder->fd, 0);
 		
 	header = decoder->map;
+	decoder->version = header->magic == WCAP_HEADER_MAGIC_V2 ? 2 : 1;
 	decoder->format = header->format;
 	decoder->count = 0;
 	decoder->width = header->width;
 	decoder->height = header->height;
 	decoder->p = header + 1;
+	decoder->start = decoder->p;
 	decoder->end = decoder->map + decoder->size;
 
 	frame_size = header->width * header->height * 4;
 	decoder->frame = malloc(frame_size);
 	memset(decoder->frame, 0, frame_size);
 
+	decoder->index = NULL;
+	decoder->index_count = 0;
+	if (decoder->version == 1 || !wcap_decoder_read_index(decoder))
+		wcap_decoder_skim(decoder);
+
 	return decoder;
 }
 
@@ -147,6 +345,7 @@ wcap_decoder_destroy(struct wcap_decoder *decoder)
 {
 	munmap(decoder->map, decoder->size);
 	close(decoder->fd);
+	free(decoder->index);
 	free(decoder->frame);
 	free(decoder);
 }
@@ -24,6 +24,9 @@
 #define _WCAP_DECODE_
 
 #define WCAP_HEADER_MAGIC	0x57434150
+/* Version 2 adds keyframes and a trailing frame index. */
+#define WCAP_HEADER_MAGIC_V2	0x57434132
+#define WCAP_INDEX_MAGIC	0x58444957
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
@@ -45,18 +48,46 @@ struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
 
+/* Set in wcap_frame_header.nrects of a version 2 keyframe: the frame
+ * covers the whole screen and is coded against black rather than the
+ * previous frame. */
+#define WCAP_FRAME_KEY		0x80000000
+
+#define WCAP_INDEX_KEY		0x00000001
+
+struct wcap_index_entry {
+	uint32_t offset_lo, offset_hi;	/* of the frame header */
+	uint32_t msecs;
+	uint32_t flags;
+};
+
+/* The last 16 bytes of a complete version 2 file. */
+struct wcap_index_trailer {
+	uint32_t offset_lo, offset_hi;	/* of the first index entry */
+	uint32_t count;
+	uint32_t magic;
+};
+
 struct wcap_decoder {
 	int fd;
 	size_t size;
-	void *map, *p, *end;
+	void *map, *p, *start, *end;
 	uint32_t *frame;
 	uint32_t format;
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+	int version;
+
+	/* One entry per frame, read from the file or, for version 1
+	 * and truncated files, built by skimming over it. */
+	struct wcap_index_entry *index;
+	uint32_t index_count;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs);
+int wcap_decoder_seek_frame(struct wcap_decoder *decoder, uint32_t frame);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 
@@ -0,0 +1,141 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "wcap-decode.h"
+#include "wcap-yuv.h"
+
+/* Times the YUV conversion of a synthetic 1080p frame, SIMD against
+ * plain C, and checks that both give the same output. */
+
+typedef void (*convert_func_t)(uint32_t format, const uint32_t *frame,
+			       int width, int height, unsigned char *out);
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+run(convert_func_t convert, uint32_t format, const uint32_t *frame,
+    int width, int height, unsigned char *out, int iterations)
+{
+	double start;
+	int i;
+
+	start = now();
+	for (i = 0; i < iterations; i++)
+		convert(format, frame, width, height, out);
+
+	return (now() - start) / iterations;
+}
+
+static int
+bench(const char *name, convert_func_t simd, convert_func_t c,
+      uint32_t format, const uint32_t *frame, int width, int height,
+      int size, int iterations)
+{
+	unsigned char *a, *b;
+	double t_simd, t_c;
+	int ret = 0;
+
+	a = malloc(size);
+	b = malloc(size);
+	if (!a || !b) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	t_c = run(c, format, frame, width, height, b, iterations);
+	t_simd = run(simd, format, frame, width, height, a, iterations);
+
+	if (memcmp(a, b, size) != 0) {
+		printf("%-16s output differs from the C version\n", name);
+		ret = -1;
+	}
+
+	printf("%-16s C %7.2f ms  SIMD %7.2f ms  %5.2fx  %6.1f frames/s\n",
+	       name, t_c * 1000, t_simd * 1000, t_c / t_simd, 1 / t_simd);
+
+	free(a);
+	free(b);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int width = 1920, height = 1080, iterations = 50, i, ret = 0;
+	uint32_t *frame, s = 1;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+	if (iterations <= 0)
+		iterations = 1;
+
+	frame = malloc(width * height * 4);
+	if (!frame) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Half noise, half flat runs, like a desktop. */
+	for (i = 0; i < width * height; i++) {
+		if ((i / 64) & 1)
+			s = s * 1103515245 + 12345;
+		frame[i] = s ^ (i / 64);
+	}
+
+	ret |= bench("yv12 xrgb", wcap_convert_to_yv12,
+		     wcap_convert_to_yv12_c, WCAP_FORMAT_XRGB8888,
+		     frame, width, height, width * height * 3 / 2, iterations);
+	ret |= bench("yv12 xbgr", wcap_convert_to_yv12,
+		     wcap_convert_to_yv12_c, WCAP_FORMAT_XBGR8888,
+		     frame, width, height, width * height * 3 / 2, iterations);
+	ret |= bench("yuv444 xrgb", wcap_convert_to_yuv444,
+		     wcap_convert_to_yuv444_c, WCAP_FORMAT_XRGB8888,
+		     frame, width, height, width * height * 3, iterations);
+
+	/* An odd size exercises the C tails. */
+	ret |= bench("yv12 1366x768", wcap_convert_to_yv12,
+		     wcap_convert_to_yv12_c, WCAP_FORMAT_XRGB8888,
+		     frame, 1366, 768, 1366 * 768 * 3 / 2, iterations);
+	ret |= bench("yuv444 1366x768", wcap_convert_to_yuv444,
+		     wcap_convert_to_yuv444_c, WCAP_FORMAT_XRGB8888,
+		     frame, 1366, 768, 1366 * 768 * 3, iterations);
+
+	free(frame);
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
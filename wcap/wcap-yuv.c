@@ -0,0 +1,392 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "wcap-decode.h"
+#include "wcap-yuv.h"
+
+static inline int
+rgb_to_yuv(uint32_t format, uint32_t p, int *u, int *v)
+{
+	int r, g, b, y;
+
+	switch (format) {
+	case WCAP_FORMAT_XRGB8888:
+		r = (p >> 16) & 0xff;
+		g = (p >> 8) & 0xff;
+		b = (p >> 0) & 0xff;
+		break;
+	case WCAP_FORMAT_XBGR8888:
+		r = (p >> 0) & 0xff;
+		g = (p >> 8) & 0xff;
+		b = (p >> 16) & 0xff;
+		break;
+	default:
+		assert(0);
+	}
+
+	y = (19595 * r + 38469 * g + 7472 * b) >> 16;
+	if (y > 255)
+		y = 255;
+
+	*u += 46727 * (r - y);
+	*v += 36962 * (b - y);
+
+	return y;
+}
+
+static inline
+int clamp_uv(int u)
+{
+	int clamp = (u >> 18) + 128;
+
+	if (clamp < 0)
+		return 0;
+	else if (clamp > 255)
+		return 255;
+	else
+		return clamp;
+}
+
+/* Two rows, from column x to the end, one 2x2 block at a time. */
+static void
+yv12_rows_c(uint32_t format, const uint32_t *p1, const uint32_t *p2,
+	    unsigned char *y1, unsigned char *y2,
+	    unsigned char *u, unsigned char *v, int x, int width)
+{
+	const uint32_t *end = p1 + width;
+	int u_accum, v_accum;
+
+	p1 += x;
+	p2 += x;
+	y1 += x;
+	y2 += x;
+	u += x / 2;
+	v += x / 2;
+	while (p1 < end) {
+		u_accum = 0;
+		v_accum = 0;
+		y1[0] = rgb_to_yuv(format, p1[0], &u_accum, &v_accum);
+		y1[1] = rgb_to_yuv(format, p1[1], &u_accum, &v_accum);
+		y2[0] = rgb_to_yuv(format, p2[0], &u_accum, &v_accum);
+		y2[1] = rgb_to_yuv(format, p2[1], &u_accum, &v_accum);
+		u[0] = clamp_uv(u_accum);
+		v[0] = clamp_uv(v_accum);
+
+		y1 += 2;
+		p1 += 2;
+		y2 += 2;
+		p2 += 2;
+		u++;
+		v++;
+	}
+}
+
+static void
+yuv444_row_c(uint32_t format, const uint32_t *rp, unsigned char *yp,
+	     unsigned char *up, unsigned char *vp, int x, int width)
+{
+	const uint32_t *end = rp + width;
+	int u, v;
+
+	rp += x;
+	yp += x;
+	up += x;
+	vp += x;
+	while (rp < end) {
+		u = 0;
+		v = 0;
+		yp[0] = rgb_to_yuv(format, rp[0], &u, &v);
+		up[0] = clamp_uv(u/.3);
+		vp[0] = clamp_uv(v/.3);
+		up++;
+		vp++;
+		yp++;
+		rp++;
+	}
+}
+
+#if defined(__SSE2__)
+
+/* rgb_to_yuv() for four pixels.  madd only takes signed 16 bit
+ * factors, so 38469 * g is split over the r and b products and the
+ * chroma factors are split in two halves. */
+static inline __m128i
+rgb_to_yuv_sse2(__m128i p, __m128i rshift, __m128i bshift,
+		__m128i *u, __m128i *v)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	__m128i r, g, b, y, d;
+
+	r = _mm_and_si128(_mm_srl_epi32(p, rshift), mask);
+	g = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(p, 8), mask), 16);
+	b = _mm_and_si128(_mm_srl_epi32(p, bshift), mask);
+
+	y = _mm_add_epi32(
+		_mm_madd_epi16(_mm_or_si128(r, g),
+			       _mm_set1_epi32(19595 | 19234 << 16)),
+		_mm_madd_epi16(_mm_or_si128(b, g),
+			       _mm_set1_epi32(7472 | 19235 << 16)));
+	y = _mm_srli_epi32(y, 16);
+
+	d = _mm_sub_epi32(r, y);
+	d = _mm_or_si128(_mm_and_si128(d, _mm_set1_epi32(0xffff)),
+			 _mm_slli_epi32(d, 16));
+	*u = _mm_madd_epi16(d, _mm_set1_epi32(23364 | 23363 << 16));
+
+	d = _mm_sub_epi32(b, y);
+	d = _mm_or_si128(_mm_and_si128(d, _mm_set1_epi32(0xffff)),
+			 _mm_slli_epi32(d, 16));
+	*v = _mm_madd_epi16(d, _mm_set1_epi32(18481 | 18481 << 16));
+
+	return y;
+}
+
+/* clamp_uv() of four lanes, packed into the low four bytes. */
+static inline __m128i
+clamp_uv_sse2(__m128i u)
+{
+	u = _mm_add_epi32(_mm_srai_epi32(u, 18), _mm_set1_epi32(128));
+	u = _mm_packs_epi32(u, u);
+
+	return _mm_packus_epi16(u, u);
+}
+
+/* The C version divides by .3 in double precision and truncates;
+ * do exactly the same, two lanes at a time. */
+static inline __m128i
+div_3_sse2(__m128i u)
+{
+	const __m128d k = _mm_set1_pd(.3);
+	__m128i lo, hi;
+
+	lo = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(u), k));
+	u = _mm_shuffle_epi32(u, _MM_SHUFFLE(1, 0, 3, 2));
+	hi = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(u), k));
+
+	return _mm_unpacklo_epi64(lo, hi);
+}
+
+static inline void
+store32(unsigned char *dst, __m128i v)
+{
+	uint32_t w = _mm_cvtsi128_si32(v);
+
+	memcpy(dst, &w, sizeof w);
+}
+
+static int
+format_shifts(uint32_t format, __m128i *rshift, __m128i *bshift)
+{
+	switch (format) {
+	case WCAP_FORMAT_XRGB8888:
+		*rshift = _mm_cvtsi32_si128(16);
+		*bshift = _mm_cvtsi32_si128(0);
+		return 1;
+	case WCAP_FORMAT_XBGR8888:
+		*rshift = _mm_cvtsi32_si128(0);
+		*bshift = _mm_cvtsi32_si128(16);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Eight columns of two rows per iteration; returns the first column
+ * left for the C version. */
+static int
+yv12_rows_sse2(uint32_t format, const uint32_t *p1, const uint32_t *p2,
+	       unsigned char *y1, unsigned char *y2,
+	       unsigned char *u, unsigned char *v, int width)
+{
+	__m128i rshift, bshift, ya, yb, ua, ub, uc, ud, va, vb, vc, vd;
+	__m128 s, t;
+	int x;
+
+	if (!format_shifts(format, &rshift, &bshift))
+		return 0;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		ya = rgb_to_yuv_sse2(_mm_loadu_si128((__m128i *) (p1 + x)),
+				     rshift, bshift, &ua, &va);
+		yb = rgb_to_yuv_sse2(_mm_loadu_si128((__m128i *) (p1 + x + 4)),
+				     rshift, bshift, &ub, &vb);
+		ya = _mm_packs_epi32(ya, yb);
+		_mm_storel_epi64((__m128i *) (y1 + x),
+				 _mm_packus_epi16(ya, ya));
+
+		ya = rgb_to_yuv_sse2(_mm_loadu_si128((__m128i *) (p2 + x)),
+				     rshift, bshift, &uc, &vc);
+		yb = rgb_to_yuv_sse2(_mm_loadu_si128((__m128i *) (p2 + x + 4)),
+				     rshift, bshift, &ud, &vd);
+		ya = _mm_packs_epi32(ya, yb);
+		_mm_storel_epi64((__m128i *) (y2 + x),
+				 _mm_packus_epi16(ya, ya));
+
+		/* Sum each 2x2 block: the rows first, then
+		 * neighbouring columns. */
+		s = _mm_castsi128_ps(_mm_add_epi32(ua, uc));
+		t = _mm_castsi128_ps(_mm_add_epi32(ub, ud));
+		ua = _mm_add_epi32(
+			_mm_castps_si128(_mm_shuffle_ps(s, t, _MM_SHUFFLE(2, 0, 2, 0))),
+			_mm_castps_si128(_mm_shuffle_ps(s, t, _MM_SHUFFLE(3, 1, 3, 1))));
+		store32(u + x / 2, clamp_uv_sse2(ua));
+
+		s = _mm_castsi128_ps(_mm_add_epi32(va, vc));
+		t = _mm_castsi128_ps(_mm_add_epi32(vb, vd));
+		va = _mm_add_epi32(
+			_mm_castps_si128(_mm_shuffle_ps(s, t, _MM_SHUFFLE(2, 0, 2, 0))),
+			_mm_castps_si128(_mm_shuffle_ps(s, t, _MM_SHUFFLE(3, 1, 3, 1))));
+		store32(v + x / 2, clamp_uv_sse2(va));
+	}
+
+	return x;
+}
+
+static int
+yuv444_row_sse2(uint32_t format, const uint32_t *rp, unsigned char *yp,
+		unsigned char *up, unsigned char *vp, int width)
+{
+	__m128i rshift, bshift, y, u, v;
+	int x;
+
+	if (!format_shifts(format, &rshift, &bshift))
+		return 0;
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		y = rgb_to_yuv_sse2(_mm_loadu_si128((__m128i *) (rp + x)),
+				    rshift, bshift, &u, &v);
+		y = _mm_packs_epi32(y, y);
+		store32(yp + x, _mm_packus_epi16(y, y));
+		store32(up + x, clamp_uv_sse2(div_3_sse2(u)));
+		store32(vp + x, clamp_uv_sse2(div_3_sse2(v)));
+	}
+
+	return x;
+}
+
+#else
+
+static int
+yv12_rows_sse2(uint32_t format, const uint32_t *p1, const uint32_t *p2,
+	       unsigned char *y1, unsigned char *y2,
+	       unsigned char *u, unsigned char *v, int width)
+{
+	return 0;
+}
+
+static int
+yuv444_row_sse2(uint32_t format, const uint32_t *rp, unsigned char *yp,
+		unsigned char *up, unsigned char *vp, int width)
+{
+	return 0;
+}
+
+#endif
+
+static void
+convert_to_yv12(uint32_t format, const uint32_t *frame,
+		int width, int height, unsigned char *out, int simd)
+{
+	unsigned char *y1, *y2, *u, *v;
+	const uint32_t *p1, *p2;
+	int i, x, stride0, stride1;
+
+	stride0 = width;
+	stride1 = width / 2;
+	for (i = 0; i < height; i += 2) {
+		y1 = out + stride0 * i;
+		y2 = y1 + stride0;
+		v = out + stride0 * height + stride1 * i / 2;
+		u = v + stride1 * height / 2;
+		p1 = frame + width * i;
+		p2 = p1 + width;
+
+		x = 0;
+		if (simd)
+			x = yv12_rows_sse2(format, p1, p2,
+					   y1, y2, u, v, width);
+		yv12_rows_c(format, p1, p2, y1, y2, u, v, x, width);
+	}
+}
+
+static void
+convert_to_yuv444(uint32_t format, const uint32_t *frame,
+		  int width, int height, unsigned char *out, int simd)
+{
+	unsigned char *yp, *up, *vp;
+	const uint32_t *rp;
+	int i, x, stride, psize;
+
+	stride = width;
+	psize = stride * height;
+	for (i = 0; i < height; i++) {
+		yp = out + stride * i;
+		up = yp + (psize * 2);
+		vp = yp + (psize * 1);
+		rp = frame + width * i;
+
+		x = 0;
+		if (simd)
+			x = yuv444_row_sse2(format, rp, yp, up, vp, width);
+		yuv444_row_c(format, rp, yp, up, vp, x, width);
+	}
+}
+
+void
+wcap_convert_to_yv12(uint32_t format, const uint32_t *frame,
+		     int width, int height, unsigned char *out)
+{
+	convert_to_yv12(format, frame, width, height, out, 1);
+}
+
+void
+wcap_convert_to_yuv444(uint32_t format, const uint32_t *frame,
+		       int width, int height, unsigned char *out)
+{
+	convert_to_yuv444(format, frame, width, height, out, 1);
+}
+
+void
+wcap_convert_to_yv12_c(uint32_t format, const uint32_t *frame,
+		       int width, int height, unsigned char *out)
+{
+	convert_to_yv12(format, frame, width, height, out, 0);
+}
+
+void
+wcap_convert_to_yuv444_c(uint32_t format, const uint32_t *frame,
+			 int width, int height, unsigned char *out)
+{
+	convert_to_yuv444(format, frame, width, height, out, 0);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WCAP_YUV_
+#define _WCAP_YUV_
+
+#include <stdint.h>
+
+/* Convert a decoded frame to planar YV12 (w * h * 3 / 2 bytes) or
+ * YUV444 (w * h * 3 bytes).  These use SIMD where available and give
+ * the same output as the plain C versions below. */
+void wcap_convert_to_yv12(uint32_t format, const uint32_t *frame,
+			  int width, int height, unsigned char *out);
+void wcap_convert_to_yuv444(uint32_t format, const uint32_t *frame,
+			    int width, int height, unsigned char *out);
+
+void wcap_convert_to_yv12_c(uint32_t format, const uint32_t *frame,
+			    int width, int height, unsigned char *out);
+void wcap_convert_to_yuv444_c(uint32_t format, const uint32_t *frame,
+			      int width, int height, unsigned char *out);
+
+#endif